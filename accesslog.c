@@ -0,0 +1,245 @@
+/*
+ * accesslog.c - 비동기 access log (accesslog.h 참고)
+ *
+ * ring은 칸마다 sequence 번호를 둔 bounded MPMC queue (Vyukov) 모양이지만, 꺼내는 쪽은 writer 하나뿐.
+ * 넣는 쪽은 CAS 한번으로 칸을 잡고 기록을 복사한 뒤 sequence를 올려서 writer에게 넘김.
+ */
+#include <sys/uio.h>
+#include "csapp.h"
+#include "accesslog.h"
+
+#define ALOG_LINE_MAX (ALOG_URI_MAX + 256) // 한 줄 최대 길이
+#define ALOG_STRIPE 64                     // false sharing을 막기 위한 간격 (cache line)
+
+typedef struct
+{
+  unsigned long seq; // 이 칸 차례 (넣을 수 있으면 pos, 꺼낼 수 있으면 pos + 1)
+  alog_record rec;
+} alog_cell;
+
+typedef struct
+{
+  unsigned long head __attribute__((aligned(ALOG_STRIPE))); // 다음에 넣을 위치 (요청 쓰레드들이 CAS로 올림)
+  unsigned long tail __attribute__((aligned(ALOG_STRIPE))); // 다음에 꺼낼 위치 (writer만 씀)
+  alog_cell cells[ALOG_RING_SIZE];
+} alog_ring;
+
+static alog_ring rings[ALOG_SHARDS];
+static int logfd = -1;
+static long dropped;                 // ring이 꽉 차서 버린 기록 수
+static unsigned nextShard;           // 새 쓰레드에게 나눠줄 ring 번호
+static __thread int myShard = -1;    // 이 쓰레드가 쓰는 ring
+
+static const char *cacheNames[] = {"-", "HIT", "MISS", "SEGMENT", "NEGATIVE"};
+
+static void *alog_writer(void *vargp);
+
+void alog_init(const char *path, pthread_attr_t *attr)
+{
+  pthread_t tid;
+  int i, j;
+
+  for (i = 0; i < ALOG_SHARDS; i++)
+  {
+    rings[i].head = rings[i].tail = 0;
+    for (j = 0; j < ALOG_RING_SIZE; j++)
+      rings[i].cells[j].seq = j;
+  }
+  if (!path)
+    logfd = STDOUT_FILENO;
+  else if ((logfd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0)
+    unix_error("access log open error");
+  if ((errno = pthread_create(&tid, attr, alog_writer, NULL)) != 0)
+    unix_error("access log writer error");
+  pthread_detach(tid);
+}
+
+void alog_begin(alog_record *rec, struct sockaddr *client, socklen_t len, struct timespec *accepted)
+{
+  int i;
+
+  clock_gettime(CLOCK_REALTIME, &rec->wall);
+  rec->start = *accepted;
+  if (len > sizeof(rec->client))
+    len = sizeof(rec->client);
+  memcpy(&rec->client, client, len);
+  rec->clientLen = len;
+  rec->method[0] = rec->uri[0] = '\0';
+  rec->status = 0;
+  rec->bytes = 0;
+  rec->received = 0;
+  rec->cache = ALOG_CACHE_NONE;
+  for (i = 0; i < ALOG_PHASES; i++)
+    rec->phase[i] = -1;
+}
+
+/* src를 dst에 잘라서 복사 (공백, 제어 문자는 로그 한 줄이 깨지지 않게 바꿈) */
+static void copy_field(char *dst, const char *src, size_t max)
+{
+  size_t i;
+
+  for (i = 0; i + 1 < max && src[i]; i++)
+    dst[i] = (unsigned char)src[i] <= ' ' || src[i] == 0x7f ? '_' : src[i];
+  dst[i] = '\0';
+}
+
+void alog_request(alog_record *rec, const char *method, const char *uri)
+{
+  copy_field(rec->method, method, sizeof(rec->method));
+  copy_field(rec->uri, uri, sizeof(rec->uri));
+}
+
+void alog_mark(alog_record *rec, int phase)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  rec->phase[phase] = (now.tv_sec - rec->start.tv_sec) * 1000000 + (now.tv_nsec - rec->start.tv_nsec) / 1000;
+}
+
+void alog_submit(alog_record *rec)
+{
+  alog_ring *r;
+  alog_cell *cell;
+  unsigned long pos;
+  long diff;
+
+  if (myShard < 0)
+    myShard = __atomic_fetch_add(&nextShard, 1, __ATOMIC_RELAXED) % ALOG_SHARDS;
+  r = &rings[myShard];
+
+  pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+  for (;;)
+  {
+    cell = &r->cells[pos & (ALOG_RING_SIZE - 1)];
+    diff = (long)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+    if (diff == 0)
+    {
+      if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    else if (diff < 0) // writer가 아직 꺼내지 않은 칸 (꽉 참): 기다리지 않고 버림
+    {
+      __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+    else
+      pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+  }
+  cell->rec = *rec;
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+long alog_dropped(void)
+{
+  return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+/* ring에서 하나 꺼내기 (없으면 0) */
+static int ring_pop(alog_ring *r, alog_record *rec)
+{
+  alog_cell *cell = &r->cells[r->tail & (ALOG_RING_SIZE - 1)];
+
+  if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != r->tail + 1)
+    return 0;
+  *rec = cell->rec;
+  __atomic_store_n(&cell->seq, r->tail + ALOG_RING_SIZE, __ATOMIC_RELEASE);
+  r->tail++;
+  return 1;
+}
+
+/* 기록 하나를 한 줄로
+ * 시각 client method uri status bytes received cache read/connect/header/done(us) */
+static int format_record(char *line, alog_record *rec)
+{
+  char host[NI_MAXHOST], when[32], phases[ALOG_PHASES][16];
+  struct tm tm;
+  int i;
+
+  if (getnameinfo((struct sockaddr *)&rec->client, rec->clientLen, host, sizeof(host), NULL, 0, NI_NUMERICHOST))
+    strcpy(host, "?");
+  gmtime_r(&rec->wall.tv_sec, &tm);
+  strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+  for (i = 0; i < ALOG_PHASES; i++)
+  {
+    if (rec->phase[i] < 0)
+      strcpy(phases[i], "-");
+    else
+      snprintf(phases[i], sizeof(phases[i]), "%d", rec->phase[i]);
+  }
+  return snprintf(line, ALOG_LINE_MAX, "%s.%03ldZ %s \"%s %s\" %d %ld %ld %s %s/%s/%s/%s\n",
+                  when, rec->wall.tv_nsec / 1000000, host,
+                  rec->method[0] ? rec->method : "-", rec->uri[0] ? rec->uri : "-",
+                  rec->status, rec->bytes, rec->received, cacheNames[rec->cache],
+                  phases[ALOG_PHASE_READ], phases[ALOG_PHASE_CONNECT], phases[ALOG_PHASE_HEADER], phases[ALOG_PHASE_DONE]);
+}
+
+/* iov 전체를 씀 (중간에 잘리면 남은 부분부터 다시) */
+static void writev_all(struct iovec *iov, int cnt)
+{
+  ssize_t n;
+
+  while (cnt > 0)
+  {
+    if ((n = writev(logfd, iov, cnt)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return; // 로그를 못 쓰는 건 요청 처리와 상관없으므로 이번 묶음만 버림
+    }
+    while (cnt > 0 && n >= (ssize_t)iov->iov_len)
+    {
+      n -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0)
+    {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+}
+
+/* ring들을 돌아가며 비우고 ALOG_BATCH 줄씩 모아서 씀. 쌓인 게 없으면 잠깐 쉼 */
+static void *alog_writer(void *vargp)
+{
+  static char lines[ALOG_BATCH][ALOG_LINE_MAX];
+  struct iovec iov[ALOG_BATCH];
+  alog_record rec;
+  long reported = 0, now;
+  int i, cnt, found;
+
+  for (;;)
+  {
+    cnt = 0;
+    do
+    {
+      found = 0;
+      for (i = 0; i < ALOG_SHARDS && cnt < ALOG_BATCH; i++)
+      {
+        if (!ring_pop(&rings[i], &rec))
+          continue;
+        iov[cnt].iov_base = lines[cnt];
+        iov[cnt].iov_len = format_record(lines[cnt], &rec);
+        if (iov[cnt].iov_len >= ALOG_LINE_MAX)
+          iov[cnt].iov_len = ALOG_LINE_MAX - 1;
+        cnt++;
+        found = 1;
+      }
+    } while (found && cnt < ALOG_BATCH);
+
+    if ((now = alog_dropped()) != reported && cnt < ALOG_BATCH) // 버린 기록이 있었으면 같이 남김
+    {
+      iov[cnt].iov_base = lines[cnt];
+      iov[cnt].iov_len = snprintf(lines[cnt], ALOG_LINE_MAX, "access log: dropped %ld records\n", now - reported);
+      cnt++;
+      reported = now;
+    }
+    if (cnt)
+      writev_all(iov, cnt);
+    if (cnt < ALOG_BATCH)
+      usleep(ALOG_IDLE_MS * 1000);
+  }
+  return NULL;
+}
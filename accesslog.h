@@ -0,0 +1,64 @@
+/*
+ * accesslog.h - 요청마다 한 줄씩 남기는 비동기 access log
+ *
+ * 요청 쓰레드는 고정 크기 기록(alog_record)을 lock-free ring에 복사만 하고 바로 돌아감.
+ * 이름 바꾸기, 시간 포맷, 파일 쓰기는 백그라운드 writer 쓰레드가 모아서 writev 한번으로 처리함.
+ * ring이 꽉 차면 (writer가 못 따라가면) 요청을 기다리게 하지 않고 기록을 버리고 버린 수만 셈.
+ */
+#ifndef __ACCESSLOG_H__
+#define __ACCESSLOG_H__
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#define ALOG_SHARDS 8       // ring 개수. 쓰레드마다 하나씩 정해서 씀 (연결마다 쓰레드가 새로 생기므로 돌아가며 나눠 가짐)
+#define ALOG_RING_SIZE 256  // ring 하나의 칸 수 (2의 거듭제곱)
+#define ALOG_METHOD_MAX 16  // 기록할 method 최대 길이
+#define ALOG_URI_MAX 256    // 기록할 URI 최대 길이 (넘으면 잘라서 남김)
+#define ALOG_BATCH 64       // writev 한번에 쓰는 최대 줄 수
+#define ALOG_IDLE_MS 50     // ring이 비어있을 때 writer가 쉬는 시간
+
+// 캐시 처리 결과
+enum
+{
+  ALOG_CACHE_NONE = 0, // 캐시와 상관없음 (에러, 통계 요청 등)
+  ALOG_CACHE_HIT,      // 캐시 블럭에서 응답
+  ALOG_CACHE_MISS,     // endserver에서 받아서 응답
+  ALOG_CACHE_SEGMENT,  // 큰 객체를 segment 캐시로 응답
+  ALOG_CACHE_NEGATIVE  // 기억해둔 실패 응답
+};
+
+// 요청 처리 단계. accept 시각부터 각 단계가 끝날 때까지 걸린 시간을 남김
+enum
+{
+  ALOG_PHASE_READ = 0, // 요청 header를 다 받고 파싱함
+  ALOG_PHASE_CONNECT,  // endserver에 연결함
+  ALOG_PHASE_HEADER,   // endserver 응답 header를 받음 (first byte)
+  ALOG_PHASE_DONE,     // 응답을 다 씀
+  ALOG_PHASES
+};
+
+typedef struct
+{
+  struct timespec wall;              // accept한 시각 (기록에 남길 시각)
+  struct timespec start;             // accept한 시각 (CLOCK_MONOTONIC, 단계별 시간 기준)
+  struct sockaddr_storage client;    // 클라이언트 주소 (writer에서 숫자로 바꿈)
+  socklen_t clientLen;
+  char method[ALOG_METHOD_MAX];
+  char uri[ALOG_URI_MAX];
+  int status;                        // 클라이언트에 보낸 status (보내지 못했으면 0)
+  long bytes;                        // 클라이언트에 보낸 byte 수 (header 포함)
+  long received;                     // 요청 header 뒤에 클라이언트에서 받은 byte 수 (요청 body, 터널)
+  int cache;                         // ALOG_CACHE_*
+  int phase[ALOG_PHASES];            // 단계별 accept 이후 경과 시간 (us, 그 단계까지 못갔으면 -1)
+} alog_record;
+
+void alog_init(const char *path, pthread_attr_t *attr);              // 로그 파일을 열고 writer 쓰레드 시작 (path가 NULL이면 stdout)
+void alog_begin(alog_record *rec, struct sockaddr *client, socklen_t len, struct timespec *accepted); // 새 기록 (accepted: accept 시각, CLOCK_MONOTONIC)
+void alog_request(alog_record *rec, const char *method, const char *uri); // method, URI 기록 (잘라서 복사)
+void alog_mark(alog_record *rec, int phase);                          // 단계 시간 기록
+void alog_submit(alog_record *rec);                                   // ring에 넣음 (꽉 찼으면 버림)
+long alog_dropped(void);                                              // 지금까지 버린 기록 수
+
+#endif /* __ACCESSLOG_H__ */
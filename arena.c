@@ -0,0 +1,174 @@
+/*
+ * arena.c - 요청 하나를 처리하는 동안 쓰는 bump allocator (arena.h 참고)
+ */
+#include "csapp.h"
+#include "arena.h"
+
+#define ARENA_ALIGN(n) (((n) + 15) & ~(size_t)15)
+#define CLASS_BYTES(cls) ((size_t)ARENA_CHUNK_SIZE << (cls)) // header 포함 chunk 크기
+
+static __thread arena_chunk *localFree[ARENA_CLASSES]; // 이 쓰레드가 다 쓰고 돌려준 chunk
+static arena_hook hook;                                // chunk 크기 변화 알림 (없으면 NULL)
+
+static struct
+{
+  arena_chunk *free[ARENA_CLASSES]; // 끝난 쓰레드들이 남긴 chunk
+  size_t bytes;                     // free에 쌓인 크기 합
+  sem_t mutex;
+} pool;
+
+/* n byte를 담을 수 있는 chunk 하나 가져오기. 쓰레드 free list, 공용 pool 순서로 찾고 없을 때만 malloc */
+static arena_chunk *chunk_get(size_t n)
+{
+  arena_chunk *c;
+  int cls;
+
+  for (cls = 0; cls < ARENA_CLASSES; cls++)
+    if (CLASS_BYTES(cls) - sizeof(arena_chunk) >= n)
+      break;
+  if (cls == ARENA_CLASSES) // 가장 큰 chunk보다 크면 그때만 따로 받음
+  {
+    c = Malloc(sizeof(arena_chunk) + n);
+    c->cls = -1;
+    c->size = n;
+    return c;
+  }
+
+  if ((c = localFree[cls]))
+    localFree[cls] = c->next;
+  else
+  {
+    P(&pool.mutex);
+    if ((c = pool.free[cls]))
+    {
+      pool.free[cls] = c->next;
+      pool.bytes -= CLASS_BYTES(cls);
+    }
+    V(&pool.mutex);
+  }
+  if (!c)
+  {
+    c = Malloc(CLASS_BYTES(cls));
+    c->cls = cls;
+    c->size = CLASS_BYTES(cls) - sizeof(arena_chunk);
+  }
+  return c;
+}
+
+void arena_pool_init(void)
+{
+  memset(pool.free, 0, sizeof(pool.free));
+  pool.bytes = 0;
+  Sem_init(&pool.mutex, 0, 1);
+}
+
+void arena_set_hook(arena_hook h)
+{
+  hook = h;
+}
+
+void arena_init(arena_t *a)
+{
+  a->head = NULL;
+  a->bytes = a->used = 0;
+}
+
+void *arena_alloc(arena_t *a, size_t n)
+{
+  arena_chunk *c = a->head;
+  void *p;
+
+  n = ARENA_ALIGN(n ? n : 1);
+  if (!c || c->size - c->used < n) // 남은 자리가 모자라면 새 chunk (남은 자리는 버림)
+  {
+    c = chunk_get(n);
+    c->used = 0;
+    c->next = a->head;
+    a->head = c;
+    a->bytes += sizeof(arena_chunk) + c->size;
+    if (hook)
+      hook(sizeof(arena_chunk) + c->size);
+  }
+  p = c->data + c->used;
+  c->used += n;
+  a->used += n;
+  return p;
+}
+
+void *arena_resize(arena_t *a, void *p, size_t oldSize, size_t newSize)
+{
+  arena_chunk *c = a->head;
+  size_t off;
+  void *q;
+
+  // 마지막으로 할당한 구간이면 chunk 안에서 끝만 옮김
+  if (p && c && (char *)p >= c->data && (char *)p + ARENA_ALIGN(oldSize) == c->data + c->used)
+  {
+    off = (char *)p - c->data;
+    a->used -= c->used - off;
+    c->used = off; // 일단 되돌려두고 (자리가 모자라면 다음 chunk로 옮겨도 내용은 그대로 남아있음)
+    if (c->size - off >= ARENA_ALIGN(newSize))
+    {
+      c->used += ARENA_ALIGN(newSize);
+      a->used += ARENA_ALIGN(newSize);
+      return p;
+    }
+  }
+  q = arena_alloc(a, newSize);
+  if (p)
+    memcpy(q, p, oldSize < newSize ? oldSize : newSize);
+  return q;
+}
+
+char *arena_strndup(arena_t *a, const char *s, size_t n)
+{
+  char *p = arena_alloc(a, n + 1);
+  memcpy(p, s, n);
+  p[n] = '\0';
+  return p;
+}
+
+void arena_release(arena_t *a)
+{
+  arena_chunk *c, *next;
+
+  if (hook && a->bytes)
+    hook(-(long)a->bytes);
+  for (c = a->head; c; c = next)
+  {
+    next = c->next;
+    if (c->cls < 0)
+      Free(c);
+    else
+    {
+      c->next = localFree[c->cls];
+      localFree[c->cls] = c;
+    }
+  }
+  arena_init(a);
+}
+
+void arena_thread_exit(void)
+{
+  arena_chunk *c, *next;
+  int cls;
+
+  P(&pool.mutex);
+  for (cls = 0; cls < ARENA_CLASSES; cls++)
+  {
+    for (c = localFree[cls]; c; c = next)
+    {
+      next = c->next;
+      if (pool.bytes + CLASS_BYTES(cls) > ARENA_POOL_MAX)
+      {
+        Free(c);
+        continue;
+      }
+      c->next = pool.free[cls];
+      pool.free[cls] = c;
+      pool.bytes += CLASS_BYTES(cls);
+    }
+    localFree[cls] = NULL;
+  }
+  V(&pool.mutex);
+}
@@ -0,0 +1,47 @@
+/*
+ * arena.h - 요청 하나를 처리하는 동안 쓰는 bump allocator
+ *
+ * 필요한 버퍼를 chunk 앞에서부터 잘라 쓰고 (하나씩 free하지 않음), 요청이 끝나면 chunk를 통째로 돌려줌.
+ * 돌려받은 chunk는 쓰레드별 free list에 두었다가 다음 할당에 다시 씀. 연결마다 쓰레드를 새로 만들기 때문에
+ * 쓰레드가 끝날 때 남은 chunk는 공용 pool로 옮겨두고, 새 쓰레드는 pool에서 이어받음.
+ * 한번 데워지면 요청을 처리하는 동안 malloc/free를 부르지 않음.
+ */
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE 24576   // 가장 작은 chunk 크기 (작은 객체 요청 하나가 chunk 하나로 끝나는 크기)
+#define ARENA_CLASSES 4          // chunk 크기 종류 (ARENA_CHUNK_SIZE의 1, 2, 4, 8배). 이보다 큰 할당은 그때만 malloc
+#define ARENA_POOL_MAX (4 << 20) // 공용 pool에 쌓아둘 최대 byte 수 (넘는 chunk는 반납)
+
+typedef struct arena_chunk
+{
+  struct arena_chunk *next;
+  int cls;     // 크기 종류 (-1이면 pool에 넣지 않는 큰 chunk)
+  size_t size; // data 크기
+  size_t used; // 앞에서부터 쓴 크기
+  char data[] __attribute__((aligned(16)));
+} arena_chunk;
+
+typedef struct
+{
+  arena_chunk *head; // 지금 잘라 쓰는 chunk (앞의 chunk들은 next로 연결)
+  size_t bytes;      // 가지고 있는 chunk 크기 합
+  size_t used;       // 실제로 할당한 크기 합
+} arena_t;
+
+typedef void (*arena_hook)(long delta); // arena가 chunk를 잡거나(+) 돌려줄 때(-) 크기를 알려받는 함수
+
+void arena_pool_init(void);                                                // 공용 pool 초기화 (쓰레드 만들기 전에 한번)
+void arena_set_hook(arena_hook hook);                                      // 메모리 사용량 집계용 hook (그 arena를 쓰는 쓰레드에서 불림)
+void arena_init(arena_t *a);                                               // 빈 arena (chunk는 처음 할당할 때 가져옴)
+void *arena_alloc(arena_t *a, size_t n);                                   // n byte (16 byte 정렬)
+void *arena_resize(arena_t *a, void *p, size_t oldSize, size_t newSize);   // 마지막 할당이면 제자리에서 늘리거나 줄임, 아니면 새로 받아서 복사
+char *arena_strndup(arena_t *a, const char *s, size_t n);                  // s 앞 n byte를 문자열로 복사
+void arena_release(arena_t *a);                                            // chunk를 전부 쓰레드 free list로 돌려줌
+void arena_thread_exit(void);                                              // 쓰레드 free list를 공용 pool로 옮김 (쓰레드 끝날 때)
+
+#define arena_strdup(a, s) arena_strndup((a), (s), strlen(s))
+
+#endif /* __ARENA_H__ */
@@ -0,0 +1,496 @@
+/*
+ * backend.c - reverse proxy backend pool과 부하 분산, circuit breaker (backend.h 참고)
+ */
+#include "csapp.h"
+#include "backend.h"
+#include "resolver.h"
+
+typedef struct
+{
+  char host[BACKEND_HOST_MAX];
+  int port;
+  int weight;
+  long outstanding; // 처리 중인 요청 수
+  long picked;      // 지금까지 고른 수
+
+  // circuit breaker (ejected, until, trial은 고를 때 잠그지 않고 읽음)
+  int ejected;      // 빠져있는지
+  long until;       // 이 시각(ms)이 지나면 half-open
+  int trial;        // half-open에서 보내보는 요청이 나가있는지
+  int ejections;    // 연속으로 뺀 횟수 (빼두는 시간을 늘림)
+  long ejectCount;  // 지금까지 뺀 횟수
+  unsigned window;  // 최근 요청 결과 (bit 1이 실패)
+  int nwindow;      // window에 든 결과 수
+  int consecutive;  // 연속 실패 수
+  int probeFails;   // health check 연속 실패 수
+  sem_t mutex;      // breaker 상태 바꿀 때
+} backend;
+
+typedef struct
+{
+  unsigned hash; // ring 위의 위치
+  int idx;       // backend 번호
+} ring_point;
+
+static const char *policyNames[BACKEND_POLICIES] = {"least", "p2c", "hash"};
+
+static backend backends[BACKEND_MAX];
+static int nbackends;
+static int policy = BACKEND_LEAST;
+static ring_point *ring; // hash 순서로 정렬한 점들
+static int nring;
+static unsigned long rr;                  // least에서 같을 때 돌아가며 고르기 위한 시작 위치
+static __thread unsigned long randState;  // p2c 난수 (쓰레드마다)
+static __thread unsigned trials;          // 이 쓰레드가 half-open 요청을 맡은 backend bit (hedge로 둘을 같이 고를 수 있음)
+
+static void *health_thread(void *vargp);
+
+static long now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static unsigned hash_str(const char *s, int salt)
+{
+  unsigned h = 2166136261u; // FNV-1a 후 섞어줌 (비슷한 문자열이 ring에 몰리지 않도록)
+
+  for (; *s; s++)
+    h = (h ^ (unsigned char)*s) * 16777619u;
+  h ^= salt * 0x9e3779b9u;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+int backend_add(char *spec)
+{
+  char *colon = strrchr(spec, ':'), *at, *end;
+  backend *b;
+  long port, weight = 1;
+
+  if (nbackends == BACKEND_MAX || !colon || colon == spec || colon - spec >= BACKEND_HOST_MAX)
+    return -1;
+  port = strtol(colon + 1, &end, 10);
+  if (*end == '@')
+  {
+    at = end;
+    weight = strtol(at + 1, &end, 10);
+    if (end == at + 1)
+      return -1;
+  }
+  if (end == colon + 1 || *end || port <= 0 || port > 65535 || weight < 1 || weight > BACKEND_WEIGHT_MAX)
+    return -1;
+  b = &backends[nbackends++];
+  memcpy(b->host, spec, colon - spec);
+  b->host[colon - spec] = '\0';
+  b->port = port;
+  b->weight = weight;
+  return 0;
+}
+
+int backend_setPolicy(char *name)
+{
+  for (int k = 0; k < BACKEND_POLICIES; k++)
+    if (!strcmp(name, policyNames[k]))
+    {
+      policy = k;
+      return 0;
+    }
+  return -1;
+}
+
+static int ring_cmp(const void *a, const void *b)
+{
+  unsigned x = ((ring_point *)a)->hash, y = ((ring_point *)b)->hash;
+  return x < y ? -1 : x > y;
+}
+
+void backend_init(pthread_attr_t *attr)
+{
+  char key[BACKEND_HOST_MAX + 16];
+  int i, v, totalWeight = 0;
+  pthread_t tid;
+
+  if (!nbackends)
+    return;
+  for (i = 0; i < nbackends; i++)
+  {
+    totalWeight += backends[i].weight;
+    Sem_init(&backends[i].mutex, 0, 1);
+  }
+  ring = Malloc(totalWeight * BACKEND_VNODES * sizeof(ring_point));
+  for (i = 0; i < nbackends; i++)
+  {
+    snprintf(key, sizeof(key), "%s:%d", backends[i].host, backends[i].port);
+    for (v = 0; v < backends[i].weight * BACKEND_VNODES; v++)
+    {
+      ring[nring].hash = hash_str(key, v);
+      ring[nring++].idx = i;
+    }
+  }
+  qsort(ring, nring, sizeof(ring_point), ring_cmp);
+  Pthread_create(&tid, attr, health_thread, NULL);
+}
+
+int backend_count(void)
+{
+  return nbackends;
+}
+
+/* 보낼 수 있는지. 빠져있어도 시간이 지났고 보내보는 요청이 없으면 half-open으로 하나 보낼 수 있음 */
+static int available(int i, long now)
+{
+  backend *b = &backends[i];
+
+  if (!__atomic_load_n(&b->ejected, __ATOMIC_ACQUIRE))
+    return 1;
+  return now >= __atomic_load_n(&b->until, __ATOMIC_RELAXED) && !__atomic_load_n(&b->trial, __ATOMIC_RELAXED);
+}
+
+/* a가 b보다 한가한지 (처리 중인 요청 수를 weight로 나눠서 비교) */
+static int less_loaded(int a, int b)
+{
+  long oa = __atomic_load_n(&backends[a].outstanding, __ATOMIC_RELAXED);
+  long ob = __atomic_load_n(&backends[b].outstanding, __ATOMIC_RELAXED);
+
+  return (oa + 1) * backends[b].weight < (ob + 1) * backends[a].weight;
+}
+
+static int pick_least(unsigned ok)
+{
+  int start = __atomic_fetch_add(&rr, 1, __ATOMIC_RELAXED) % nbackends;
+  int best = -1, i, j;
+
+  for (i = 0; i < nbackends; i++)
+  {
+    j = (start + i) % nbackends;
+    if ((ok >> j & 1) && (best < 0 || less_loaded(j, best)))
+      best = j;
+  }
+  return best;
+}
+
+/* 보낼 수 있는 backend 중 weight 비율로 무작위 하나 (xorshift) */
+static int pick_random(unsigned ok)
+{
+  int total = 0, r, i;
+
+  for (i = 0; i < nbackends; i++)
+    if (ok >> i & 1)
+      total += backends[i].weight;
+  if (!randState)
+    randState = (unsigned long)pthread_self() ^ time(NULL) ^ 0x2545f4914f6cdd1dUL;
+  randState ^= randState << 13;
+  randState ^= randState >> 7;
+  randState ^= randState << 17;
+  r = randState % total;
+  for (i = 0; !(ok >> i & 1) || r >= backends[i].weight; i++)
+    if (ok >> i & 1)
+      r -= backends[i].weight;
+  return i;
+}
+
+static int pick_p2c(unsigned ok)
+{
+  int a = pick_random(ok), b = a, tries;
+
+  for (tries = 0; b == a && tries < 4; tries++) // 다른 backend가 나올 때까지 몇번만 (weight가 한쪽에 몰려있으면 같은 것)
+    b = pick_random(ok);
+  return less_loaded(b, a) ? b : a;
+}
+
+/* key의 hash 이상인 첫 점부터 보낼 수 있는 backend가 나올 때까지 (끝이면 처음으로 돌아감) */
+static int pick_hash(char *key, unsigned ok)
+{
+  unsigned h = hash_str(key, 0);
+  int lo = 0, hi = nring, i;
+
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (ring[mid].hash < h)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (i = 0; i < nring; i++)
+    if (ok >> ring[(lo + i) % nring].idx & 1)
+      return ring[(lo + i) % nring].idx;
+  return -1;
+}
+
+int backend_pick(char *key, unsigned skip)
+{
+  long now = now_ms();
+  unsigned ok = 0;
+  int idx, i;
+
+  for (i = 0; i < nbackends; i++)
+    if (!(skip >> i & 1) && available(i, now))
+      ok |= 1u << i;
+  while (ok)
+  {
+    if (policy == BACKEND_HASH)
+      idx = pick_hash(key, ok);
+    else if (policy == BACKEND_P2C)
+      idx = pick_p2c(ok);
+    else
+      idx = pick_least(ok);
+    // 빠져있던 backend면 보내보는 요청을 맡아야 함 (다른 쓰레드가 먼저 맡았으면 다시 고름)
+    if (__atomic_load_n(&backends[idx].ejected, __ATOMIC_ACQUIRE))
+    {
+      int expected = 0;
+      if (!__atomic_compare_exchange_n(&backends[idx].trial, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      {
+        ok &= ~(1u << idx);
+        continue;
+      }
+      trials |= 1u << idx;
+    }
+    __atomic_fetch_add(&backends[idx].outstanding, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&backends[idx].picked, 1, __ATOMIC_RELAXED);
+    return idx;
+  }
+  return -1;
+}
+
+/* 빼기. 뺄 때마다 빼두는 시간을 두배로 늘림. mutex를 잡고 불러야 함 */
+static void eject(backend *b, long now)
+{
+  long ms = (long)BACKEND_EJECT_MS << (b->ejections < 5 ? b->ejections : 5);
+
+  b->ejections++;
+  b->ejectCount++;
+  __atomic_store_n(&b->until, now + (ms < BACKEND_EJECT_MAX_MS ? ms : BACKEND_EJECT_MAX_MS), __ATOMIC_RELAXED);
+  __atomic_store_n(&b->trial, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&b->ejected, 1, __ATOMIC_RELEASE);
+  b->window = b->nwindow = b->consecutive = 0;
+}
+
+/* 되돌리기. mutex를 잡고 불러야 함 */
+static void restore(backend *b)
+{
+  __atomic_store_n(&b->ejected, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&b->trial, 0, __ATOMIC_RELAXED);
+  b->ejections = 0;
+  b->window = b->nwindow = b->consecutive = 0;
+}
+
+void backend_done(int idx, int result)
+{
+  backend *b = &backends[idx];
+  unsigned mask = (1u << BACKEND_WINDOW) - 1;
+  int fails, holdsTrial = trials >> idx & 1;
+
+  __atomic_fetch_sub(&b->outstanding, 1, __ATOMIC_RELAXED);
+  P(&b->mutex);
+  if (result == BACKEND_UNKNOWN)
+  {
+    if (holdsTrial) // 보내보지 못했으면 다음 요청이 보내보게 함
+      __atomic_store_n(&b->trial, 0, __ATOMIC_RELAXED);
+  }
+  else if (b->ejected)
+  {
+    if (holdsTrial) // half-open에서 보내본 결과
+    {
+      if (result == BACKEND_OK)
+        restore(b);
+      else
+        eject(b, now_ms());
+    }
+  }
+  else
+  {
+    b->window = (b->window << 1 | (result == BACKEND_FAILED)) & mask;
+    if (b->nwindow < BACKEND_WINDOW)
+      b->nwindow++;
+    b->consecutive = result == BACKEND_FAILED ? b->consecutive + 1 : 0;
+    fails = __builtin_popcount(b->window);
+    if (b->consecutive >= BACKEND_EJECT_CONSECUTIVE ||
+        (b->nwindow >= BACKEND_WINDOW_MIN && fails * 100 >= b->nwindow * BACKEND_EJECT_PERCENT))
+      eject(b, now_ms());
+  }
+  V(&b->mutex);
+  trials &= ~(1u << idx);
+}
+
+char *backend_host(int idx)
+{
+  return backends[idx].host;
+}
+
+int backend_port(int idx)
+{
+  return backends[idx].port;
+}
+
+int backend_format(char *buf, size_t size)
+{
+  long now = now_ms(), until;
+  int len = 0;
+
+  for (int i = 0; i < nbackends && len < size; i++)
+  {
+    backend *b = &backends[i];
+    len += snprintf(buf + len, size - len, "backend %s:%d weight %d, outstanding %ld, picked %ld, ejected %ld times (%s), ",
+                    b->host, b->port, b->weight, __atomic_load_n(&b->outstanding, __ATOMIC_RELAXED),
+                    __atomic_load_n(&b->picked, __ATOMIC_RELAXED), b->ejectCount, policyNames[policy]);
+    if (len >= size)
+      break;
+    until = __atomic_load_n(&b->until, __ATOMIC_RELAXED);
+    if (!__atomic_load_n(&b->ejected, __ATOMIC_RELAXED))
+      len += snprintf(buf + len, size - len, "up\n");
+    else if (now < until)
+      len += snprintf(buf + len, size - len, "ejected for %ldms\n", until - now);
+    else
+      len += snprintf(buf + len, size - len, "half-open\n");
+  }
+  return len < size ? len : size - 1; // 잘렸으면 쓴 만큼만
+}
+
+/* health check 하나의 진행 상태 (backend마다 하나씩 두고 한 poll로 같이 기다림) */
+typedef struct
+{
+  resolver_addr addrs[RESOLVER_MAX_ADDRS]; // 연결해볼 주소들
+  int naddrs, next;                        // 주소 수, 다음에 연결해볼 주소
+  int fd;                                  // -1이면 끝남
+  int sent;                                // 요청을 보냈는지 (보내기 전에는 연결되기를 기다림)
+  int len;                                 // 받은 status line 앞부분 길이
+  char buf[12];                            // "HTTP/1.x NNN"
+} probe_state;
+
+/* 다음 주소로 non-blocking 연결을 시작만 함. 남은 주소가 없으면 -1 */
+static int probe_connect(probe_state *st)
+{
+  resolver_addr *a;
+  int fd;
+
+  while (st->next < st->naddrs)
+  {
+    a = &st->addrs[st->next++];
+    if ((fd = socket(a->family, a->socktype, a->protocol)) < 0)
+      continue;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    if (!connect(fd, (SA *)&a->addr, a->addrlen) || errno == EINPROGRESS)
+      return fd;
+    close(fd);
+  }
+  return -1;
+}
+
+/* poll에서 깨어난 health check를 한 단계 진행함. 연결되면 BACKEND_PROBE_PATH를 GET 하고, status line 앞부분을 다 받으면 끝냄
+ * 끝나면 fd를 -1로 두고, status가 5xx가 아니면 *ok를 세움 */
+static void probe_step(backend *b, probe_state *st, int *ok)
+{
+  char req[MAXLINE];
+  int err = 0, n;
+  socklen_t errlen = sizeof(err);
+
+  if (!st->sent)
+  {
+    if (getsockopt(st->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err) // 연결 실패면 다음 주소로
+    {
+      close(st->fd);
+      st->fd = probe_connect(st);
+      return;
+    }
+    n = snprintf(req, MAXLINE, "GET %s HTTP/1.0\r\nHost: %s\r\nConnection: close\r\n\r\n", BACKEND_PROBE_PATH, b->host);
+    if (write(st->fd, req, n) == n) // 새 연결의 송신 버퍼는 비어있으므로 한번에 다 써짐
+    {
+      st->sent = 1;
+      return;
+    }
+  }
+  else
+  {
+    n = read(st->fd, st->buf + st->len, sizeof(st->buf) - st->len);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+      return;
+    if (n > 0 && (st->len += n) < sizeof(st->buf))
+      return;
+    if (st->len == sizeof(st->buf) && !strncmp(st->buf, "HTTP/1.", 7))
+    {
+      n = atoi(st->buf + 9);
+      *ok = n >= 100 && n < 500;
+    }
+  }
+  close(st->fd);
+  st->fd = -1;
+}
+
+/* 모든 backend에 health check를 같이 보내고 한 poll로 기다림. backend 수와 상관없이 한 번에 BACKEND_PROBE_TIMEOUT_MS 안에 끝남
+ * (하나씩 차례로 하면 응답하지 않는 backend마다 제한 시간만큼 밀려서 뒤의 backend는 BACKEND_PROBE_MS마다 확인되지 못함) */
+static void probe_all(int *ok)
+{
+  static probe_state st[BACKEND_MAX];
+  struct pollfd pfds[BACKEND_MAX];
+  int idx[BACKEND_MAX];
+  long deadline = now_ms() + BACKEND_PROBE_TIMEOUT_MS, left;
+  char port[16];
+  int i, k, n;
+
+  for (i = 0; i < nbackends; i++)
+  {
+    ok[i] = 0;
+    st[i].next = st[i].sent = st[i].len = 0;
+    sprintf(port, "%d", backends[i].port);
+    st[i].naddrs = resolver_lookup(backends[i].host, port, st[i].addrs); // 조회 실패면 음수라서 연결해보지 않음
+    st[i].fd = probe_connect(&st[i]);
+  }
+  while ((left = deadline - now_ms()) > 0)
+  {
+    for (i = n = 0; i < nbackends; i++)
+      if (st[i].fd >= 0)
+      {
+        pfds[n].fd = st[i].fd;
+        pfds[n].events = st[i].sent ? POLLIN : POLLOUT;
+        idx[n++] = i;
+      }
+    if (!n) // 모두 끝남
+      break;
+    if (poll(pfds, n, left) <= 0)
+      continue;
+    for (k = 0; k < n; k++)
+      if (pfds[k].revents)
+        probe_step(&backends[idx[k]], &st[idx[k]], &ok[idx[k]]);
+  }
+  for (i = 0; i < nbackends; i++) // 제한 시간 안에 답하지 않은 backend는 실패
+    if (st[i].fd >= 0)
+    {
+      close(st[i].fd);
+      st[i].fd = -1;
+    }
+}
+
+/* BACKEND_PROBE_MS마다 모든 backend에 health check. 연속으로 실패하면 빼고, 빠져있던 backend가 성공하면 기다리지 않고 half-open으로 */
+static void *health_thread(void *vargp)
+{
+  int i, ok[BACKEND_MAX];
+
+  Pthread_detach(pthread_self());
+  while (1)
+  {
+    usleep(BACKEND_PROBE_MS * 1000);
+    probe_all(ok);
+    for (i = 0; i < nbackends; i++)
+    {
+      backend *b = &backends[i];
+      P(&b->mutex);
+      b->probeFails = ok[i] ? 0 : b->probeFails + 1;
+      if (ok[i] && b->ejected && now_ms() < b->until) // 바로 half-open으로 (요청이 실패해서 뺐을 수도 있으므로 요청 하나로 확인하고 되돌림)
+        __atomic_store_n(&b->until, now_ms(), __ATOMIC_RELAXED);
+      else if (!ok[i] && b->ejected && now_ms() >= b->until && !b->trial) // 아직 망가져있으면 요청으로 보내보지 않고 더 빼둠
+        eject(b, now_ms());
+      else if (!ok[i] && !b->ejected && b->probeFails >= BACKEND_PROBE_FAILS)
+        eject(b, now_ms());
+      V(&b->mutex);
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,63 @@
+/*
+ * backend.h - reverse proxy 모드의 backend pool과 부하 분산
+ *
+ * absolute-form이 아닌 요청("GET /path")은 -b로 정해둔 backend 중 하나로 보냄.
+ * 고르는 방법은 세가지이고, 모두 backend마다 weight를 반영함.
+ *   least : 처리 중인 요청 수 / weight 가 가장 작은 backend (같으면 돌아가며)
+ *   p2c   : weight 비율로 무작위로 둘을 뽑아서 처리 중인 요청이 적은 쪽 (전체를 보지 않고도 쏠리지 않음)
+ *   hash  : path의 consistent hash (같은 객체는 항상 같은 backend로 가서 backend 캐시를 잘 씀.
+ *           backend가 바뀌어도 그 backend 몫만 옮겨감). weight만큼 ring에 점을 많이 찍음
+ * 처리 중인 요청 수는 atomic으로만 세고 락을 잡지 않음. pool은 시작할 때 정하고 바꾸지 않음.
+ *
+ * backend마다 circuit breaker가 있어서 망가진 backend는 고르지 않음 (eject).
+ *   passive : 요청 결과(연결 실패, 응답 시간 초과, 5xx)를 기록해서 연속으로 실패하거나 최근 실패 비율이 높으면 뺌
+ *   active  : health 쓰레드가 주기적으로 요청을 보내보고 연속으로 실패하면 빼고, 빠져있던 backend가 성공하면 바로 half-open으로
+ * 뺀 backend는 정해진 시간(뺄 때마다 두배)이 지나면 half-open이 되어 요청 하나만 보내보고, 성공하면 되돌리고 실패하면 다시 뺌.
+ */
+#ifndef __BACKEND_H__
+#define __BACKEND_H__
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define BACKEND_MAX 32         // 최대 backend 수
+#define BACKEND_HOST_MAX 256   // backend host 최대 길이
+#define BACKEND_WEIGHT_MAX 100 // 최대 weight
+#define BACKEND_VNODES 40      // weight 1당 hash ring에 찍는 점 수
+#define BACKEND_EJECT_CONSECUTIVE 3 // 연속으로 이만큼 실패하면 뺌
+#define BACKEND_WINDOW 20           // 실패 비율을 보는 최근 요청 수
+#define BACKEND_WINDOW_MIN 10       // 최근 요청이 이만큼은 있어야 비율로 뺌
+#define BACKEND_EJECT_PERCENT 50    // 최근 요청 중 이 비율(%) 이상 실패하면 뺌
+#define BACKEND_EJECT_MS 1000       // 처음 뺄 때 빼두는 시간 (ms, 다시 뺄 때마다 두배)
+#define BACKEND_EJECT_MAX_MS 30000  // 빼두는 최대 시간 (ms)
+#define BACKEND_PROBE_MS 1000       // health check 주기 (ms)
+#define BACKEND_PROBE_TIMEOUT_MS 500 // health check 제한 시간 (ms, 모든 backend에 같이 보내고 한 번에 기다림)
+#define BACKEND_PROBE_FAILS 2       // health check가 연속으로 이만큼 실패하면 뺌
+#define BACKEND_PROBE_PATH "/"      // health check로 GET 하는 경로 (5xx가 아니면 정상)
+
+enum
+{
+  BACKEND_LEAST = 0, // least outstanding requests
+  BACKEND_P2C,       // power of two choices
+  BACKEND_HASH,      // consistent hashing
+  BACKEND_POLICIES
+};
+
+enum
+{
+  BACKEND_UNKNOWN = 0, // backend에 요청을 보내지 않음 (캐시에서 응답 등)
+  BACKEND_OK,          // 응답을 받음
+  BACKEND_FAILED       // 연결 실패, 응답 시간 초과, 잘못된 응답 또는 5xx
+};
+
+int backend_add(char *spec);        // "host:port[@weight]" 추가 (잘못되면 -1)
+int backend_setPolicy(char *name);  // "least", "p2c", "hash" (없는 이름이면 -1)
+void backend_init(pthread_attr_t *attr); // 추가를 다 한 다음 hash ring 만들고 health 쓰레드 생성
+int backend_count(void);
+int backend_pick(char *key, unsigned skip); // backend 고르기 (처리 중으로 셈, 보낼 곳이 없으면 -1). key는 hash에서 씀, skip은 고르지 않을 backend bit
+void backend_done(int idx, int result);     // 요청 끝 (결과를 circuit breaker에 반영)
+char *backend_host(int idx);
+int backend_port(int idx);
+int backend_format(char *buf, size_t size); // backend별 상태를 text로
+
+#endif /* __BACKEND_H__ */
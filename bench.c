@@ -0,0 +1,306 @@
+/*
+ * bench.c - Microbenchmarks for the request parsing and line reading paths
+ *
+ * usage: make bench && ./bench [iterations]
+ *
+ * 같은 요청을 메모리에 올려두고 (socket read 비용은 빼고) 파싱에 드는 시간만 비교함.
+ *   legacy   : 예전 doit()/build_requesthdrs() 방식 (Rio_readlineb로 줄마다 복사 + sscanf + strncasecmp)
+ *   strcmp   : http_parse_request()로 파싱 후 header 이름을 strcasecmp로 하나씩 비교
+ *   parser   : http_parse_request()로 파싱 후 파싱할 때 분류해둔 id(perfect hash)로 처리
+ *   chunked  : 같은 요청을 CHUNK byte씩 나누어 넣으며 이어서 파싱 (non-blocking 소켓에서 조금씩 받는 경우)
+ *   (strcmp/parser/chunked는 구분자 찾기 kernel(scalar, sse2, avx2)별로 각각 잼)
+ *   bytewise : 예전 rio_readlineb (1 byte씩 rio_read)로 header 줄 읽기
+ *   readline : 지금 rio_readlineb (memchr로 줄 끝을 찾아 한번에 복사)로 header 줄 읽기
+ */
+#include <time.h>
+#include "csapp.h"
+#include "http.h"
+
+#define DEFAULT_ITERS 1000000
+#define CHUNK 64
+
+static const char *samples[][2] = {
+    {"curl",
+     "GET http://localhost:15213/home.html HTTP/1.1\r\n"
+     "Host: localhost:15213\r\n"
+     "User-Agent: curl/7.81.0\r\n"
+     "Accept: */*\r\n"
+     "Proxy-Connection: Keep-Alive\r\n"
+     "\r\n"},
+    {"browser",
+     "GET http://www.example.com/static/js/app.3f9a1c.js?v=20240101 HTTP/1.1\r\n"
+     "Host: www.example.com\r\n"
+     "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0\r\n"
+     "Accept: */*\r\n"
+     "Accept-Language: en-US,en;q=0.5\r\n"
+     "Accept-Encoding: gzip, deflate\r\n"
+     "Referer: http://www.example.com/index.html\r\n"
+     "Cookie: session=8c1d7f0a2b3e4f5a6b7c8d9e0f1a2b3c; theme=dark; lang=en\r\n"
+     "Connection: keep-alive\r\n"
+     "Proxy-Connection: keep-alive\r\n"
+     "Sec-Fetch-Dest: script\r\n"
+     "Sec-Fetch-Mode: no-cors\r\n"
+     "Sec-Fetch-Site: same-origin\r\n"
+     "If-Modified-Since: Mon, 01 Jan 2024 00:00:00 GMT\r\n"
+     "If-None-Match: \"3f9a1c-5d2\"\r\n"
+     "Cache-Control: max-age=0\r\n"
+     "\r\n"},
+};
+
+static volatile long sink; // 컴파일러가 결과를 버리지 않도록
+
+static double now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* rio 버퍼에 요청을 미리 채워둠 (read()를 부르지 않고 버퍼에서만 읽게 됨) */
+static void fill_rio(rio_t *rio, const char *data, int len)
+{
+  rio_readinitb(rio, -1);
+  memcpy(rio->rio_buf, data, len);
+  rio->rio_cnt = len;
+}
+
+/* 예전 rio_read (버퍼에 미리 채워둔 내용만 읽음). csapp.c처럼 다른 함수로 남도록 inline 금지 */
+static __attribute__((noinline)) ssize_t bytewise_read(rio_t *rp, char *usrbuf, size_t n)
+{
+  int cnt;
+
+  if (rp->rio_cnt <= 0)
+    return 0;
+  cnt = n;
+  if (rp->rio_cnt < n)
+    cnt = rp->rio_cnt;
+  memcpy(usrbuf, rp->rio_bufptr, cnt);
+  rp->rio_bufptr += cnt;
+  rp->rio_cnt -= cnt;
+  return cnt;
+}
+
+/* 예전 rio_readlineb: 1 byte씩 rio_read로 꺼내서 복사 */
+static ssize_t bytewise_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
+{
+  int n, rc;
+  char c, *bufp = usrbuf;
+
+  for (n = 1; n < maxlen; n++)
+  {
+    if ((rc = bytewise_read(rp, &c, 1)) == 1)
+    {
+      *bufp++ = c;
+      if (c == '\n')
+      {
+        n++;
+        break;
+      }
+    }
+    else if (rc == 0)
+    {
+      if (n == 1)
+        return 0;
+      break;
+    }
+    else
+      return -1;
+  }
+  *bufp = 0;
+  return n - 1;
+}
+
+/* 예전 방식: request line을 줄 단위로 복사해서 sscanf, header도 줄마다 복사 후 접두어 비교 */
+static long legacy_parse(const char *data, int len)
+{
+  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+  char host_hdr[MAXLINE], range[MAXLINE], other_hdr[MAXLINE];
+  rio_t rio;
+
+  fill_rio(&rio, data, len);
+  bytewise_readlineb(&rio, buf, MAXLINE);
+  sscanf(buf, "%s %s %s", method, uri, version);
+  other_hdr[0] = host_hdr[0] = range[0] = '\0';
+  while (bytewise_readlineb(&rio, buf, MAXLINE))
+  {
+    if (!strcmp(buf, "\r\n"))
+      break;
+    if (!strncasecmp(buf, "Host", 4))
+    {
+      strcpy(host_hdr, buf);
+      continue;
+    }
+    if (!strncasecmp(buf, "Range:", 6))
+    {
+      sscanf(buf + 6, " %[^\r\n]", range);
+      continue;
+    }
+    if (!strncasecmp(buf, "If-Range:", 9))
+      continue;
+    if (strncasecmp(buf, "Connection", 10) && strncasecmp(buf, "Proxy-Connection", 16) && strncasecmp(buf, "User-Agent", 10))
+      strcat(other_hdr, buf);
+  }
+  return strlen(method) + strlen(uri) + strlen(other_hdr) + strlen(host_hdr);
+}
+
+/* header 하나를 other_hdr에 이어 붙임 */
+static int append_hdr(char *other_hdr, int otherLen, http_request *req, http_header *h)
+{
+  memcpy(other_hdr + otherLen, http_str(req, h->name), h->name.len);
+  memcpy(other_hdr + otherLen + h->name.len, ": ", 2);
+  memcpy(other_hdr + otherLen + h->name.len + 2, http_str(req, h->value), h->value.len);
+  memcpy(other_hdr + otherLen + h->name.len + 2 + h->value.len, "\r\n", 2);
+  return otherLen + h->name.len + h->value.len + 4;
+}
+
+/* header 이름을 strcasecmp로 하나씩 비교 */
+static long classify_strcmp(http_request *req)
+{
+  char other_hdr[MAXLINE];
+  int i, otherLen = 0;
+  long n = 0;
+
+  for (i = 0; i < req->f.nheaders; i++)
+  {
+    http_header *h = &req->f.headers[i];
+    char *name = http_str(req, h->name);
+    if (!strcasecmp(name, "Host") || !strcasecmp(name, "Range") || !strcasecmp(name, "If-Range"))
+      n += h->value.len;
+    else if (strcasecmp(name, "Connection") && strcasecmp(name, "Proxy-Connection") && strcasecmp(name, "User-Agent"))
+      otherLen = append_hdr(other_hdr, otherLen, req, h);
+  }
+  other_hdr[otherLen] = '\0';
+  return n + otherLen + req->method.len + req->target.len;
+}
+
+/* build_requesthdrs()처럼 파싱할 때 분류해둔 id로 처리 */
+static long classify(http_request *req)
+{
+  char other_hdr[MAXLINE];
+  int i, otherLen = 0;
+  long n = 0;
+
+  for (i = 0; i < req->f.nheaders; i++)
+  {
+    http_header *h = &req->f.headers[i];
+    switch (h->id)
+    {
+    case HTTP_HDR_HOST:
+    case HTTP_HDR_RANGE:
+    case HTTP_HDR_IF_RANGE:
+      n += h->value.len;
+      break;
+    case HTTP_HDR_CONNECTION:
+    case HTTP_HDR_PROXY_CONNECTION:
+    case HTTP_HDR_USER_AGENT:
+      break;
+    default:
+      otherLen = append_hdr(other_hdr, otherLen, req, h);
+    }
+  }
+  other_hdr[otherLen] = '\0';
+  return n + otherLen + req->method.len + req->target.len;
+}
+
+static long parse_with(const char *data, int len, long (*classifier)(http_request *))
+{
+  rio_t rio;
+  http_request req;
+
+  fill_rio(&rio, data, len);
+  http_request_init(&req);
+  if (http_parse_request(&req, rio.rio_bufptr, rio.rio_cnt) <= 0)
+    return -1;
+  http_request_terminate(&req, rio.rio_bufptr);
+  return classifier(&req);
+}
+
+static long strcmp_parse(const char *data, int len)
+{
+  return parse_with(data, len, classify_strcmp);
+}
+
+static long parser_parse(const char *data, int len)
+{
+  return parse_with(data, len, classify);
+}
+
+static long chunked_parse(const char *data, int len)
+{
+  rio_t rio;
+  http_request req;
+  int rc = HTTP_PARSE_AGAIN, avail;
+
+  fill_rio(&rio, data, len);
+  http_request_init(&req);
+  for (avail = CHUNK; rc == HTTP_PARSE_AGAIN; avail += CHUNK)
+    rc = http_parse_request(&req, rio.rio_bufptr, avail < len ? avail : len);
+  if (rc <= 0)
+    return -1;
+  http_request_terminate(&req, rio.rio_bufptr);
+  return classify(&req);
+}
+
+/* header block 전체를 줄 단위로 읽기만 함 (tiny의 read_requesthdrs처럼) */
+static long readlines(const char *data, int len, ssize_t (*readline)(rio_t *, void *, size_t))
+{
+  char buf[MAXLINE];
+  rio_t rio;
+  long n = 0;
+
+  fill_rio(&rio, data, len);
+  while (rio.rio_cnt > 0 && readline(&rio, buf, MAXLINE) > 0)
+    n += buf[0];
+  return n;
+}
+
+static long bytewise_lines(const char *data, int len)
+{
+  return readlines(data, len, bytewise_readlineb);
+}
+
+static long rio_lines(const char *data, int len)
+{
+  return readlines(data, len, rio_readlineb);
+}
+
+static void run(const char *name, const char *sample, long (*fn)(const char *, int), long iters)
+{
+  int len = strlen(sample);
+  double start;
+  long i;
+
+  for (i = 0; i < iters / 10; i++) // warm up
+    sink += fn(sample, len);
+  start = now_ns();
+  for (i = 0; i < iters; i++)
+    sink += fn(sample, len);
+  printf("  %-8s %8.1f ns/req\n", name, (now_ns() - start) / iters);
+}
+
+int main(int argc, char **argv)
+{
+  static const char *kernels[] = {"scalar", "sse2", "avx2"};
+  long iters = argc > 1 ? atol(argv[1]) : DEFAULT_ITERS;
+  const char *best = http_simd_name();
+  int i, k;
+
+  for (i = 0; i < sizeof(samples) / sizeof(samples[0]); i++)
+  {
+    printf("%s request (%d bytes):\n", samples[i][0], (int)strlen(samples[i][1]));
+    run("legacy", samples[i][1], legacy_parse, iters);
+    for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+    {
+      if (http_simd_use(kernels[k]) < 0)
+        continue;
+      printf(" [%s]\n", kernels[k]);
+      run("strcmp", samples[i][1], strcmp_parse, iters);
+      run("parser", samples[i][1], parser_parse, iters);
+      run("chunked", samples[i][1], chunked_parse, iters);
+    }
+    http_simd_use(best);
+    run("bytewise", samples[i][1], bytewise_lines, iters);
+    run("readline", samples[i][1], rio_lines, iters);
+  }
+  return 0;
+}
@@ -806,18 +806,11 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 /* $end rio_writen */
 
 /*
- * rio_read - This is a wrapper for the Unix read() function that
- *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
- *    buffer, where n is the number of bytes requested by the user and
- *    rio_cnt is the number of unread bytes in the internal buffer. On
- *    entry, rio_read() refills the internal buffer via a call to
- *    read() if the internal buffer is empty.
+ * rio_fill - Refill the internal buffer with a call to read() if it is
+ *    empty. Returns the number of unread bytes, 0 on EOF, -1 on error.
  */
-/* $begin rio_read */
-static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
+static ssize_t rio_fill(rio_t *rp)
 {
-    int cnt;
-
     while (rp->rio_cnt <= 0)
     { /* Refill if buf is empty */
         rp->rio_cnt = read(rp->rio_fd, rp->rio_buf,
@@ -832,6 +825,24 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
         else
             rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
     }
+    return rp->rio_cnt;
+}
+
+/*
+ * rio_read - This is a wrapper for the Unix read() function that
+ *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
+ *    buffer, where n is the number of bytes requested by the user and
+ *    rio_cnt is the number of unread bytes in the internal buffer. On
+ *    entry, rio_read() refills the internal buffer via a call to
+ *    read() if the internal buffer is empty.
+ */
+/* $begin rio_read */
+static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
+{
+    int cnt;
+
+    if ((cnt = rio_fill(rp)) <= 0)
+        return cnt;
 
     /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
     cnt = n;
@@ -880,40 +891,98 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 /* $end rio_readnb */
 
 /*
- * rio_readlineb - Robustly read a text line (buffered)
+ * rio_readlineb - Robustly read a text line (buffered). Instead of
+ *    moving one byte at a time, find the newline in the internal buffer
+ *    with memchr() and copy everything up to it in one memcpy().
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
+    size_t n = 0, cnt;
+    ssize_t rc;
+    char *bufp = usrbuf, *nl = NULL;
 
-    for (n = 1; n < maxlen; n++)
+    while (!nl && n + 1 < maxlen)
     {
-        if ((rc = rio_read(rp, &c, 1)) == 1)
-        {
-            *bufp++ = c;
-            if (c == '\n')
-            {
-                n++;
-                break;
-            }
-        }
-        else if (rc == 0)
-        {
-            if (n == 1)
-                return 0; /* EOF, no data read */
-            else
-                break; /* EOF, some data was read */
-        }
-        else
+        if ((rc = rio_fill(rp)) < 0)
             return -1; /* Error */
+        else if (rc == 0)
+            break; /* EOF */
+
+        /* Copy up to and including the newline, or as much as fits */
+        cnt = maxlen - 1 - n;
+        if (rp->rio_cnt < cnt)
+            cnt = rp->rio_cnt;
+        if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+            cnt = nl - rp->rio_bufptr + 1;
+        memcpy(bufp, rp->rio_bufptr, cnt);
+        rp->rio_bufptr += cnt;
+        rp->rio_cnt -= cnt;
+        bufp += cnt;
+        n += cnt;
     }
-    *bufp = 0;
-    return n - 1;
+    if (maxlen > 0)
+        *bufp = 0;
+    return n;
 }
 /* $end rio_readlineb */
 
+/*
+ * rio_fillb - Append more bytes from the descriptor to the unread part
+ *    of the internal buffer without consuming anything, so callers can
+ *    parse directly over rp->rio_bufptr. Unread bytes are moved to the
+ *    front of the buffer first if there is no room after them. Returns
+ *    the number of bytes added, 0 on EOF, -1 on error (errno ENOBUFS if
+ *    the unread bytes already fill the whole buffer).
+ */
+/* $begin rio_fillb */
+ssize_t rio_fillb(rio_t *rp)
+{
+    ssize_t nread;
+    char *end;
+
+    if (rp->rio_cnt <= 0)
+    {
+        rp->rio_cnt = 0;
+        rp->rio_bufptr = rp->rio_buf;
+    }
+    else if (rp->rio_cnt == sizeof(rp->rio_buf))
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+    else if (rp->rio_bufptr + rp->rio_cnt == rp->rio_buf + sizeof(rp->rio_buf))
+    { /* No room after unread bytes: slide them to the front */
+        memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+        rp->rio_bufptr = rp->rio_buf;
+    }
+
+    end = rp->rio_bufptr + rp->rio_cnt;
+    while ((nread = read(rp->rio_fd, end,
+                         rp->rio_buf + sizeof(rp->rio_buf) - end)) < 0)
+    {
+        if (errno != EINTR) /* Interrupted by sig handler return */
+            return -1;
+    }
+    rp->rio_cnt += nread;
+    return nread;
+}
+/* $end rio_fillb */
+
+/*
+ * rio_consumeb - Mark the first n unread bytes of the internal buffer
+ *    as read (after parsing them in place with rio_fillb)
+ */
+/* $begin rio_consumeb */
+void rio_consumeb(rio_t *rp, size_t n)
+{
+    if (n > rp->rio_cnt)
+        n = rp->rio_cnt;
+    rp->rio_bufptr += n;
+    rp->rio_cnt -= n;
+}
+/* $end rio_consumeb */
+
 /**********************************
  * Wrappers for robust I/O routines
  **********************************/
@@ -971,7 +1040,7 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
 int open_clientfd(char *hostname, char *port)
 {
     int clientfd, rc;
-    struct addrinfo hints, *listp, *p;
+    struct addrinfo hints, *listp;
 
     /* Get a list of potential server addresses */
     memset(&hints, 0, sizeof(struct addrinfo));
@@ -984,31 +1053,147 @@ int open_clientfd(char *hostname, char *port)
         return -2;
     }
 
-    /* Walk the list for one that we can successfully connect to */
-    for (p = listp; p; p = p->ai_next)
+    clientfd = open_clientaddr(listp, 0);
+
+    /* Clean up */
+    freeaddrinfo(listp);
+    return clientfd;
+}
+/* $end open_clientfd */
+
+/*
+ * open_clientaddr - Connect to an already resolved address list (e.g.
+ *     one kept by a resolver cache) without blocking on any single
+ *     address. Attempts are started non-blocking, alternating address
+ *     families, with CONNECT_ATTEMPT_DELAY_MS between them (RFC 8305
+ *     "Happy Eyeballs"); a failed attempt starts the next one at once.
+ *     The first attempt to complete wins and is returned in blocking
+ *     mode. timeout_ms <= 0 means no overall deadline.
+ *
+ *     On error, returns -1 with errno set (ETIMEDOUT past the deadline).
+ */
+/* $begin open_clientaddr */
+static long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+int open_clientaddr(struct addrinfo *listp, int timeout_ms)
+{
+    struct addrinfo *order[CONNECT_MAX_ATTEMPTS], *first[CONNECT_MAX_ATTEMPTS], *second[CONNECT_MAX_ATTEMPTS], *p;
+    struct pollfd pfds[CONNECT_MAX_ATTEMPTS];
+    int nfirst = 0, nsecond = 0, n = 0, next = 0, nfds = 0, clientfd = -1, last_error = ECONNREFUSED;
+    int i, rc, err, wait, family;
+    socklen_t len;
+    long now, deadline, next_start;
+
+    /* Interleave address families, starting with the resolver's first choice */
+    family = listp ? listp->ai_family : AF_UNSPEC;
+    for (p = listp; p && nfirst + nsecond < CONNECT_MAX_ATTEMPTS; p = p->ai_next)
     {
-        /* Create a socket descriptor */
-        if ((clientfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
-            continue; /* Socket failed, try the next */
+        if (p->ai_family == family)
+            first[nfirst++] = p;
+        else
+            second[nsecond++] = p;
+    }
+    for (i = 0; i < nfirst || i < nsecond; i++)
+    {
+        if (i < nfirst)
+            order[n++] = first[i];
+        if (i < nsecond)
+            order[n++] = second[i];
+    }
 
-        /* Connect to the server */
-        if (connect(clientfd, p->ai_addr, p->ai_addrlen) != -1)
-            break; /* Success */
-        if (close(clientfd) < 0)
-        { /* Connect failed, try another */ // line:netp:openclientfd:closefd
-            fprintf(stderr, "open_clientfd: close failed: %s\n", strerror(errno));
-            return -1;
+    now = now_ms();
+    deadline = timeout_ms > 0 ? now + timeout_ms : -1;
+    next_start = now;
+    while (clientfd < 0)
+    {
+        now = now_ms();
+        if (deadline >= 0 && now >= deadline)
+        {
+            last_error = ETIMEDOUT;
+            break;
+        }
+
+        /* Start the next attempt when its turn comes or nothing is pending */
+        if (next < n && (nfds == 0 || now >= next_start))
+        {
+            p = order[next++];
+            next_start = now + CONNECT_ATTEMPT_DELAY_MS;
+            if ((rc = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
+            {
+                last_error = errno;
+                continue;
+            }
+            fcntl(rc, F_SETFL, fcntl(rc, F_GETFL, 0) | O_NONBLOCK);
+            if (connect(rc, p->ai_addr, p->ai_addrlen) == 0)
+                clientfd = rc; /* Connected at once (e.g. loopback) */
+            else if (errno == EINPROGRESS)
+            {
+                pfds[nfds].fd = rc;
+                pfds[nfds].events = POLLOUT;
+                nfds++;
+            }
+            else
+            {
+                last_error = errno;
+                close(rc);
+                next_start = now;
+            }
+            continue;
+        }
+        if (nfds == 0) /* Every address failed */
+            break;
+
+        /* Wait for a pending attempt, the next start, or the deadline */
+        wait = -1;
+        if (next < n)
+            wait = next_start - now;
+        if (deadline >= 0 && (wait < 0 || deadline - now < wait))
+            wait = deadline - now;
+        if ((rc = poll(pfds, nfds, wait)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            last_error = errno;
+            break;
+        }
+        for (i = 0; rc > 0 && i < nfds; i++)
+        {
+            if (!pfds[i].revents)
+                continue;
+            len = sizeof(err);
+            if (getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+                err = errno;
+            if (err == 0)
+            {
+                clientfd = pfds[i].fd;
+                pfds[i] = pfds[--nfds];
+                break;
+            }
+            last_error = err;
+            close(pfds[i].fd);
+            pfds[i--] = pfds[--nfds];
+            next_start = now; /* Failed: don't wait out the stagger */
         }
     }
 
-    /* Clean up */
-    freeaddrinfo(listp);
-    if (!p) /* All connects failed */
+    /* Clean up the attempts that lost the race */
+    for (i = 0; i < nfds; i++)
+        close(pfds[i].fd);
+    if (clientfd < 0)
+    {
+        errno = last_error;
         return -1;
-    else /* The last connect succeeded */
-        return clientfd;
+    }
+    fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL, 0) & ~O_NONBLOCK);
+    return clientfd;
 }
-/* $end open_clientfd */
+/* $end open_clientaddr */
 
 /*
  * open_listenfd - Open and return a listening socket on port. This
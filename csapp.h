@@ -28,6 +28,7 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <poll.h>
 
 /* Default file permissions are DEF_MODE & ~DEF_UMASK */
 /* $begin createmasks */
@@ -59,6 +60,8 @@ extern char **environ; /* Defined by libc */
 #define	MAXLINE	 8192  /* Max text line length */
 #define MAXBUF   8192  /* Max I/O buffer size */
 #define LISTENQ  1024  /* Second argument to listen() */
+#define CONNECT_ATTEMPT_DELAY_MS 250 /* Stagger between connect attempts (RFC 8305) */
+#define CONNECT_MAX_ATTEMPTS 16      /* Max addresses tried per connect */
 
 /* Our own error-handling functions */
 void unix_error(char *msg);
@@ -178,6 +181,8 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n);
 void rio_readinitb(rio_t *rp, int fd); 
 ssize_t	rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t	rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t	rio_fillb(rio_t *rp);
+void	rio_consumeb(rio_t *rp, size_t n);
 
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
@@ -188,6 +193,7 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
 
 /* Reentrant protocol-independent client/server helpers */
 int open_clientfd(char *hostname, char *port);
+int open_clientaddr(struct addrinfo *listp, int timeout_ms);
 int open_listenfd(char *port);
 
 /* Wrappers for reentrant protocol-independent client/server helpers */
@@ -0,0 +1,104 @@
+/*
+ * hedge.c - endserver 응답 지연 집계와 재시도 예산 (hedge.h 참고)
+ */
+#include "csapp.h"
+#include "hedge.h"
+
+#define HEDGE_UNIT 1000 // 예산은 token의 1/1000 단위로 셈
+
+typedef struct
+{
+  long samples[HEDGE_SAMPLES]; // 최근 지연 (ms, 돌아가며 덮어씀)
+  unsigned long count;         // 지금까지 기록한 수
+  long p95;                    // 마지막으로 계산한 p95 (ms, 모르면 -1)
+} hedge_slot;
+
+static hedge_slot slots[HEDGE_SLOTS];
+static long budget;   // 남은 예산 (HEDGE_UNIT 단위)
+static hedge_stats stats;
+
+void hedge_init(void)
+{
+  for (int i = 0; i < HEDGE_SLOTS; i++)
+    slots[i].p95 = -1;
+  budget = HEDGE_BUDGET_MAX * HEDGE_UNIT;
+}
+
+/* 최근 지연을 정렬해서 p95를 다시 계산함. 다른 쓰레드가 같은 칸에 쓰는 중이어도 값 하나가 틀릴 뿐이라 잠그지 않음 */
+static void update_p95(hedge_slot *s, unsigned long count)
+{
+  long v[HEDGE_SAMPLES], x;
+  int n = count < HEDGE_SAMPLES ? count : HEDGE_SAMPLES;
+  int i, j;
+
+  for (i = 0; i < n; i++) // 삽입 정렬 (64개뿐)
+  {
+    x = __atomic_load_n(&s->samples[i], __ATOMIC_RELAXED);
+    for (j = i; j > 0 && v[j - 1] > x; j--)
+      v[j] = v[j - 1];
+    v[j] = x;
+  }
+  __atomic_store_n(&s->p95, v[(n * 95 + 99) / 100 - 1], __ATOMIC_RELAXED);
+}
+
+void hedge_record(unsigned origin, long ms)
+{
+  hedge_slot *s = &slots[origin % HEDGE_SLOTS];
+  unsigned long i = __atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED);
+
+  __atomic_store_n(&s->samples[i % HEDGE_SAMPLES], ms, __ATOMIC_RELAXED);
+  if (i + 1 >= HEDGE_MIN_SAMPLES && (i + 1) % 8 == 0) // 8개마다 다시 계산함
+    update_p95(s, i + 1);
+}
+
+long hedge_delay(unsigned origin)
+{
+  long p95 = __atomic_load_n(&slots[origin % HEDGE_SLOTS].p95, __ATOMIC_RELAXED);
+
+  if (p95 < 0)
+    return -1;
+  return p95 < HEDGE_MIN_DELAY_MS ? HEDGE_MIN_DELAY_MS : p95;
+}
+
+void hedge_deposit(void)
+{
+  long old = __atomic_load_n(&budget, __ATOMIC_RELAXED), next;
+
+  do
+  {
+    if (old >= HEDGE_BUDGET_MAX * HEDGE_UNIT)
+      return;
+    next = old + HEDGE_UNIT * HEDGE_BUDGET_PERCENT / 100;
+    if (next > HEDGE_BUDGET_MAX * HEDGE_UNIT)
+      next = HEDGE_BUDGET_MAX * HEDGE_UNIT;
+  } while (!__atomic_compare_exchange_n(&budget, &old, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+int hedge_withdraw(int kind)
+{
+  long old = __atomic_load_n(&budget, __ATOMIC_RELAXED);
+
+  do
+  {
+    if (old < HEDGE_UNIT)
+    {
+      __atomic_fetch_add(&stats.denied, 1, __ATOMIC_RELAXED);
+      return 0;
+    }
+  } while (!__atomic_compare_exchange_n(&budget, &old, old - HEDGE_UNIT, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  __atomic_fetch_add(&stats.used[kind], 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+void hedge_won(void)
+{
+  __atomic_fetch_add(&stats.wins, 1, __ATOMIC_RELAXED);
+}
+
+void hedge_getStats(hedge_stats *out)
+{
+  for (int k = 0; k < HEDGE_KINDS; k++)
+    out->used[k] = __atomic_load_n(&stats.used[k], __ATOMIC_RELAXED);
+  out->denied = __atomic_load_n(&stats.denied, __ATOMIC_RELAXED);
+  out->wins = __atomic_load_n(&stats.wins, __ATOMIC_RELAXED);
+}
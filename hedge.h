@@ -0,0 +1,44 @@
+/*
+ * hedge.h - endserver 응답 지연 집계와 재시도 예산 (느린 응답에 한번 더 보내기, 연결 실패 재시도)
+ *
+ * origin마다 최근 응답 header까지 걸린 시간을 기억해서 p95를 계산해둠. 요청이 p95가 지나도록
+ * 응답이 없으면 같은 요청을 다른 연결로 한번 더 보내고 먼저 오는 쪽을 씀 (hedge).
+ * hedge와 연결 실패 재시도는 모두 공용 예산에서 token을 하나씩 써야 함. 예산은 보낸 요청마다
+ * HEDGE_BUDGET_PERCENT만큼만 쌓이므로, 서버가 느려지거나 실패가 많아져도 추가 요청은 그 비율을 넘지 않음
+ * (과부하를 키우지 않음). 집계와 예산 모두 atomic으로만 갱신하고 락을 잡지 않음.
+ */
+#ifndef __HEDGE_H__
+#define __HEDGE_H__
+
+#define HEDGE_SLOTS 64          // 지연을 집계하는 origin 칸 수 (hash가 겹치면 같이 씀)
+#define HEDGE_SAMPLES 64        // origin마다 기억하는 최근 지연 수
+#define HEDGE_MIN_SAMPLES 20    // 이만큼 모이기 전에는 hedge하지 않음
+#define HEDGE_MIN_DELAY_MS 10   // p95가 이보다 짧아도 이만큼은 기다림
+#define HEDGE_BUDGET_PERCENT 10 // 요청마다 쌓이는 예산 (요청 수의 %)
+#define HEDGE_BUDGET_MAX 20     // 쌓아둘 수 있는 최대 token 수 (시작할 때는 가득 참)
+#define HEDGE_MAX_RETRIES 2     // 연결 하나에 대한 최대 재시도 횟수
+#define HEDGE_RETRY_BACKOFF_MS 50 // 첫 재시도 전에 쉬는 시간 (ms, 재시도마다 두배)
+
+enum
+{
+  HEDGE_KIND_HEDGE = 0, // 느린 응답에 한번 더 보냄
+  HEDGE_KIND_RETRY,     // 연결 실패를 다시 시도함
+  HEDGE_KINDS
+};
+
+typedef struct
+{
+  long used[HEDGE_KINDS]; // 예산을 쓴 횟수
+  long denied;            // 예산이 없어서 하지 못한 횟수
+  long wins;              // hedge한 요청이 먼저 응답한 횟수
+} hedge_stats;
+
+void hedge_init(void);
+void hedge_record(unsigned origin, long ms); // 응답 header까지 걸린 시간 기록
+long hedge_delay(unsigned origin);           // hedge하기 전에 기다릴 시간 (ms, 아직 모르면 -1)
+void hedge_deposit(void);                    // endserver로 요청 하나를 보냄 (예산이 쌓임)
+int hedge_withdraw(int kind);                // 예산에서 token 하나 쓰기 (없으면 0)
+void hedge_won(void);                        // hedge한 쪽이 이김
+void hedge_getStats(hedge_stats *stats);
+
+#endif /* __HEDGE_H__ */
@@ -0,0 +1,507 @@
+/*
+ * http.c - HTTP/1.x request/response header parser and header scanning helpers
+ *
+ * 줄 단위로 ':'와 '\n'을 찾아서 처리하고, 아직 끝나지 않은 줄은 다음 호출에서 다시 봄.
+ * 읽은 내용을 복사하지 않고 위치만 기록하므로 sscanf나 줄마다 복사하는 비용이 없음.
+ * 구분자 찾기는 SSE2/AVX2로 16/32 byte씩 비교하고, header 이름은 perfect hash로 한번에 분류함.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_HAVE_X86 1
+#endif
+#include "http.h"
+
+#define STATE_REQUEST_LINE 0 // 첫 줄 (METHOD SP target SP version)
+#define STATE_HEADERS 1      // header 줄들
+#define STATE_DONE 2         // 빈 줄까지 다 읽음
+
+/* token에 쓸 수 있는 문자 표 (RFC 7230 tchar) */
+static const unsigned char tchar[256] = {
+    ['a' ... 'z'] = 1, ['A' ... 'Z'] = 1, ['0' ... '9'] = 1,
+    ['!'] = 1, ['#'] = 1, ['$'] = 1, ['%'] = 1, ['&'] = 1, ['\''] = 1, ['*'] = 1, ['+'] = 1,
+    ['-'] = 1, ['.'] = 1, ['^'] = 1, ['_'] = 1, ['`'] = 1, ['|'] = 1, ['~'] = 1};
+
+#define is_tchar(c) (tchar[(unsigned char)(c)])
+#define is_ows(c) ((c) == ' ' || (c) == '\t')
+
+/*
+ * 구분자 찾기 kernel들. 모두 [p, end)에서 a나 b가 처음 나오는 위치를 반환함
+ */
+static const char *scan2_scalar(const char *p, const char *end, char a, char b)
+{
+  for (; p < end; p++)
+    if (*p == a || *p == b)
+      return p;
+  return NULL;
+}
+
+#ifdef HTTP_HAVE_X86
+__attribute__((target("sse2"))) static const char *scan2_sse2(const char *p, const char *end, char a, char b)
+{
+  __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+
+  for (; end - p >= 16; p += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return scan2_scalar(p, end, a, b); // 16 byte 안 되는 나머지
+}
+
+__attribute__((target("avx2"))) static const char *scan2_avx2(const char *p, const char *end, char a, char b)
+{
+  __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+
+  for (; end - p >= 32; p += 32)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  if (end - p >= 16) // 나머지도 여기서 VEX 명령으로 처리 (SSE 함수를 부르면 AVX->SSE 전환 비용이 큼)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(va)), _mm_cmpeq_epi8(v, _mm256_castsi256_si128(vb))));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+  for (; p < end; p++)
+    if (*p == a || *p == b)
+      return p;
+  return NULL;
+}
+#endif
+
+typedef const char *(*scan2_fn)(const char *, const char *, char, char);
+
+static const struct
+{
+  const char *name;
+  scan2_fn fn;
+} kernels[] = {
+#ifdef HTTP_HAVE_X86
+    {"avx2", scan2_avx2},
+    {"sse2", scan2_sse2},
+#endif
+    {"scalar", scan2_scalar},
+};
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+static int kernel = KERNEL_COUNT - 1; // 쓰레드가 뜨기 전에 select_kernel()에서 정해지고 그 뒤로는 읽기만 함
+
+/* 해당 kernel을 이 CPU에서 쓸 수 있는지 */
+static int kernel_supported(int i)
+{
+#ifdef HTTP_HAVE_X86
+  __builtin_cpu_init();
+  if (kernels[i].fn == scan2_avx2)
+    return __builtin_cpu_supports("avx2");
+  if (kernels[i].fn == scan2_sse2)
+    return __builtin_cpu_supports("sse2");
+#endif
+  return 1;
+}
+
+/* 프로그램 시작할 때 (main 전에) 쓸 수 있는 것 중 가장 빠른 kernel을 고름 */
+__attribute__((constructor)) static void select_kernel(void)
+{
+  int i;
+
+  for (i = 0; i < KERNEL_COUNT; i++)
+    if (kernel_supported(i))
+    {
+      kernel = i;
+      return;
+    }
+}
+
+const char *http_scan2(const char *p, const char *end, char a, char b)
+{
+  return kernels[kernel].fn(p, end, a, b);
+}
+
+int http_simd_use(const char *name)
+{
+  int i;
+
+  for (i = 0; i < KERNEL_COUNT; i++)
+    if (!strcmp(kernels[i].name, name) && kernel_supported(i))
+    {
+      kernel = i;
+      return 0;
+    }
+  return -1;
+}
+
+const char *http_simd_name(void)
+{
+  return kernels[kernel].name;
+}
+
+/*
+ * header 이름 perfect hash. 아래 이름들이 64칸 안에서 겹치지 않도록 고른 식:
+ *   (길이 * 15 + 첫 글자 * 6 + 끝 글자 * 5 + 가운데 글자) % 64  (글자는 소문자 기준)
+ * 이름을 추가하면 겹치지 않는지 다시 확인해야 함
+ */
+#define NAME_HASH_SIZE 64
+#define lower(c) ((unsigned char)(c) | 0x20) // 영문자, '-', 숫자는 그대로 소문자 비교 가능
+
+static const struct
+{
+  const char *name;
+  int len;
+  int id;
+} known_names[NAME_HASH_SIZE] = {
+    [1] = {"Date", 4, HTTP_HDR_DATE},
+    [2] = {"Content-Range", 13, HTTP_HDR_CONTENT_RANGE},
+    [4] = {"Trailer", 7, HTTP_HDR_TRAILER},
+    [6] = {"Pragma", 6, HTTP_HDR_PRAGMA},
+    [8] = {"If-Range", 8, HTTP_HDR_IF_RANGE},
+    [11] = {"Proxy-Authorization", 19, HTTP_HDR_PROXY_AUTHORIZATION},
+    [15] = {"Vary", 4, HTTP_HDR_VARY},
+    [16] = {"Cookie", 6, HTTP_HDR_COOKIE},
+    [18] = {"Upgrade", 7, HTTP_HDR_UPGRADE},
+    [19] = {"Age", 3, HTTP_HDR_AGE},
+    [20] = {"Cache-Control", 13, HTTP_HDR_CACHE_CONTROL},
+    [23] = {"If-Modified-Since", 17, HTTP_HDR_IF_MODIFIED_SINCE},
+    [24] = {"Authorization", 13, HTTP_HDR_AUTHORIZATION},
+    [25] = {"Content-Length", 14, HTTP_HDR_CONTENT_LENGTH},
+    [26] = {"Location", 8, HTTP_HDR_LOCATION},
+    [30] = {"Range", 5, HTTP_HDR_RANGE},
+    [33] = {"Expect", 6, HTTP_HDR_EXPECT},
+    [35] = {"Host", 4, HTTP_HDR_HOST},
+    [36] = {"Proxy-Connection", 16, HTTP_HDR_PROXY_CONNECTION},
+    [38] = {"If-None-Match", 13, HTTP_HDR_IF_NONE_MATCH},
+    [39] = {"Transfer-Encoding", 17, HTTP_HDR_TRANSFER_ENCODING},
+    [42] = {"Content-Encoding", 16, HTTP_HDR_CONTENT_ENCODING},
+    [46] = {"Last-Modified", 13, HTTP_HDR_LAST_MODIFIED},
+    [47] = {"Expires", 7, HTTP_HDR_EXPIRES},
+    [48] = {"Set-Cookie", 10, HTTP_HDR_SET_COOKIE},
+    [49] = {"Connection", 10, HTTP_HDR_CONNECTION},
+    [50] = {"Keep-Alive", 10, HTTP_HDR_KEEP_ALIVE},
+    [51] = {"Content-Type", 12, HTTP_HDR_CONTENT_TYPE},
+    [52] = {"TE", 2, HTTP_HDR_TE},
+    [53] = {"Accept-Ranges", 13, HTTP_HDR_ACCEPT_RANGES},
+    [57] = {"User-Agent", 10, HTTP_HDR_USER_AGENT},
+    [62] = {"ETag", 4, HTTP_HDR_ETAG},
+};
+
+static unsigned name_hash(const char *name, int len)
+{
+  return (len * 15 + lower(name[0]) * 6 + lower(name[len - 1]) * 5 + lower(name[len / 2])) % NAME_HASH_SIZE;
+}
+
+int http_header_id(const char *name, int len)
+{
+  unsigned h;
+
+  if (len <= 0)
+    return HTTP_HDR_OTHER;
+  h = name_hash(name, len);
+  if (known_names[h].len == len && !strncasecmp(known_names[h].name, name, len))
+    return known_names[h].id;
+  return HTTP_HDR_OTHER;
+}
+
+int http_classify_line(const char *line, int len, const char **value)
+{
+  const char *colon = http_scan2(line, line + len, ':', '\n');
+  const char *v;
+
+  if (!colon || *colon != ':' || colon == line)
+    return -1;
+  for (v = colon + 1; v < line + len && is_ows(*v); v++)
+    ;
+  if (value)
+    *value = v;
+  return http_header_id(line, colon - line);
+}
+
+static void set_slice(http_slice *s, const char *buf, const char *start, const char *end)
+{
+  s->off = start - buf;
+  s->len = end - start;
+}
+
+/* request line 파싱. 형식이 틀리면 -1 */
+static int parse_request_line(void *msg, const char *buf, const char *p, const char *end)
+{
+  http_request *req = msg;
+  const char *q;
+
+  // method
+  for (q = p; q < end && is_tchar(*q); q++)
+    ;
+  if (q == p || q == end || *q != ' ')
+    return -1;
+  set_slice(&req->method, buf, p, q);
+
+  // target (공백과 제어문자 없이)
+  for (p = ++q; q < end && (unsigned char)*q > ' ' && *q != 0x7f; q++)
+    ;
+  if (q == p || q == end || *q != ' ')
+    return -1;
+  set_slice(&req->target, buf, p, q);
+
+  // version
+  p = ++q;
+  if (end - p != 8 || memcmp(p, "HTTP/", 5) || p[5] < '0' || p[5] > '9' || p[6] != '.' || p[7] < '0' || p[7] > '9')
+    return -1;
+  set_slice(&req->version, buf, p, end);
+  return 0;
+}
+
+/* status line 파싱 (HTTP/x.y SP 3자리 code [SP reason]). 형식이 틀리면 -1 */
+static int parse_status_line(void *msg, const char *buf, const char *p, const char *end)
+{
+  http_response *resp = msg;
+
+  if (end - p < 12 || memcmp(p, "HTTP/", 5) || p[6] != '.' || p[8] != ' ')
+    return -1;
+  if (p[9] < '1' || p[9] > '5' || p[10] < '0' || p[10] > '9' || p[11] < '0' || p[11] > '9')
+    return -1;
+  if (end - p > 12 && p[12] != ' ')
+    return -1;
+  set_slice(&resp->version, buf, p, p + 8);
+  resp->status = (p[9] - '0') * 100 + (p[10] - '0') * 10 + (p[11] - '0');
+  set_slice(&resp->reason, buf, end - p > 12 ? p + 13 : end, end);
+  return 0;
+}
+
+/* header 한 줄 파싱 (colon은 줄 안의 첫 ':'). 형식이 틀리면 HTTP_PARSE_ERROR, 자리가 없으면 HTTP_PARSE_TOOLARGE */
+static int parse_header_line(http_fields *f, const char *buf, const char *p, const char *colon, const char *end)
+{
+  const char *q, *v;
+  http_header *h;
+
+  for (q = p; q < colon && is_tchar(*q); q++) // 이름 뒤에 공백이 오거나, 줄이 공백으로 시작하면(obs-fold) 에러
+    ;
+  if (q == p || q != colon)
+    return HTTP_PARSE_ERROR;
+  if (f->nheaders == HTTP_MAX_HEADERS)
+  {
+    if (f->overflow < 0)
+      return HTTP_PARSE_TOOLARGE;
+    f->overflow++;
+    return 0;
+  }
+
+  h = &f->headers[f->nheaders];
+  set_slice(&h->name, buf, p, q);
+  h->id = http_header_id(p, q - p);
+  for (v = q + 1; v < end && is_ows(*v); v++)
+    ;
+  while (end > v && is_ows(end[-1]))
+    end--;
+  set_slice(&h->value, buf, v, end);
+  if (h->id && f->index[h->id] < 0) // 같은 이름이 여러번 나오면 첫번째를 기억
+    f->index[h->id] = f->nheaders;
+  f->nheaders++;
+  return 0;
+}
+
+static void fields_init(http_fields *f)
+{
+  f->state = STATE_REQUEST_LINE;
+  f->pos = 0;
+  f->nheaders = 0;
+  memset(f->index, 0xff, sizeof(f->index)); // 모두 -1
+}
+
+/*
+ * buf[0, len)을 이전 호출에서 멈춘 줄부터 이어서 파싱함. 첫 줄은 first_line으로 넘김.
+ * 빈 줄까지 다 읽었으면 header 전체 길이, 아직이면 HTTP_PARSE_AGAIN, 잘못되었으면 음수 반환
+ */
+static int parse_message(http_fields *f, int (*first_line)(void *, const char *, const char *, const char *), void *msg,
+                         const char *buf, size_t len)
+{
+  const char *p, *eol, *end, *colon = NULL, *bufEnd = buf + len;
+  int rc;
+
+  while (f->state != STATE_DONE)
+  {
+    // header 줄이면 ':'(이름 끝)를 먼저 찾고 거기서부터 줄 끝을 찾으므로 줄을 한번만 훑음
+    p = buf + f->pos;
+    eol = http_scan2(p, bufEnd, f->state == STATE_HEADERS ? ':' : '\n', '\n');
+    if (eol && *eol == ':')
+    {
+      colon = eol;
+      eol = http_scan2(colon + 1, bufEnd, '\n', '\n');
+    }
+    else
+      colon = NULL;
+    if (!eol) // 줄이 아직 덜 들어옴
+      return bufEnd - p >= HTTP_MAX_LINE ? HTTP_PARSE_TOOLARGE : HTTP_PARSE_AGAIN;
+    if (eol - p >= HTTP_MAX_LINE)
+      return HTTP_PARSE_TOOLARGE;
+
+    end = eol;
+    if (end > p && end[-1] == '\r') // CRLF, LF 둘 다 허용
+      end--;
+
+    if (f->state == STATE_REQUEST_LINE)
+    {
+      if (end != p) // 첫 줄 앞의 빈 줄은 무시 (RFC 7230 3.5)
+      {
+        if (first_line(msg, buf, p, end) < 0)
+          return HTTP_PARSE_ERROR;
+        f->state = STATE_HEADERS;
+      }
+    }
+    else if (end == p) // 빈 줄이면 header 끝
+      f->state = STATE_DONE;
+    else if (!colon)
+      return HTTP_PARSE_ERROR;
+    else if ((rc = parse_header_line(f, buf, p, colon, end)) < 0)
+      return rc;
+
+    f->pos = eol + 1 - buf;
+  }
+  return f->pos;
+}
+
+void http_request_init(http_request *req)
+{
+  fields_init(&req->f);
+  req->f.overflow = -1;
+  req->base = NULL;
+}
+
+int http_parse_request(http_request *req, const char *buf, size_t len)
+{
+  return parse_message(&req->f, parse_request_line, req, buf, len);
+}
+
+/* 파싱이 끝난 요청의 각 구간 끝에 '\0'을 씀. 구간 바로 뒤는 공백, ':', CR/LF 중 하나라 내용은 안 건드림 */
+void http_request_terminate(http_request *req, char *buf)
+{
+  int i;
+
+  buf[req->method.off + req->method.len] = '\0';
+  buf[req->target.off + req->target.len] = '\0';
+  buf[req->version.off + req->version.len] = '\0';
+  for (i = 0; i < req->f.nheaders; i++)
+  {
+    buf[req->f.headers[i].name.off + req->f.headers[i].name.len] = '\0';
+    buf[req->f.headers[i].value.off + req->f.headers[i].value.len] = '\0';
+  }
+  req->base = buf;
+}
+
+char *http_request_value(http_request *req, int id)
+{
+  int i = req->f.index[id];
+  return i < 0 ? NULL : http_str(req, req->f.headers[i].value);
+}
+
+/* p부터 len byte가 token과 같은지 (대소문자 무시) */
+static int slice_is(const char *p, int len, const char *token)
+{
+  return (int)strlen(token) == len && !strncasecmp(p, token, len);
+}
+
+/* Cache-Control / Pragma 값에서 아는 지시어를 찾아 flag로 */
+static void parse_cache_control(http_response *resp, const char *buf, http_slice value)
+{
+  const char *p = buf + value.off, *end = p + value.len, *q, *eq;
+
+  while (p < end)
+  {
+    while (p < end && (is_ows(*p) || *p == ','))
+      p++;
+    if (!(q = http_scan2(p, end, ',', ',')))
+      q = end;
+    eq = http_scan2(p, q, '=', '=');
+    if (slice_is(p, (eq ? eq : q) - p, "no-store"))
+      resp->cacheFlags |= HTTP_CC_NO_STORE;
+    else if (slice_is(p, (eq ? eq : q) - p, "no-cache"))
+      resp->cacheFlags |= HTTP_CC_NO_CACHE;
+    else if (slice_is(p, (eq ? eq : q) - p, "private"))
+      resp->cacheFlags |= HTTP_CC_PRIVATE;
+    else if (slice_is(p, (eq ? eq : q) - p, "public"))
+      resp->cacheFlags |= HTTP_CC_PUBLIC;
+    else if (slice_is(p, (eq ? eq : q) - p, "must-revalidate"))
+      resp->cacheFlags |= HTTP_CC_MUST_REVALIDATE;
+    else if (eq && slice_is(p, eq - p, "max-age"))
+      resp->maxAge = strtol(eq + 1 + (eq[1] == '"'), NULL, 10);
+    p = q;
+  }
+}
+
+void http_response_init(http_response *resp)
+{
+  fields_init(&resp->f);
+  resp->f.overflow = 0;
+  resp->status = 0;
+  resp->contentLength = -1;
+  resp->rangeFirst = resp->rangeLast = resp->rangeTotal = -1;
+  resp->chunked = 0;
+  resp->cacheFlags = 0;
+  resp->maxAge = -1;
+}
+
+/*
+ * 응답 header를 파싱하고, 다 읽었으면 길이/Content-Range/Transfer-Encoding/Cache-Control 값을 미리 계산해둠.
+ * 반환값은 http_parse_request()와 같음
+ */
+int http_parse_response(http_response *resp, const char *buf, size_t len)
+{
+  int rc, i;
+  char *endp;
+  const char *v;
+
+  if ((rc = parse_message(&resp->f, parse_status_line, resp, buf, len)) <= 0)
+    return rc;
+
+  for (i = 0; i < resp->f.nheaders; i++)
+  {
+    http_header *h = &resp->f.headers[i];
+    v = buf + h->value.off;
+    switch (h->id)
+    {
+    case HTTP_HDR_CONTENT_LENGTH:
+      resp->contentLength = strtol(v, &endp, 10);
+      if (endp == v || resp->contentLength < 0)
+        resp->contentLength = -1;
+      break;
+    case HTTP_HDR_CONTENT_RANGE: // bytes first-last/total 또는 bytes */total
+      if (h->value.len > 6 && !strncasecmp(v, "bytes ", 6))
+      {
+        v += 6;
+        if (*v == '*')
+          endp = (char *)v + 1;
+        else
+        {
+          resp->rangeFirst = strtol(v, &endp, 10);
+          if (*endp == '-')
+            resp->rangeLast = strtol(endp + 1, &endp, 10);
+        }
+        if (*endp == '/')
+          resp->rangeTotal = strtol(endp + 1, NULL, 10);
+      }
+      break;
+    case HTTP_HDR_TRANSFER_ENCODING: // 마지막 coding이 chunked인지만 봄
+      if (h->value.len >= 7 && !strncasecmp(v + h->value.len - 7, "chunked", 7))
+        resp->chunked = 1;
+      break;
+    case HTTP_HDR_CACHE_CONTROL:
+      parse_cache_control(resp, buf, h->value);
+      break;
+    case HTTP_HDR_PRAGMA:
+      if (slice_is(v, h->value.len, "no-cache"))
+        resp->cacheFlags |= HTTP_CC_NO_CACHE;
+      break;
+    }
+  }
+  // Transfer-Encoding이 있으면 Content-Length는 무시 (RFC 7230 3.3.3). 기록하지 못한 header 중에 Transfer-Encoding이 있을 수 있으므로 그때도 무시
+  if (resp->chunked || resp->f.overflow)
+    resp->contentLength = -1;
+  return rc;
+}
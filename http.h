@@ -0,0 +1,131 @@
+/*
+ * http.h - HTTP/1.x request/response header parser and header scanning helpers
+ *
+ * 받은 버퍼를 그대로 두고 method, target, version, header 위치(offset, 길이)만 기록함.
+ * 데이터가 덜 들어왔으면 HTTP_PARSE_AGAIN을 반환하고, 이어서 더 받은 버퍼로 다시 호출하면
+ * 끝난 줄부터 이어서 파싱함 (non-blocking 소켓에서 조금씩 읽어도 처음부터 다시 보지 않음).
+ */
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#include <stddef.h>
+
+#define HTTP_MAX_HEADERS 64 // 요청 하나에서 기록할 최대 header 개수 (요청은 넘으면 에러, 응답은 넘는 header를 세기만 하고 건너뜀)
+#define HTTP_MAX_LINE 8192  // 한 줄 최대 길이 (넘으면 에러)
+
+#define HTTP_PARSE_AGAIN 0       // 아직 header 끝(빈 줄)까지 안 들어옴
+#define HTTP_PARSE_ERROR -1      // 형식이 잘못된 요청
+#define HTTP_PARSE_TOOLARGE -2   // header가 너무 많거나 줄이 너무 김
+
+// 자주 쓰는 header 이름. http_header_id()가 이름 하나를 한번에 이 값으로 바꿔줌 (모르는 이름은 HTTP_HDR_OTHER)
+enum
+{
+  HTTP_HDR_OTHER = 0,
+  HTTP_HDR_HOST,
+  HTTP_HDR_CONNECTION,
+  HTTP_HDR_PROXY_CONNECTION,
+  HTTP_HDR_KEEP_ALIVE,
+  HTTP_HDR_USER_AGENT,
+  HTTP_HDR_CONTENT_LENGTH,
+  HTTP_HDR_CONTENT_TYPE,
+  HTTP_HDR_CONTENT_RANGE,
+  HTTP_HDR_CONTENT_ENCODING,
+  HTTP_HDR_TRANSFER_ENCODING,
+  HTTP_HDR_TE,
+  HTTP_HDR_TRAILER,
+  HTTP_HDR_UPGRADE,
+  HTTP_HDR_EXPECT,
+  HTTP_HDR_RANGE,
+  HTTP_HDR_IF_RANGE,
+  HTTP_HDR_ACCEPT_RANGES,
+  HTTP_HDR_CACHE_CONTROL,
+  HTTP_HDR_PRAGMA,
+  HTTP_HDR_EXPIRES,
+  HTTP_HDR_DATE,
+  HTTP_HDR_AGE,
+  HTTP_HDR_VARY,
+  HTTP_HDR_ETAG,
+  HTTP_HDR_LAST_MODIFIED,
+  HTTP_HDR_IF_MODIFIED_SINCE,
+  HTTP_HDR_IF_NONE_MATCH,
+  HTTP_HDR_LOCATION,
+  HTTP_HDR_AUTHORIZATION,
+  HTTP_HDR_PROXY_AUTHORIZATION,
+  HTTP_HDR_COOKIE,
+  HTTP_HDR_SET_COOKIE,
+  HTTP_HDR_COUNT
+};
+
+// Cache-Control (와 Pragma) 지시어
+#define HTTP_CC_NO_STORE 0x01
+#define HTTP_CC_NO_CACHE 0x02
+#define HTTP_CC_PRIVATE 0x04
+#define HTTP_CC_PUBLIC 0x08
+#define HTTP_CC_MUST_REVALIDATE 0x10
+
+// 버퍼 안의 한 구간. 버퍼가 옮겨져도(내용이 같으면) 그대로 쓸 수 있도록 포인터 대신 offset으로 저장
+typedef struct
+{
+  int off; // 버퍼 시작으로부터의 위치
+  int len; // 길이
+} http_slice;
+
+typedef struct
+{
+  http_slice name;  // ':' 앞까지
+  http_slice value; // 앞뒤 공백 뺀 값
+  int id;           // HTTP_HDR_* (파싱할 때 한번 분류해둠)
+} http_header;
+
+// 요청, 응답 공통 부분 (파싱 상태와 header 목록)
+typedef struct
+{
+  int state;                            // 어디까지 파싱했는지 (첫 줄 / headers / 완료)
+  size_t pos;                           // 다음에 볼 줄의 시작 위치
+  http_header headers[HTTP_MAX_HEADERS];
+  int nheaders;
+  signed char index[HTTP_HDR_COUNT];    // 아는 header마다 처음 나온 headers[] 위치 (없으면 -1)
+  int overflow;                         // headers[]가 차서 기록하지 못한 header 수 (요청은 -1, 넘치면 에러)
+} http_fields;
+
+typedef struct
+{
+  http_fields f;
+  http_slice method, target, version;
+  char *base; // http_request_terminate() 후 문자열로 쓸 수 있는 버퍼 (그 전에는 NULL)
+} http_request;
+
+// upstream 응답 header. 채울 때 한번만 파싱해서 필요한 값을 미리 계산해둠
+typedef struct
+{
+  http_fields f;
+  http_slice version, reason;
+  int status;
+  long contentLength;                     // 없으면 -1 (chunked이거나 기록하지 못한 header가 있을 때도 -1)
+  long rangeFirst, rangeLast, rangeTotal; // Content-Range (없으면 -1)
+  int chunked;                            // Transfer-Encoding: chunked
+  int cacheFlags;                         // HTTP_CC_*
+  long maxAge;                            // Cache-Control max-age (없으면 -1)
+} http_response;
+
+void http_request_init(http_request *req);
+int http_parse_request(http_request *req, const char *buf, size_t len); // 완료되면 header 끝(빈 줄 포함)까지의 byte 수 반환
+void http_request_terminate(http_request *req, char *buf);            // 각 구간 끝에 '\0'을 써서 바로 C 문자열로 쓸 수 있게 함
+char *http_request_value(http_request *req, int id);                   // terminate 후 해당 header 값 (없으면 NULL)
+
+void http_response_init(http_response *resp);
+int http_parse_response(http_response *resp, const char *buf, size_t len); // http_parse_request()와 같은 반환값
+#define http_response_header(resp, id) ((resp)->f.index[id] < 0 ? NULL : &(resp)->f.headers[(int)(resp)->f.index[id]])
+
+// header 한 줄 단위 helper (rio_readlineb로 읽은 응답 header 등)
+int http_header_id(const char *name, int len);                     // header 이름을 HTTP_HDR_*로 (perfect hash)
+int http_classify_line(const char *line, int len, const char **value); // "Name: value" 줄을 분류. header 줄이 아니면 -1
+
+// 구분자 찾기. SSE2/AVX2 중 CPU가 지원하는 것을 시작할 때 골라서 씀
+const char *http_scan2(const char *p, const char *end, char a, char b); // [p, end)에서 a나 b가 처음 나오는 위치 (없으면 NULL)
+int http_simd_use(const char *name);                                    // "scalar", "sse2", "avx2" 중 하나로 바꿈 (지원 안하면 -1)
+const char *http_simd_name(void);                                       // 지금 쓰는 구현 이름
+
+#define http_str(req, slice) ((req)->base + (slice).off) // terminate 후 구간을 문자열로
+
+#endif /* __HTTP_H__ */
@@ -0,0 +1,269 @@
+/*
+ * origin.c - origin별 동시 연결 수 제한과 공정한 대기열 (origin.h 참고)
+ */
+#include "csapp.h"
+#include "origin.h"
+
+// 기다리는 요청 하나 (기다리는 쓰레드의 stack에 있음)
+typedef struct origin_waiter
+{
+  struct origin_waiter *next;
+  sem_t ready;  // 차례가 오면 V
+  int granted;  // 자리를 받았는지 (시간이 지난 뒤에 받았을 수도 있으므로 mutex를 잡고 확인)
+} origin_waiter;
+
+// 같은 클라이언트(IP hash)의 대기열
+typedef struct origin_flow
+{
+  struct origin_flow *next; // 기다리는 요청이 있는 flow 목록 (DRR 순서)
+  origin_waiter *head, *tail;
+  int deficit;              // 이번 차례에 꺼낼 수 있는 양
+  int active;               // 목록에 들어있는지
+} origin_flow;
+
+typedef struct
+{
+  char key[ORIGIN_KEY_MAX]; // host:port ("" 이면 빈 자리)
+  int inflight;             // 열려있는 연결 수
+  int queued;               // 기다리는 요청 수
+  time_t used;              // 마지막으로 쓴 시각 (자리가 모자랄 때 버릴 곳 고르기)
+  origin_flow *first, *last; // 기다리는 요청이 있는 flow들
+  origin_flow flows[ORIGIN_FLOWS];
+} origin_entry;
+
+static struct
+{
+  origin_entry entries[ORIGIN_COUNT];
+  int maxInflight;
+  origin_stats stats;
+  sem_t mutex;
+} origins;
+
+void origin_init(int maxInflight)
+{
+  memset(&origins.entries, 0, sizeof(origins.entries));
+  memset(&origins.stats, 0, sizeof(origins.stats));
+  origins.maxInflight = maxInflight;
+  Sem_init(&origins.mutex, 0, 1);
+}
+
+unsigned origin_client(struct sockaddr *addr)
+{
+  unsigned char *p;
+  unsigned h = 2166136261u; // FNV-1a
+  int n, i;
+
+  if (addr->sa_family == AF_INET)
+  {
+    p = (unsigned char *)&((struct sockaddr_in *)addr)->sin_addr;
+    n = 4;
+  }
+  else if (addr->sa_family == AF_INET6)
+  {
+    p = (unsigned char *)&((struct sockaddr_in6 *)addr)->sin6_addr;
+    n = 16;
+  }
+  else
+    return 0;
+  for (i = 0; i < n; i++)
+    h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+/* key 자리 찾기. 없으면 빈 자리나 쓰지 않는 자리 중 가장 오래된 곳을 씀 (모두 사용 중이면 -1). mutex를 잡고 불러야 함 */
+static int find_entry(char *key, time_t now)
+{
+  int i, idx = -1;
+
+  for (i = 0; i < ORIGIN_COUNT; i++)
+  {
+    origin_entry *e = &origins.entries[i];
+    if (!strcmp(e->key, key))
+      return i;
+    if (e->inflight || e->queued)
+      continue;
+    if (idx < 0 || e->used < origins.entries[idx].used)
+      idx = i;
+  }
+  if (idx >= 0)
+  {
+    strcpy(origins.entries[idx].key, key);
+    origins.entries[idx].used = now;
+  }
+  return idx;
+}
+
+/* flow를 DRR 목록 끝에 붙임 */
+static void flow_append(origin_entry *e, origin_flow *f)
+{
+  f->next = NULL;
+  f->active = 1;
+  if (e->last)
+    e->last->next = f;
+  else
+    e->first = f;
+  e->last = f;
+}
+
+/* DRR로 다음 요청 꺼내기. 앞의 flow부터 deficit이 남았으면 하나 꺼내고, 모자라면 quantum을 더해서 뒤로 보냄 */
+static origin_waiter *drr_next(origin_entry *e)
+{
+  origin_flow *f;
+  origin_waiter *w;
+
+  while ((f = e->first))
+  {
+    if (f->deficit < 1)
+    {
+      f->deficit += ORIGIN_QUANTUM;
+      e->first = f->next;
+      if (!e->first)
+        e->last = NULL;
+      flow_append(e, f);
+      continue;
+    }
+    w = f->head;
+    f->head = w->next;
+    if (!f->head)
+      f->tail = NULL;
+    f->deficit--;
+    e->queued--;
+    if (!f->head) // 비었으면 목록에서 빼고 deficit을 남기지 않음
+    {
+      e->first = f->next;
+      if (!e->first)
+        e->last = NULL;
+      f->active = 0;
+      f->deficit = 0;
+    }
+    return w;
+  }
+  return NULL;
+}
+
+int origin_acquire(char *host, char *port, unsigned client, int timeoutMs)
+{
+  char key[ORIGIN_KEY_MAX];
+  origin_waiter w, **pp;
+  origin_flow *f;
+  origin_entry *e;
+  struct timespec until;
+  int idx, rc;
+
+  if (snprintf(key, sizeof(key), "%s:%s", host, port) >= sizeof(key))
+    return ORIGIN_UNLIMITED;
+
+  P(&origins.mutex);
+  if ((idx = find_entry(key, time(NULL))) < 0)
+  {
+    V(&origins.mutex);
+    return ORIGIN_UNLIMITED;
+  }
+  e = &origins.entries[idx];
+  e->used = time(NULL);
+  if (e->inflight < origins.maxInflight && !e->queued)
+  {
+    e->inflight++;
+    V(&origins.mutex);
+    return idx;
+  }
+  if (timeoutMs <= 0) // 기다리지 않음 (집계에도 넣지 않음)
+  {
+    V(&origins.mutex);
+    return ORIGIN_BUSY;
+  }
+  if (e->queued >= ORIGIN_QUEUE_MAX)
+  {
+    origins.stats.rejected++;
+    V(&origins.mutex);
+    return ORIGIN_BUSY;
+  }
+
+  // 자기 flow 대기열 끝에 서서 차례를 기다림
+  Sem_init(&w.ready, 0, 0);
+  w.next = NULL;
+  w.granted = 0;
+  f = &e->flows[client % ORIGIN_FLOWS];
+  if (f->tail)
+    f->tail->next = &w;
+  else
+    f->head = &w;
+  f->tail = &w;
+  if (!f->active)
+    flow_append(e, f);
+  e->queued++;
+  origins.stats.queued++;
+  V(&origins.mutex);
+
+  clock_gettime(CLOCK_REALTIME, &until);
+  until.tv_sec += timeoutMs / 1000;
+  until.tv_nsec += (timeoutMs % 1000) * 1000000L;
+  if (until.tv_nsec >= 1000000000L)
+  {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000L;
+  }
+  while ((rc = sem_timedwait(&w.ready, &until)) < 0 && errno == EINTR)
+    ;
+
+  P(&origins.mutex);
+  if (!w.granted) // 시간이 지남: 대기열에서 빠짐
+  {
+    for (pp = &f->head; *pp != &w; pp = &(*pp)->next)
+      ;
+    *pp = w.next;
+    if (f->tail == &w)
+    {
+      f->tail = NULL;
+      for (origin_waiter *t = f->head; t; t = t->next)
+        f->tail = t;
+    }
+    if (!f->head) // flow가 비었으면 DRR 목록에서도 뺌
+    {
+      origin_flow **fp;
+      for (fp = &e->first; *fp != f; fp = &(*fp)->next)
+        ;
+      *fp = f->next;
+      if (e->last == f)
+      {
+        e->last = NULL;
+        for (origin_flow *t = e->first; t; t = t->next)
+          e->last = t;
+      }
+      f->active = 0;
+      f->deficit = 0;
+    }
+    e->queued--;
+    origins.stats.timeouts++;
+    idx = ORIGIN_BUSY;
+  }
+  V(&origins.mutex);
+  sem_destroy(&w.ready);
+  return idx;
+}
+
+void origin_release(int idx)
+{
+  origin_entry *e;
+  origin_waiter *w;
+
+  if (idx < 0)
+    return;
+  e = &origins.entries[idx];
+  P(&origins.mutex);
+  e->inflight--;
+  while (e->inflight < origins.maxInflight && (w = drr_next(e))) // 받은 쪽의 자리로 바로 넘김
+  {
+    e->inflight++;
+    w->granted = 1;
+    V(&w->ready);
+  }
+  V(&origins.mutex);
+}
+
+void origin_getStats(origin_stats *stats)
+{
+  P(&origins.mutex);
+  *stats = origins.stats;
+  V(&origins.mutex);
+}
@@ -0,0 +1,36 @@
+/*
+ * origin.h - endserver(origin)별 동시 연결 수 제한과 클라이언트 간 공정한 대기열
+ *
+ * origin 하나에 동시에 열 수 있는 연결을 제한하고, 넘치는 요청은 기다리게 함.
+ * 기다리는 요청은 클라이언트 IP를 hash한 flow별 대기열에 넣고, 자리가 나면 flow들을
+ * deficit round robin으로 돌면서 하나씩 꺼냄. 그래서 한 클라이언트가 요청을 많이 쌓아도
+ * 다른 클라이언트의 요청은 자기 차례에 바로 나가고, 느린 origin 하나가 모든 쓰레드를 붙잡지 않음.
+ */
+#ifndef __ORIGIN_H__
+#define __ORIGIN_H__
+
+#include <sys/socket.h>
+
+#define ORIGIN_COUNT 64          // 기억하는 origin 수 (꽉 차고 모두 사용 중이면 제한 없이 연결)
+#define ORIGIN_FLOWS 64          // origin마다 클라이언트 flow 수 (IP hash가 겹치면 같은 대기열을 씀)
+#define ORIGIN_QUEUE_MAX 256     // origin 하나에 기다릴 수 있는 최대 요청 수 (넘으면 바로 실패)
+#define ORIGIN_QUANTUM 1         // flow 차례마다 더해주는 deficit (요청 하나의 비용이 1)
+#define ORIGIN_KEY_MAX 280       // host:port 최대 길이
+
+#define ORIGIN_UNLIMITED -2      // origin_acquire: 자리를 기억하지 못해서 제한 없이 연결함 (release하지 않음)
+#define ORIGIN_BUSY -1           // origin_acquire: 대기열이 꽉 찼거나 기다리다 시간이 지남
+
+typedef struct
+{
+  long queued;   // 기다렸던 요청 수
+  long timeouts; // 기다리다 포기한 요청 수
+  long rejected; // 대기열이 꽉 차서 바로 실패한 요청 수
+} origin_stats;
+
+void origin_init(int maxInflight);                                         // origin마다 동시 연결 수 제한
+int origin_acquire(char *host, char *port, unsigned client, int timeoutMs); // 연결할 자리 얻기 (자리 번호, ORIGIN_UNLIMITED 또는 ORIGIN_BUSY). timeoutMs가 0이면 기다리지 않음
+void origin_release(int idx);                                              // 연결 끝 (기다리는 요청이 있으면 다음 차례에게 넘김)
+unsigned origin_client(struct sockaddr *addr);                             // 클라이언트 주소 hash (flow 고르기)
+void origin_getStats(origin_stats *stats);
+
+#endif /* __ORIGIN_H__ */
@@ -1,11 +1,63 @@
 #include <stdio.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include "csapp.h"
+#include "http.h"
+#include "arena.h"
+#include "accesslog.h"
+#include "resolver.h"
+#include "timerwheel.h"
+#include "origin.h"
+#include "ratelimit.h"
+#include "hedge.h"
+#include "backend.h"
+#include "route.h"
+#include "tunnel.h"
 
 /* Recommended max cache and object sizes */
 #define MAX_CACHE_SIZE 1049000 // 최대 캐싱할 수 있는 사이즈
 #define MAX_OBJECT_SIZE 102400 // 최대 캐싱할 수 있는 obj 사이즈
-#define CACHE_OBJS_COUNT 10    // 최대 캐싱할 수 있는 obj 개수
+#define CACHE_OBJS_COUNT 32    // 최대 캐싱할 수 있는 obj 개수 (body는 공유되므로 실제 크기는 MAX_CACHE_SIZE로 제한)
 #define LRU_MAGIC_NUMBER 100   // 최대 우선순위 숫자
+#define MAX_RANGES 16          // 한 Range 요청에서 처리할 최대 구간 개수
+#define SEGMENT_SIZE 65536     // MAX_OBJECT_SIZE를 넘는 객체를 나누어 캐싱할 segment 크기
+#define SEGMENT_COUNT 16       // 최대 캐싱할 수 있는 segment 개수
+#define SEG_OBJS_COUNT 16      // segment로 나누어 캐싱하는 큰 객체의 최대 개수
+#define NEG_CACHE_COUNT 32     // 최대 기억할 수 있는 실패(404/410, 연결 실패) 개수
+#define NEG_RESPONSE_TTL 10    // 404/410 응답을 기억하는 시간 (초)
+#define NEG_CONNECT_TTL 3      // endserver 연결 실패를 기억하는 시간 (초)
+#define PREFETCH_QUEUE_SIZE 16 // 미리 받아올 요청을 쌓아두는 큐 크기 (꽉 차면 버림)
+#define PREFETCH_PER_PAGE 8    // HTML 하나에서 미리 받아올 최대 객체 수
+#define PREFETCH_NICE 10       // prefetch 쓰레드의 nice 값 (클라이언트 요청보다 낮은 우선순위)
+#define MAX_ETAG 128           // 기억해둘 ETag 최대 길이 (넘으면 ETag로는 304를 만들지 않음)
+#define MAX_RESP_HDR 65536     // 응답 header 최대 크기 (rio 버퍼보다 크면 arena에서 늘려가며 받음, 넘으면 502)
+#define RESP_TOOLARGE -2       // read_response: header가 MAX_RESP_HDR보다 크거나 한 줄이 HTTP_MAX_LINE보다 김
+#define THREAD_STACK_KB 256    // 쓰레드 stack 기본 크기 (KB, -s로 바꿈). 큰 버퍼는 arena에 있어서 기본값(보통 8MB)보다 훨씬 작아도 됨
+#define STATS_PATH "/proxy-stats" // loopback에서 proxy에 직접 이 경로를 요청하면 메모리 사용량, DNS 캐시 집계를 보여줌
+#define LIMITS_PATH "/proxy-limits" // loopback에서 proxy에 직접 요청하면 제한 값 보기 ("?name=value&..."를 붙이면 바꿈)
+#define ACCEPT_BATCH 64        // listen 소켓이 읽을 수 있게 되면 한번에 받는 최대 연결 수
+#define CONNECT_TIMEOUT_MS 3000 // endserver 연결을 기다리는 최대 시간 (ms, -c로 바꿈). 주소가 여러개면 모두 합쳐서
+#define HEADER_TIMEOUT_MS 10000     // 클라이언트가 요청 header를 다 보내야 하는 시간 (ms, 넘으면 408)
+#define FIRST_BYTE_TIMEOUT_MS 30000 // endserver가 요청을 받고 응답 header를 보내야 하는 시간 (ms, 넘으면 504)
+#define IDLE_TIMEOUT_MS 30000       // body를 주고받다가 멈춰있을 수 있는 시간 (ms)
+#define REQUEST_TIMEOUT_MS 600000   // 요청 하나를 처리하는 전체 시간 (ms)
+#define TUNNEL_IDLE_TIMEOUT_MS 300000 // CONNECT 터널이 양쪽 모두 조용히 있을 수 있는 시간 (ms)
+#define TUNNEL_TIMEOUT_MS 3600000     // CONNECT 터널 하나를 열어두는 전체 시간 (ms)
+#define TUNNEL_PORTS_MAX 16           // CONNECT로 열 수 있는 최대 port 수 (443 포함)
+#define ADMIT_MAX_INFLIGHT 512      // 동시에 처리하는 최대 연결 수 (-m으로 바꿈, 넘으면 503)
+#define ADMIT_MAX_MEMORY (64L << 20) // 연결들이 잡은 메모리 합계 한도 (byte, 넘으면 503)
+#define CODEL_TARGET_US 5000        // 연결을 받은 뒤 쓰레드가 처리를 시작하기까지 허용하는 지연 (us)
+#define CODEL_INTERVAL_US 100000    // 지연이 이 시간 내내 target을 넘으면 버리기 시작함 (us)
+#define RETRY_AFTER_SEC 1           // 503에 넣는 Retry-After (초)
+#define ORIGIN_MAX_INFLIGHT 32      // origin 하나에 동시에 여는 최대 연결 수 (-o로 바꿈, 넘으면 클라이언트별로 돌아가며 기다림)
+#define ORIGIN_QUEUE_TIMEOUT_MS 5000 // origin 자리를 기다리는 최대 시간 (ms, 넘으면 503)
+#define ENDSERVER_BUSY -3           // Open_endServer: origin 자리를 얻지 못함
+#define SHED_LINGER_MAX 256         // 503을 보낸 뒤 클라이언트가 요청을 다 보내고 닫을 때까지 기다려주는 연결 수
+#define SHED_LINGER_MS 1000         // 503을 보낸 연결을 기다려주는 최대 시간 (ms)
+#define BODY_CHUNKED -1              // body_length: Transfer-Encoding: chunked (끝까지 읽어봐야 크기를 앎)
+#define BODY_INVALID -2              // body_length: 크기를 알 수 없는 body (잘못된 Content-Length, chunked가 아닌 Transfer-Encoding)
+#define ROUTE_MS(field, def) (curRoute && curRoute->field ? curRoute->field : (def)) // route가 정한 제한 시간 (없으면 기본값)
 
 /* constants for building HTTP Request headers */
 /* You won't lose style points for including this long line in your code */
@@ -16,28 +68,147 @@ static const char *conn_hdr = "Connection: close\r\n";
 static const char *prox_conn_hdr = "Proxy-Connection: close\r\n";
 static const char *host_hdr_fmt = "Host: %s\r\n";
 static const char *request_hdr_fmt = "%s %s HTTP/1.0\r\n";
+static const char *chunked_request_hdr_fmt = "%s %s HTTP/1.1\r\n"; // chunked body는 HTTP/1.1에만 있음
+static const char *continue_hdr = "HTTP/1.1 100 Continue\r\n\r\n";
 static const char *endof_hdr = "\r\n";
 
-static const char *conn_key = "Connection";
-static const char *user_agent_key = "User-Agent";
-static const char *prox_conn_key = "Proxy-Connection";
-static const char *host_key = "Host";
+static const char *range_hdr_fmt = "Range: %s\r\n";
+static const char *tunnel_hdr = "HTTP/1.0 200 Connection established\r\n\r\n";
+
+/* constants for building 206 Partial Content responses */
+static const char *partial_hdr = "HTTP/1.0 206 Partial Content\r\n";
+static const char *content_range_fmt = "Content-Range: bytes %ld-%ld/%ld\r\n";
+static const char *byteranges_boundary = "PROXY_BYTERANGES_BOUNDARY";
+
+/* pre-serialized response for shedding load (written straight from the accept path) */
+#define STR(x) #x
+#define XSTR(x) STR(x)
+static const char overload_resp[] =
+    "HTTP/1.0 503 Service Unavailable\r\n"
+    "Retry-After: " XSTR(RETRY_AFTER_SEC) "\r\n"
+    "Content-type: text/plain\r\n"
+    "Content-length: 20\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "Proxy is overloaded\n";
+
+/* constants for pre-serialized cached response headers */
+static const char *ok_hdr = "HTTP/1.0 200 OK\r\n";
+static const char *not_modified_hdr = "HTTP/1.0 304 Not Modified\r\n";
+static const char *content_length_fmt = "Content-length: %ld\r\n";
 
 /* Prototypes */
+// accept한 연결. 주소는 받은 그대로 두고 이름이 필요할 때만 숫자로 바꿈 (accept 쓰레드에서 역방향 DNS 조회를 하지 않음)
+typedef struct
+{
+  int fd;
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  struct timespec accepted; // accept한 시각 (access log의 단계별 시간 기준)
+} conn_info;
+
+// glibc는 _GNU_SOURCE에서만 accept4를 선언하는데, 그러면 csapp.h의 gai_error()와 이름이 겹치므로 직접 선언함
+int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+
+// 과부하일 때 쓰레드를 만들기 전에 (accept 쓰레드에서) 연결을 거절함
+// 처리 중인 연결 수, 메모리 합계, 그리고 CoDel처럼 연결을 받고 쓰레드가 처리를 시작하기까지의 지연(sojourn)을 봄
+enum
+{
+  ADMIT_OK = 0,
+  ADMIT_SHED_INFLIGHT, // 처리 중인 연결이 너무 많음
+  ADMIT_SHED_MEMORY,   // 메모리 한도를 넘음
+  ADMIT_SHED_DELAY,    // 지연이 계속 target을 넘음 (CoDel)
+  ADMIT_REASONS
+};
+
+typedef struct
+{
+  long inflight;              // accept해서 아직 끝나지 않은 연결 수 (accept 쓰레드에서 늘리고 요청 쓰레드가 줄임)
+  long admitted;              // 받아들인 연결 수
+  long shed[ADMIT_REASONS];   // 이유별 거절한 연결 수
+  // CoDel 상태 (mutex 보호)
+  long firstAbove;            // 지연이 target을 넘기 시작하고 interval이 지나는 시각 (us, 0이면 target 아래)
+  long dropNext;              // 다음에 거절할 시각 (us)
+  long count;                 // 이번에 버리기 시작한 뒤 거절한 수 (많을수록 더 자주 거절)
+  int dropping;               // 거절하는 중인지
+  sem_t mutex;
+  // 503을 보내고 닫기를 기다리는 연결 (accept 쓰레드만 씀). 읽지 않은 요청이 남은 채로 닫으면 RST가 가서 503이 사라질 수 있음
+  struct pollfd pfds[1 + SHED_LINGER_MAX]; // [0]은 listen 소켓
+  long lingerUntil[1 + SHED_LINGER_MAX];   // 이 시각(ms)까지 안 닫히면 그냥 닫음
+  int nlinger;
+} AdmitState;
+
 // main and sub functions for proxy
+void accept_batch(int listenfd);                                    // 쌓여있는 연결을 한번에 받아서 쓰레드로 넘김
+int admit_check(long nowUs);                                        // 새 연결을 받아들일지 (ADMIT_OK 또는 거절 이유)
+void admit_sample(long sojournUs, long nowUs);                      // 쓰레드가 처리를 시작할 때 지연 기록 (CoDel)
+void admit_shed(int fd, int reason, long nowMs);                    // 503 쓰고 닫기 (클라이언트가 닫을 때까지 잠깐 기다려줌)
+void admit_linger(long nowMs);                                      // 기다리던 연결 중 끝난 것 닫기
 void *thread(void *vargp);
-void doit(int fd);                                                                                      /* --------------- 연결된 client에 대해서 유효성 확인 및 요청에 대한 응답 처리 --------------- */
+void doit(int fd, arena_t *arena);                                                                      /* --------------- 연결된 client에 대해서 유효성 확인 및 요청에 대한 응답 처리 --------------- */
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);                     /* --------------- 확실한 error에 대해서 처리하여 client에게 응답함 --------------- */
-void serve(int fd, char *method, char *uri, char *version, rio_t *rio);                                 /* 서버로 요청 및 응답받은 내용 반환 */
+void limits_serve(int fd, char *uri);                                                                   // 제한 값 보기, 바꾸기
+int admin_request(int fd, http_request *req);                                                // proxy 자신에게 loopback에서 온 요청인지
+void limits_reject(int fd, long retryMs);                                                               // 요청 수 제한을 넘으면 429
+void serve(int fd, rio_t *rio, arena_t *arena, char *method, char *uri, char *version, http_request *req); /* 서버로 요청 및 응답받은 내용 반환 */
+long body_length(http_request *req);                                                                    /* 요청 body 크기 (없으면 0, BODY_CHUNKED, BODY_INVALID) */
+int send_body(int serverfd, rio_t *rio, long length);                                                   /* 요청 body를 endserver로 흘려보냄 (버퍼 하나만 씀) */
+void body_discard(int fd, rio_t *rio);                                                                  /* 응답을 보낸 뒤 남은 요청 body를 잠깐 읽어서 버림 */
+void serve_tunnel(int fd, rio_t *rio, char *authority);                                                  /* CONNECT: endserver와 연결하고 양방향으로 옮김 */
+int tunnel_addPorts(char *list);                                                                        /* CONNECT로 열 수 있는 port 추가 ("8443,5222") */
 void parse_uri(char *uri, char *hostname, int *port, char *path);                                       /* uri로부터 hostname, port, path파싱 */
-void build_requesthdrs(char *http_header, char *method, char *hostname, char *path, rio_t *client_rio); /* endserver로의 request를 위해 header 작성 */
+char *build_requesthdrs(arena_t *arena, char *method, char *hostname, char *path, http_request *req, char **range); /* endserver로의 request를 위해 header 작성 */
 int Open_endServer(char *hostname, int port);                                                           /* 파싱한 port가 int형이기 때문에 문자열로 변환 및 endserver와 연결 */
+void Close_endServer(int fd);                                                                           /* endserver 연결 닫기 (제한 시간 대상에서 먼저 뺌) */
+void send_request(int serverfd, char *request_hdrs, char *range);                                        /* endserver로 request 전송 (필요하면 Range header 추가) */
+int hedge_race(int fd, char *hostname, int port, char *path, char *request_hdrs, char *range);           /* 응답이 늦으면 한번 더 보내고 먼저 응답하는 연결을 씀 */
+
+// 채울 때 응답 header를 한번 파싱해서 미리 만들어둔 200 응답 header의 정보
+// header는 status line, Content-type, Content-length, validator 줄들, 나머지 줄들, 빈 줄 순서로 만들고 각 위치만 기억해서
+// hit일 때 HEAD, 304, 206 header를 다시 훑지 않고 잘라 붙여서 만듦
+typedef struct
+{
+  int ctypeOff;        // Content-type 줄 시작 (= status line 끝)
+  int lenOff;          // Content-length 줄 시작
+  int valOff;          // ETag, Last-Modified, Cache-Control, Expires, Date, Vary 줄 시작 (304에 그대로 씀)
+  int restOff;         // 나머지 줄 시작
+  int endOff;          // 마지막 빈 줄 시작
+  long length;         // body 크기 (모르면 -1)
+  char etag[MAX_ETAG]; // ETag 값 (없으면 "")
+  time_t lastModified; // Last-Modified (없으면 0)
+} hdr_meta;
+
+int read_response(rio_t *rio, http_response *resp, arena_t *arena, char **hdr);                    // 응답 header를 빈 줄까지 받아서 파싱
+int resp_storable(http_response *resp);                                                             // 캐시에 저장해도 되는 응답인지
+int hdr_build(char *dst, int dstSize, char *raw, http_response *resp, long length, hdr_meta *meta); // 캐시에 둘 200 header 만들기
+char *hdr_buildArena(arena_t *arena, char *raw, http_response *resp, long length, hdr_meta *meta, int *size); // hdr_build()를 arena에 딱 맞는 크기로
+int hdr_notModified(http_request *req, hdr_meta *meta);                                             // 클라이언트 조건부 요청에 304로 답할 수 있는지
+void hdr_write304(int fd, char *hdr, hdr_meta *meta);                                               // 304 응답 보내기
+time_t parse_http_date(const char *date);                                                           // HTTP-date를 time_t로
+int etag_match(char *list, char *etag);                                                             // If-None-Match 목록에 etag가 있는지
+
+// functions for byte-range responses
+typedef struct
+{
+  long first; // 구간 시작 byte (포함)
+  long last;  // 구간 끝 byte (포함)
+} byte_range;
+
+typedef int (*range_writer)(int fd, void *ctx, long first, long last); // body의 [first, last] 구간을 fd에 써주는 함수
+
+int parse_range(char *range, long total, byte_range *ranges);                                                  // Range header 값을 구간 리스트로 파싱
+long range_start(char *range);                                                                                 // Range 요청의 가장 앞 구간 시작 위치
+int serve_range(int fd, char *hdr, hdr_meta *meta, long bodySize, char *range, range_writer writer, void *ctx); // 완전한 객체로부터 206/416 응답
+int write_body(int fd, void *body, long first, long last);                                                    // 메모리에 있는 body 구간 쓰기
 
 // functions for caching
 void cache_init(void);                                // 캐시 초기화
 int cache_isCached(char *request);                    // 캐싱되어있는지 확인
+int cache_startHit(char *request);                    // 캐시된 블럭을 읽기 lock을 잡은 채로 찾기
 int cache_findCacheableBlock(void);                   // 캐싱 가능한 블럭 확인
-void cache_cacheRequest(char *request, char *object); // 요청을 캐싱하기
+void cache_cacheRequest(char *request, char *hdr, int hdrSize, hdr_meta *meta, char *bodyData, int bodySize); // 요청을 캐싱하기
+void cache_evict(int index);                                                    // 블럭 비우기
+void cache_invalidate(char *authority, char *path);                             // 대상의 path에 대한 GET, HEAD 캐시 비우기 (POST, PUT 등이 성공했을 때)
 
 void startRead(int index);    // 읽을 수 있는지 확인 후 읽기 진입
 void endRead(int index);      // 읽기 완료 후 반납
@@ -45,11 +216,141 @@ void startWrite(int index);   // 쓸 수 있는지 확인 후 쓰기 진입
 void endWrite(int index);     // 쓰기 완료 후 반납
 void lowerPriorty(int index); // 새로 캐싱한 데이터 외에는 우선순위 낮추기
 
+// MAX_OBJECT_SIZE를 넘는 객체는 header와 전체 크기만 객체 목록에 두고, body는 SEGMENT_SIZE 단위로 따로 캐싱함
+typedef struct
+{
+  char req[MAXLINE]; // 요청 저장 (ex. GET localhost:8000/test.mp4)
+  char *hdr;         // 미리 만들어둔 response header (200 기준)
+  int hdrSize;       // hdr 크기
+  hdr_meta meta;     // hdr 안의 위치, validator
+  long total;        // body 전체 크기
+  long id;           // segment와 객체를 이어주는 고유 번호 (0이면 비어있음)
+  int priority;      // LRU 우선순위
+} seg_object;
+
+typedef struct
+{
+  long objId;   // 어느 객체의 segment인지 (0이면 비어있음)
+  long index;   // 객체 안에서 몇번째 segment인지
+  char *data;   // segment 내용 (실제 크기만큼만 할당)
+  int size;     // data 크기 (마지막 segment는 SEGMENT_SIZE보다 작음)
+  int priority; // LRU 우선순위
+  int pinCnt;   // 지금 이 segment를 클라이언트에 쓰고 있는 쓰레드 수 (0일때만 교체 가능)
+} cache_segment;
+
+typedef struct
+{
+  seg_object objs[SEG_OBJS_COUNT];  // 큰 객체 목록
+  cache_segment segs[SEGMENT_COUNT]; // segment 목록. 객체와 상관없이 각각 LRU로 교체됨
+  long nextId;                       // 다음에 등록할 객체 번호
+  sem_t mutex;                       // 목록 보호. 클라이언트에 쓰는 동안에는 잡지 않고 pinCnt로 보호함
+} SegCache;
+
+// 큰 객체 하나를 보내는 동안의 상태. 없는 segment는 열어둔 endserver 연결에서 순서대로 읽어서 채움
+typedef struct
+{
+  char *hdr; // 객체의 미리 만들어둔 response header
+  int hdrSize;
+  hdr_meta meta;
+  long total; // body 전체 크기
+  long objId; // 캐시에 등록된 객체 번호
+
+  char *hostname, *request_hdrs; // segment를 채우기 위해 다시 요청할 때 사용
+  int port;
+  int servfd;      // 열려있는 endserver 연결 (-1이면 없음)
+  rio_t *rio;      // servfd를 읽는 rio (처음 응답을 이어받을 때는 serve()의 것을 그대로 씀)
+  rio_t *own_rio;  // 직접 다시 연결했을 때 쓰는 rio (처음 다시 연결할 때 잡음)
+  long pos;        // servfd에서 다음에 읽을 body 위치
+  long end;        // servfd가 보내주는 body 끝 위치 (206이 중간까지만 오면 그 뒤 segment는 다시 요청함)
+  char *segBuf;    // 서버에서 읽은 segment를 담는 버퍼
+  arena_t *arena;  // 요청의 arena (hdr, own_rio, segBuf를 여기서 잡음)
+} seg_stream;
+
+void segcache_init(void);                                                          // segment 캐시 초기화
+int segcache_findObject(char *request, seg_stream *st, arena_t *arena);             // 큰 객체가 등록되어있는지 확인
+long segcache_addObject(char *request, char *hdr, int hdrSize, hdr_meta *meta);     // 큰 객체 등록
+int segcache_pin(long objId, long index, char **data);                             // segment 찾아서 교체되지 않게 잡기
+void segcache_unpin(int slot);                                                     // 잡았던 segment 놓기
+void segcache_store(long objId, long index, char *data, int size);                 // segment 캐싱하기
+void segcache_touch(int *priority, int isObj);                                     // LRU 우선순위 갱신
+
+void seg_initStream(seg_stream *st, arena_t *arena, char *hostname, int port, char *request_hdrs); // 큰 객체 전송 상태 초기화
+void seg_closeStream(seg_stream *st);                                              // 열려있는 endserver 연결 닫기
+void seg_freeStream(seg_stream *st);                                               // 큰 객체 전송 끝 (연결 닫고 버퍼 반납)
+int seg_open(seg_stream *st, long segStart);                                       // segStart부터 endserver에 Range 요청
+int seg_fill(seg_stream *st, long index);                                          // 없는 segment를 서버에서 받아서 채움
+int seg_write(int fd, void *ctx, long first, long last);                           // segment 단위로 body 구간 쓰기
+void serve_segmented(int fd, seg_stream *st, char *range);                          // 큰 객체 응답
+
+// 실패한 요청/연결을 짧은 시간동안 기억해두고 같은 요청은 서버에 보내지 않음
+typedef struct
+{
+  char key[MAXLINE]; // 요청 (ex. GET localhost:8000/nothing.html) 또는 연결에 실패한 host:port
+  char *resp;        // 저장해둔 에러 응답 (연결 실패면 NULL)
+  int respSize;      // resp 크기
+  time_t expires;    // 이 시각이 지나면 무효 (0이면 비어있음)
+} neg_entry;
+
+typedef struct
+{
+  neg_entry entries[NEG_CACHE_COUNT];
+  sem_t mutex;
+} NegCache;
+
+void negcache_init(void);                                       // 실패 캐시 초기화
+int negcache_lookup(char *key, int fd);                         // 기억하는 실패인지 확인 (응답이 있으면 fd에 써줌)
+void negcache_add(char *key, char *resp, int respSize, int ttl); // 실패 기억하기
+void negcache_remove(char *key);                                // 기억하던 실패 지우기
+
+// HTML을 채울 때 같은 서버의 포함 객체(img src, script src, link href)를 백그라운드에서 미리 캐싱해둠
+typedef struct
+{
+  char hostname[MAXLINE / 32];  // 받아올 서버
+  int port;
+  char authority[MAXLINE / 32]; // 캐시 key와 Host에 쓸 요청 대상 (HTML을 요청한 host:port)
+  char path[MAXLINE];           // 받아올 경로
+} prefetch_item;
+
+// CS:APP의 sbuf와 같은 방식의 원형 큐. 넣을 때는 기다리지 않고 꽉 차면 버림
+typedef struct
+{
+  prefetch_item items[PREFETCH_QUEUE_SIZE];
+  int front;   // 마지막으로 꺼낸 위치
+  int rear;    // 마지막으로 넣은 위치
+  sem_t mutex; // items 접근 보호
+  sem_t slots; // 빈 자리 수
+  sem_t filled; // 쌓인 요청 수
+} PrefetchQueue;
+
+void prefetch_init(void);                                                               // prefetch 큐 초기화 및 쓰레드 생성
+void *prefetch_thread(void *vargp);                                                     // 큐에서 꺼내서 미리 받아오는 쓰레드
+void prefetch_scan(char *hostname, int port, char *authority, char *path, char *hdr, hdr_meta *meta, char *body, int bodySize); // HTML에서 포함 객체 찾아서 큐에 넣기
+int prefetch_resolve(char *hostname, int port, char *base, char *url, char *path);      // 같은 서버의 객체면 경로 계산
+void prefetch_enqueue(char *hostname, int port, char *authority, char *path);           // 큐에 넣기 (꽉 찼으면 버림)
+void prefetch_fetch(prefetch_item *item);                                               // 서버에서 받아서 캐싱
+
+// 내용이 같은 body는 한번만 저장하고 여러 캐시 블럭이 refCnt로 공유함
+typedef struct
+{
+  unsigned long hash; // body 내용의 hash (hash가 같으면 memcmp로 한번 더 확인)
+  char *data;         // body 내용
+  int size;           // body 크기
+  int refCnt;         // 이 body를 가리키는 캐시 블럭 수 (0이면 빈 자리)
+} cache_body;
+
+unsigned long cache_hash(char *data, int size);                          // body 내용 hash
+cache_body *cache_findBody(unsigned long hash, char *data, int size);   // 같은 내용의 body가 있으면 참조 얻기
+cache_body *cache_insertBody(unsigned long hash, char *data, int size); // 새 body 저장
+void cache_releaseBody(cache_body *body);                                // body 참조 놓기 (0이 되면 반납)
+
 // 캐시를 저장할 하나하나의 블럭
 typedef struct
 {
-  char obj[MAX_OBJECT_SIZE]; // 요청에 대응하는 내용 저장
-  char req[MAXLINE];         // 요청 저장 (ex. GET /adder.html)
+  char *hdr;         // 요청에 대응하는 미리 만들어둔 response header
+  int hdrSize;       // hdr 크기
+  hdr_meta meta;     // hdr 안의 위치, validator
+  cache_body *body;  // 공유하는 response body (body가 없으면 NULL)
+  char req[MAXLINE]; // 요청 저장 (ex. GET /adder.html)
   int priority;              // LRU 우선순위
   int isOccupied;            // 점유되어있으면 1, 안되어있으면 0
 
@@ -62,29 +363,170 @@ typedef struct
 typedef struct
 {
   cache_block blocks[CACHE_OBJS_COUNT]; // 블럭 리스트 관리
+  cache_body bodies[CACHE_OBJS_COUNT];  // 중복 제거된 body 목록 (블럭마다 최대 하나씩 참조하므로 같은 개수면 충분)
+  long bytes;                           // 실제로 쓰고있는 크기 (header + 중복 제거된 body)
+  sem_t bodyMutex;                      // bodies, bytes 보호 (블럭의 wMutex를 잡은 뒤에만 잡음)
 } Cache;
 
+// 연결이 잡고 있는 메모리 집계. 종류별로 모든 연결의 현재 합계와 최고치를 모아둠 (호스트 크기를 정할 때 참고)
+enum
+{
+  MEM_BUFFERS, // 요청 arena chunk
+  MEM_PINS,    // 클라이언트에 쓰는 동안 잡고 있는 캐시 블럭, segment
+  MEM_PENDING, // 클라이언트에 쓰는 중인 body
+  MEM_KINDS
+};
+
+typedef struct
+{
+  long conns, connsPeak;             // 처리 중인 연결 수
+  long cur[MEM_KINDS], peak[MEM_KINDS]; // 종류별 합계
+  long total, totalPeak;             // 모든 종류 합계
+  long connPeak;                     // 연결 하나가 가장 많이 잡았던 크기
+} MemStats;
+
+void memstat_add(int kind, long delta); // 이 쓰레드(연결)가 잡은 메모리 변화 반영
+void memstat_buffers(long delta);        // arena chunk 변화 (arena hook)
+void memstat_conn(int delta);            // 연결 시작(+1) / 끝(-1)
+void memstat_write(int fd);              // 집계를 text/plain 응답으로 보냄
+void conn_write(int fd, void *buf, size_t n); // 클라이언트에 쓰기 (쓰는 동안 pending으로 집계, access log에 status와 byte 수 기록)
+
 // 전역 캐시 생성
 static Cache cache;
+static SegCache segCache;
+static NegCache negCache;
+static PrefetchQueue prefetchQueue;
+static int prefetchEnabled = 0; // -p 옵션으로 켬
+static int hedgeEnabled = 0;    // -H 옵션으로 켬
+static MemStats memStats;
+static AdmitState admit;
+static long maxInflight = ADMIT_MAX_INFLIGHT;
+static __thread long connMem;    // 이 쓰레드가 처리 중인 연결이 잡은 메모리
+static pthread_attr_t threadAttr; // stack 크기를 정해둔 쓰레드 속성
+static size_t threadStack = THREAD_STACK_KB * 1024;
+static char *logPath = NULL;      // access log 파일 (-l, 없으면 stdout)
+static int connectTimeout = CONNECT_TIMEOUT_MS;
+static __thread alog_record *curLog; // 이 쓰레드가 처리 중인 요청의 access log 기록
+static __thread tw_timer *curTimer;  // 이 쓰레드가 처리 중인 요청의 단계 제한 시간
+static __thread unsigned curClient;  // 이 쓰레드가 처리 중인 클라이언트 IP hash (origin 대기열 flow)
+static __thread int curOrigin = ORIGIN_UNLIMITED; // 지금 열려있는 endserver 연결의 origin 자리 (쓰레드마다 한번에 하나만 엶)
+static __thread unsigned curOriginHash; // 이 쓰레드가 처리 중인 요청의 origin hash (rate limit bucket)
+static __thread int curBackend = -1;    // reverse proxy 모드에서 이 요청을 보내는 backend (없으면 -1)
+static __thread int curBackendResult;   // 그 backend에 보낸 결과 (circuit breaker에 반영)
+static __thread route_policy *curRoute;  // 이 요청에 맞는 route (없으면 NULL)
+static int originMax = ORIGIN_MAX_INFLIGHT;
+static int tunnelPorts[TUNNEL_PORTS_MAX] = {443}; // CONNECT로 열 수 있는 port (-T로 추가, 나머지는 403)
+static int tunnelPortCount = 1;
+static int listenPort;                          // proxy가 받는 port (관리 요청인지 Host로 구분)
 
 // proxy server main function
 int main(int argc, char **argv)
 {
-  int listenfd, *connfdp = NULL;         // listening socket, Connecting socket discriptor
-  char hostname[MAXLINE], port[MAXLINE]; // Hostname & Port of Client Request
-  socklen_t clientlen;                   // size of slientaddr stucture
-  struct sockaddr_storage clientaddr;    // structure of client address storage
-  pthread_t tid;                         // thread id
+  int listenfd;       // listening socket discriptor
 
   /* Check command line args */
-  if (argc != 2) // assert(argc !=2)
+  int opt;
+  rl_init(); // 제한 없음 (-r로 정함)
+  while ((opt = getopt(argc, argv, "pHs:l:c:m:o:r:b:B:R:T:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'p': // HTML에 포함된 객체 미리 받아오기
+      prefetchEnabled = 1;
+      break;
+    case 'H': // 응답이 늦은 요청을 한번 더 보내기
+      hedgeEnabled = 1;
+      break;
+    case 's': // 쓰레드 stack 크기 (KB)
+      threadStack = (size_t)atol(optarg) * 1024;
+      break;
+    case 'l': // access log 파일
+      logPath = optarg;
+      break;
+    case 'c': // endserver 연결 제한 시간 (ms)
+      connectTimeout = atoi(optarg);
+      break;
+    case 'm': // 동시에 처리하는 최대 연결 수
+      maxInflight = atol(optarg);
+      break;
+    case 'o': // origin 하나에 동시에 여는 최대 연결 수 (0이면 origin 자리를 하나도 얻지 못하므로 1 이상만)
+    {
+      char *end;
+      long value = strtol(optarg, &end, 10);
+      if (end == optarg || *end || value < 1 || value != (int)value)
+      {
+        fprintf(stderr, "invalid origin connections: %s\n", optarg);
+        exit(1);
+      }
+      originMax = value;
+      break;
+    }
+    case 'r': // rate limit ("client_bps=100000,origin_rps=50" 처럼, 나중에 LIMITS_PATH로 바꿀 수 있음)
+      if (rl_parse(optarg) < 0)
+      {
+        fprintf(stderr, "invalid limits: %s\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'b': // reverse proxy backend (여러번 줄 수 있음)
+      if (backend_add(optarg) < 0)
+      {
+        fprintf(stderr, "invalid backend: %s\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'B': // backend 고르는 방법
+      if (backend_setPolicy(optarg) < 0)
+      {
+        fprintf(stderr, "invalid balancing policy: %s\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'R': // routing 규칙 파일 (읽어서 바로 trie로 만듦)
+      if (route_load(optarg) < 0)
+        exit(1);
+      break;
+    case 'T': // 443 말고도 CONNECT로 열 수 있는 port (여러번 줄 수 있음)
+      if (tunnel_addPorts(optarg) < 0)
+      {
+        fprintf(stderr, "invalid tunnel ports: %s\n", optarg);
+        exit(1);
+      }
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-p] [-H] [-s stackKB] [-l logfile] [-c connectMs] [-m maxConns] [-o originConns] [-r limits] [-b host:port[@weight]]... [-B least|p2c|hash] [-R routes] [-T port[,port]...] <port>\n", argv[0]);
+      exit(1);
+    }
+  }
+  if (optind != argc - 1) // port 하나만 남아있어야 함
   {
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    fprintf(stderr, "usage: %s [-p] [-H] [-s stackKB] [-l logfile] [-c connectMs] [-m maxConns] [-o originConns] [-r limits] [-b host:port[@weight]]... [-B least|p2c|hash] [-R routes] [-T port[,port]...] <port>\n", argv[0]);
+    exit(1);
+  }
+
+  // 모든 쓰레드를 정해둔 stack 크기로 만듦 (기본 속성이면 쓰레드마다 보통 8MB를 예약함)
+  pthread_attr_init(&threadAttr);
+  if (threadStack < PTHREAD_STACK_MIN || pthread_attr_setstacksize(&threadAttr, threadStack))
+  {
+    fprintf(stderr, "invalid stack size: %zu (min %ld)\n", threadStack, (long)PTHREAD_STACK_MIN);
     exit(1);
   }
 
   // 캐시 초기화해줌
+  arena_pool_init();
+  Sem_init(&admit.mutex, 0, 1);
+  arena_set_hook(memstat_buffers);
   cache_init();
+  segcache_init();
+  negcache_init();
+  if (prefetchEnabled)
+    prefetch_init();
+  resolver_init(&threadAttr);      // endserver 주소 조회 캐시
+  tw_init(&threadAttr);            // 연결별 단계 제한 시간
+  origin_init(originMax);          // origin별 동시 연결 수 제한
+  hedge_init();                    // 응답 지연 집계와 재시도 예산
+  backend_init(&threadAttr);       // reverse proxy backend hash ring과 health check 쓰레드
+  alog_init(logPath, &threadAttr); // 요청 쓰레드는 기록만 넘기고 파일에는 writer 쓰레드가 씀
 
   // 첫번째인자 유형으로 들어오는 시그널에 대해서 두번째인자 처리를 함.
   // 멀티쓰레드 동시성 관련 예외처리
@@ -94,50 +536,255 @@ int main(int argc, char **argv)
   // 따라서 해당 signal이 발생하더라도 꺼지지 않도록 무시해줄 필요가 있음 (SIGNAL IGNORE)
   Signal(SIGPIPE, SIG_IGN);
 
-  listenfd = Open_listenfd(argv[1]); // Creating Listening Socket Discriptor
+  listenfd = Open_listenfd(argv[optind]); // Creating Listening Socket Discriptor
+  listenPort = atoi(argv[optind]);
+  // listen 소켓은 non-blocking으로 두고, 연결이 들어오면 poll에서 깨어나 쌓인 연결을 EAGAIN이 날 때까지 한번에 받음
+  if (fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL, 0) | O_NONBLOCK) < 0)
+    unix_error("fcntl error");
+  // 503을 보낸 연결들도 같은 poll에서 기다림 (쓰레드를 만들지 않음)
+  admit.pfds[0].fd = listenfd;
+  admit.pfds[0].events = POLLIN;
   while (1)
   {
-    clientlen = sizeof(clientaddr);
-    connfdp = (int *)Malloc(sizeof(int));
-    *connfdp = Accept(listenfd, (SA *)&clientaddr,
-                      &clientlen); // line:netp:tiny:accept
-    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,
-                0);
-    printf("Accepted connection from (%s, %s)\n", hostname, port);
-    Pthread_create(&tid, NULL, thread, (void *)connfdp);
+    if (poll(admit.pfds, 1 + admit.nlinger, admit.nlinger ? 100 : -1) < 0)
+      continue;
+    if (admit.pfds[0].revents)
+      accept_batch(listenfd);
+    if (admit.nlinger)
+      admit_linger(tw_now());
+  }
+}
+
+/* 쌓여있는 연결을 ACCEPT_BATCH개까지 accept4로 받아서 쓰레드로 넘김. 주소는 받은 그대로 넘기고 이름으로 바꾸지 않음 */
+void accept_batch(int listenfd)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  conn_info *conn;
+  pthread_t tid;
+  struct timespec now;
+  int i, fd, reason;
+
+  for (i = 0; i < ACCEPT_BATCH; i++)
+  {
+    addrlen = sizeof(addr);
+    if ((fd = accept4(listenfd, (SA *)&addr, &addrlen, SOCK_CLOEXEC)) < 0)
+    {
+      if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) // fd나 메모리가 모자라면 잠깐 쉬었다가 다시 받음
+      {
+        fprintf(stderr, "accept error: %s\n", strerror(errno));
+        usleep(10000);
+      }
+      return; // EAGAIN (다 받음), ECONNABORTED 등은 다음 poll에서 이어서 받음
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((reason = admit_check(now.tv_sec * 1000000L + now.tv_nsec / 1000)) != ADMIT_OK)
+    {
+      admit_shed(fd, reason, now.tv_sec * 1000L + now.tv_nsec / 1000000);
+      continue;
+    }
+    __atomic_fetch_add(&admit.inflight, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&admit.admitted, 1, __ATOMIC_RELAXED);
+    conn = Malloc(sizeof(conn_info));
+    conn->fd = fd;
+    memcpy(&conn->addr, &addr, addrlen);
+    conn->addrlen = addrlen;
+    conn->accepted = now;
+    Pthread_create(&tid, &threadAttr, thread, conn);
+  }
+}
+
+/* 새 연결을 받아들일지 정함. 처리 중인 연결 수, 메모리 한도를 먼저 보고,
+ * CoDel로 지연이 interval 내내 target을 넘었으면 interval/sqrt(count) 간격으로 점점 자주 거절함 */
+int admit_check(long nowUs)
+{
+  int reason = ADMIT_OK;
+
+  if (__atomic_load_n(&admit.inflight, __ATOMIC_RELAXED) >= maxInflight)
+    return ADMIT_SHED_INFLIGHT;
+  if (__atomic_load_n(&memStats.total, __ATOMIC_RELAXED) >= ADMIT_MAX_MEMORY)
+    return ADMIT_SHED_MEMORY;
+
+  P(&admit.mutex);
+  if (admit.dropping && nowUs >= admit.dropNext)
+  {
+    admit.count++;
+    admit.dropNext += CODEL_INTERVAL_US / sqrt(admit.count);
+    reason = ADMIT_SHED_DELAY;
+  }
+  V(&admit.mutex);
+  return reason;
+}
+
+/* 쓰레드가 처리를 시작할 때의 지연 (CoDel의 dequeue 시점). target 아래로 내려오면 바로 거절을 멈춤 */
+void admit_sample(long sojournUs, long nowUs)
+{
+  P(&admit.mutex);
+  if (sojournUs < CODEL_TARGET_US)
+  {
+    admit.firstAbove = 0;
+    admit.dropping = 0;
+  }
+  else if (!admit.firstAbove)
+    admit.firstAbove = nowUs + CODEL_INTERVAL_US;
+  else if (!admit.dropping && nowUs >= admit.firstAbove)
+  {
+    // 최근에 거절하다 멈췄으면 그때 빈도에 가깝게 다시 시작함
+    admit.count = admit.count > 2 && nowUs - admit.dropNext < 16 * CODEL_INTERVAL_US ? admit.count - 2 : 1;
+    admit.dropping = 1;
+    admit.dropNext = nowUs + CODEL_INTERVAL_US / sqrt(admit.count);
+  }
+  V(&admit.mutex);
+}
+
+/* 쓰레드도 버퍼도 만들지 않고 미리 만들어둔 503만 씀 (새 소켓 버퍼는 비어있으므로 막히지 않음).
+ * 보내는 쪽만 닫고, 클라이언트가 요청을 다 보내고 닫을 때까지 accept 쓰레드의 poll에서 잠깐 기다려줌 */
+void admit_shed(int fd, int reason, long nowMs)
+{
+  __atomic_fetch_add(&admit.shed[reason], 1, __ATOMIC_RELAXED);
+  send(fd, overload_resp, sizeof(overload_resp) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+  shutdown(fd, SHUT_WR);
+  if (admit.nlinger == SHED_LINGER_MAX) // 기다려줄 자리가 없으면 바로 닫음
+  {
+    close(fd);
+    return;
+  }
+  admit.nlinger++;
+  admit.pfds[admit.nlinger].fd = fd;
+  admit.pfds[admit.nlinger].events = POLLIN;
+  admit.pfds[admit.nlinger].revents = 0;
+  admit.lingerUntil[admit.nlinger] = nowMs + SHED_LINGER_MS;
+}
+
+/* 클라이언트가 보낸 나머지를 버리고, 닫았거나 (EOF) 오래 기다렸으면 닫음 */
+void admit_linger(long nowMs)
+{
+  char buf[MAXLINE];
+  int i;
+
+  for (i = 1; i <= admit.nlinger; i++)
+  {
+    if (admit.pfds[i].revents && recv(admit.pfds[i].fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+      continue;
+    if (!admit.pfds[i].revents && nowMs < admit.lingerUntil[i])
+      continue;
+    close(admit.pfds[i].fd);
+    admit.pfds[i] = admit.pfds[admit.nlinger];
+    admit.lingerUntil[i] = admit.lingerUntil[admit.nlinger];
+    admit.nlinger--;
+    i--;
   }
 }
 
 /* thread routine */
 void *thread(void *vargp)
 {
-  int connfd = *((int *)vargp);   // 전달받은 connfdp로부터 connfd 저장
+  conn_info conn = *((conn_info *)vargp); // 전달받은 연결 정보 저장
+  int connfd = conn.fd;
+  alog_record rec;                // 이 연결의 access log 기록 (주소는 writer 쓰레드에서 숫자로 바꿈)
   Pthread_detach(pthread_self()); // 메인 쓰레드가 peer 쓰레드를 기다리지 않도록 분리상태로 만듦
-  Free(vargp);                    // connfd 전달을 위해 사용했던 힙메모리 반납
-  doit(connfd);                   // 실제 요청에 대해 처리하는 함수 실행
+  Free(vargp);                    // 연결 정보 전달을 위해 사용했던 힙메모리 반납
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  admit_sample((start.tv_sec - conn.accepted.tv_sec) * 1000000L + (start.tv_nsec - conn.accepted.tv_nsec) / 1000,
+               start.tv_sec * 1000000L + start.tv_nsec / 1000);
+  tw_timer timer;                 // 이 연결의 단계 제한 시간 (wheel에 걸려있는 동안 stack에 있음)
+  alog_begin(&rec, (SA *)&conn.addr, conn.addrlen, &conn.accepted);
+  curLog = &rec;
+  tw_start(&timer, connfd, REQUEST_TIMEOUT_MS);
+  tw_phase(&timer, TW_PHASE_HEADER, HEADER_TIMEOUT_MS);
+  curTimer = &timer;
+  curClient = origin_client((SA *)&conn.addr);
+  curOriginHash = 0;
+  arena_t arena;                  // 요청 하나 동안 쓰는 버퍼들 (끝나면 한번에 돌려줌)
+  arena_init(&arena);
+  memstat_conn(1);
+  doit(connfd, &arena);           // 실제 요청에 대해 처리하는 함수 실행
+  alog_mark(&rec, ALOG_PHASE_DONE);
+  alog_submit(&rec);              // ring에 넘기기만 함 (꽉 찼으면 버려짐)
+  curLog = NULL;
+  tw_stop(&timer);                // connfd를 닫기 전에 wheel에서 뺌 (닫은 fd 번호를 다른 연결이 받을 수 있음)
+  curTimer = NULL;
+  arena_release(&arena);
+  memstat_conn(-1);
   Close(connfd);                  // connfd 닫아주기
+  __atomic_fetch_sub(&admit.inflight, 1, __ATOMIC_RELAXED);
+  arena_thread_exit();            // 돌려받은 chunk는 다음 쓰레드가 쓰도록 공용 pool로
   return NULL;
 }
 
 /* --------------- 연결된 client에 대해서 유효성 확인 및 요청에 대한 응답 처리 --------------- */
-void doit(int fd)
+void doit(int fd, arena_t *arena)
 {
-  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE]; // 요청내용 저장 buf, buf로부터 요청 method, uri, version 파싱하여 저장
-  rio_t rio;                                                          // Client와 소통에서의 버퍼가 들어있는 rio 구조체
+  char *method, *uri, *version;                  // rio 버퍼 안의 요청 method, uri, version (복사하지 않음)
+  rio_t *rio = arena_alloc(arena, sizeof(rio_t)); // Client와 소통에서의 버퍼가 들어있는 rio 구조체
+  http_request *req = arena_alloc(arena, sizeof(http_request)); // 파싱 결과 (rio 버퍼 안의 위치만 기록)
+  int rc;
 
   /* Read request line and headers */
-  Rio_readinitb(&rio, fd);           // socket를 통해 읽어오기 위한 초기화
-  Rio_readlineb(&rio, buf, MAXLINE); // 초기화된 rio를 통해서 요청내용을 buf에 저장
-  printf("Request headers:\n");
-  printf("%s", buf);
-  sscanf(buf, "%s %s %s", method, uri, version);                                              // buf로부터 method, uri, version 파싱
-  if (strcasecmp(method, "GET") && strcasecmp(method, "HEAD"))                                // GET or HEAD만 요청시 응답
-  {                                                                                           // method가 GET이 아니면 0이 아닌 수 반환됨
+  // header 끝(빈 줄)까지 rio 버퍼에 쌓으면서 파싱함. 새로 들어온 줄만 이어서 보므로 줄마다 복사하거나 처음부터 다시 보지 않음
+  Rio_readinitb(rio, fd);
+  http_request_init(req);
+  while ((rc = http_parse_request(req, rio->rio_bufptr, rio->rio_cnt)) == HTTP_PARSE_AGAIN)
+  {
+    if (rio_fillb(rio) > 0)
+      continue;
+    if (rio->rio_cnt == sizeof(rio->rio_buf)) // header가 버퍼보다 큼
+      rc = HTTP_PARSE_TOOLARGE;
+    else if (curTimer->expired) // header를 너무 느리게 보냄 (timer가 읽는 쪽만 끊어둠)
+      clienterror(fd, "", "408", "Request Timeout", "Proxy timed out waiting for the request headers");
+    if (rc != HTTP_PARSE_TOOLARGE)
+      return; // 요청을 다 보내기 전에 끊김
+    break;
+  }
+  if (rc == HTTP_PARSE_TOOLARGE)
+  {
+    clienterror(fd, "", "431", "Request Header Fields Too Large", "Proxy could not read the request headers");
+    return;
+  }
+  if (rc < 0)
+  {
+    clienterror(fd, "", "400", "Bad Request", "Proxy could not parse the request");
+    return;
+  }
+  http_request_terminate(req, rio->rio_bufptr); // 구간들을 바로 문자열로 씀
+  rio_consumeb(rio, rc);                        // 뒤에 남은 데이터(body)는 rio로 이어서 읽을 수 있음
+  method = http_str(req, req->method);
+  uri = http_str(req, req->target);
+  version = http_str(req, req->version);
+  alog_request(curLog, method, uri);
+  alog_mark(curLog, ALOG_PHASE_READ);
+  tw_phase(curTimer, TW_PHASE_IDLE, IDLE_TIMEOUT_MS); // 캐시에서 응답하는 동안은 클라이언트가 받아가는지만 봄
+  // 관리 경로는 proxy 자신에게 loopback에서 온 요청만 받음. 나머지는 (reverse proxy로 backend에 가는 같은 path 포함) 일반 요청으로 처리
+  if (!strcmp(uri, STATS_PATH) && admin_request(fd, req)) // proxy 자신에게 온 집계 요청
+  {
+    memstat_write(fd);
+    return;
+  }
+  if (!strncmp(uri, LIMITS_PATH, strlen(LIMITS_PATH)) && (!uri[strlen(LIMITS_PATH)] || uri[strlen(LIMITS_PATH)] == '?') &&
+      admin_request(fd, req))
+  {
+    limits_serve(fd, uri);
+    return;
+  }
+  if (!strcasecmp(method, "CONNECT")) // HTTPS 등은 endserver까지 터널을 열어서 byte를 그대로 옮김
+  {
+    serve_tunnel(fd, rio, uri);
+    return;
+  }
+  if (strcasecmp(method, "GET") && strcasecmp(method, "HEAD") && strcasecmp(method, "POST") && // GET, HEAD와 body를 올려보내는 요청만 응답
+      strcasecmp(method, "PUT") && strcasecmp(method, "PATCH") && strcasecmp(method, "DELETE"))
+  {
     clienterror(fd, method, "501", "Not implemented", "Tiny does not implement this method"); // 클라이언트로 에러 Response 응답하는 함수 호출
     return;
   }
 
-  serve(fd, method, uri, version, &rio); // 엔드 서버로 요청을 보내 데이터를 처리하고, 응답받은 내용을 클라이언트에게 다시 전달
+  serve(fd, rio, arena, method, uri, version, req); // 엔드 서버로 요청을 보내 데이터를 처리하고, 응답받은 내용을 클라이언트에게 다시 전달
+  if (curBackend >= 0) // backend로 보낸 요청 끝 (어디서 return했든 여기서 한번만 셈)
+  {
+    backend_done(curBackend, curBackendResult);
+    curBackend = -1;
+  }
 }
 
 /* --------------- 확실한 error에 대해서 처리하여 client에게 응답함 --------------- */
@@ -156,194 +803,1307 @@ void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longms
 
   /* Print the HTTP response */
   sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf));
+  conn_write(fd, buf, strlen(buf));
   sprintf(buf, "Content-type: text/html\r\n");
-  Rio_writen(fd, buf, strlen(buf));
+  conn_write(fd, buf, strlen(buf));
   sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-  Rio_writen(fd, buf, strlen(buf));
-  Rio_writen(fd, body, strlen(body)); // 위에서 작성한 response body 아래에 붙임
+  conn_write(fd, buf, strlen(buf));
+  conn_write(fd, body, strlen(body)); // 위에서 작성한 response body 아래에 붙임
 }
 
-/* 서버로 요청 및 응답받은 내용 반환 */
-void serve(int fd, char *method, char *uri, char *version, rio_t *rio)
+/* 제한 값 보기. query가 있으면 적용한 뒤 보여줌 (같은 host에서 온 요청만 바꿀 수 있음) */
+void limits_serve(int fd, char *uri)
 {
-  int endserverfd;  // endserver 소켓
-  char *ptr;        // 필요시 response body 부분 처리하기 위한 ptr
-  char buf[MAXBUF]; // 서버로부터 읽고, 클라이언트한테 쓰기 위한 버퍼
-  rio_t serv_rio;   // 리오 버퍼
-
-  // uri 파싱
-  char hostname[MAXLINE], path[MAXLINE];
-  int port;
-  parse_uri(uri, hostname, &port, path);
+  char body[MAXLINE], hdr[MAXLINE];
+  char *query = strchr(uri, '?');
+  int len;
 
-  /* 캐시 되어있으면 바로 보내줌 */
-  char cachedIdx;        // 캐시되어있는지 찾고 반환값 저장
-  char request[MAXLINE]; // method, path 묶어서 확인 또는 저장
-  sprintf(request, "%s %s", method, path);
-  if ((cachedIdx = cache_isCached(request)) != -1) // 캐시되어있다면
+  if (query && *++query)
   {
-    startRead(cachedIdx);                                                             // 읽기 시작하고
-    Rio_writen(fd, cache.blocks[cachedIdx].obj, strlen(cache.blocks[cachedIdx].obj)); // 저장되어있는걸로 obj 그대로 클라이언트에 써주고
-    endRead(cachedIdx);                                                               // 읽기 닫고
-    return;                                                                           // 반환함
+    if (rl_parse(query) < 0) // 맞는 항목은 적용됨
+    {
+      clienterror(fd, LIMITS_PATH, "400", "Bad Request", "Proxy could not parse the limits");
+      return;
+    }
   }
+  len = rl_format(body, MAXLINE);
+  snprintf(hdr, MAXLINE, "HTTP/1.0 200 OK\r\nContent-type: text/plain\r\nContent-length: %d\r\n\r\n", len);
+  conn_write(fd, hdr, strlen(hdr));
+  conn_write(fd, body, len);
+}
 
-  /* 캐시 안되어있으면 서버로 요청보내고 받은 다음에 받은 response를 캐싱해줌 */
+/* 요청 수 제한을 넘음. 다시 보내도 되는 시간을 초로 올림해서 알려줌 */
+void limits_reject(int fd, long retryMs)
+{
+  char buf[MAXLINE];
+  static const char *body = "<html><title>Tiny Error</title><body bgcolor='ffffff'>\r\n429: Too Many Requests\r\n"
+                            "<hr><em>The Tiny Web server</em>\r\n";
+
+  snprintf(buf, MAXLINE, "HTTP/1.0 429 Too Many Requests\r\nRetry-After: %ld\r\nContent-type: text/html\r\n"
+                         "Content-length: %d\r\n\r\n%s",
+           (retryMs + 999) / 1000, (int)strlen(body), body);
+  conn_write(fd, buf, strlen(buf));
+}
+
+/* origin-form 관리 경로가 proxy 자신에게 온 요청인지. loopback에서 왔고, Host가 없거나 loopback 주소의 이 proxy port여야 함
+ * (reverse proxy로 받는 요청은 Host가 backend 쪽 이름이므로 backend의 같은 path를 가리지 않음) */
+int admin_request(int fd, http_request *req)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen = sizeof(addr);
+  char *host = http_request_value(req, HTTP_HDR_HOST), *colon, *end;
+  char name[MAXLINE];
+  struct in_addr in4;
+  long port = 80;
+  size_t nameLen;
 
-  // request headers 작성
-  char request_hdrs[MAXLINE];
-  build_requesthdrs(request_hdrs, method, hostname, path, rio);
+  if (getpeername(fd, (SA *)&addr, &addrlen) < 0 ||
+      !((addr.ss_family == AF_INET && ntohl(((struct sockaddr_in *)&addr)->sin_addr.s_addr) >> 24 == 127) ||
+        (addr.ss_family == AF_INET6 && IN6_IS_ADDR_LOOPBACK(&((struct sockaddr_in6 *)&addr)->sin6_addr))))
+    return 0;
+  if (!host || !host[0]) // HTTP/1.0처럼 Host가 없으면 proxy에게 직접 온 요청
+    return 1;
 
-  // end server 연결하고 request 보내기
-  if ((endserverfd = Open_endServer(hostname, port)) < 0) // 서버로 연결
+  // "name[:port]" (IPv6는 "[addr][:port]")
+  colon = strrchr(host, ':');
+  if (colon && (host[0] != '[' || colon > strchr(host, ']')))
   {
-    printf("connection failed\n");
-    return;
+    port = strtol(colon + 1, &end, 10);
+    if (end == colon + 1 || *end)
+      return 0;
+    nameLen = colon - host;
   }
+  else
+    nameLen = strlen(host);
+  if (port != listenPort || nameLen >= sizeof(name))
+    return 0;
+  memcpy(name, host, nameLen);
+  name[nameLen] = '\0';
+  return !strcasecmp(name, "localhost") || !strcmp(name, "[::1]") ||
+         (inet_pton(AF_INET, name, &in4) == 1 && ntohl(in4.s_addr) >> 24 == 127);
+}
 
-  Rio_writen(endserverfd, request_hdrs, strlen(request_hdrs));
+/* CONNECT host:port. endserver에 연결되면 200을 보내고, 그 뒤로는 두 연결 사이를 어느 쪽이든 끝날 때까지 그대로 옮김
+ * 이 쓰레드 하나가 poll로 두 방향을 같이 옮기고 (tunnel.c), 멈춰있으면 timer wheel이 두 소켓을 끊어서 끝냄 */
+void serve_tunnel(int fd, rio_t *rio, char *authority)
+{
+  char *hostname = authority, *colon, *end;
+  long port, retryMs;
+  long bytes[TUNNEL_DIRS] = {0, 0};
+  int serverfd;
 
-  char cacheBuf[MAX_OBJECT_SIZE]; // 캐싱하기 위해 response 담을 버퍼 생성
-  int bufSize = 0;                // 캐싱할지 버릴지 판단하기 위해 사이즈 계산
+  // authority-form만 받음 ("host:port", IPv6는 "[addr]:port"). port는 빼먹을 수 없음
+  if (!(colon = strrchr(authority, ':')) || colon == authority)
+  {
+    clienterror(fd, authority, "400", "Bad Request", "CONNECT needs a host:port target");
+    return;
+  }
+  *colon = '\0';
+  port = strtol(colon + 1, &end, 10);
+  if (*end || port <= 0 || port > 65535)
+  {
+    clienterror(fd, authority, "400", "Bad Request", "CONNECT needs a host:port target");
+    return;
+  }
+  if (hostname[0] == '[' && colon[-1] == ']')
+  {
+    hostname++;
+    colon[-1] = '\0';
+  }
 
-  int size;   // response body size
-  char *srcp; // response body 저장할 pointer
-  /* 응답받은 내용 클라이언트로 forwarding */
-  Rio_readinitb(&serv_rio, endserverfd);
-  bufSize += Rio_readlineb(&serv_rio, buf, MAXLINE); // response 한줄 buf에 저장하고, bufSize 에 길이 추가
-  if (bufSize < MAX_OBJECT_SIZE)                     // 최대 사이즈보다 작을때만 붙여넣음
-    strcat(cacheBuf, buf);
-  while (strcmp(buf, "\r\n")) // response header forwarding
+  // 아무 port로나 열어주면 열린 TCP relay가 되므로 443과 -T로 정한 port만 받음
+  int allowed = 0;
+  for (int i = 0; i < tunnelPortCount && !allowed; i++)
+    allowed = tunnelPorts[i] == port;
+  if (!allowed)
   {
-    Rio_writen(fd, buf, strlen(buf));
-    bufSize += Rio_readlineb(&serv_rio, buf, MAXLINE); // 한줄 읽을때마다 bufSize에 + 해주고
-    if (bufSize < MAX_OBJECT_SIZE)                     // 최대 사이즈보다 작을때에만 붙여넣어줌
-      strcat(cacheBuf, buf);
-    if (strstr(buf, "Content-length")) // GET요청일 경우에만 response body 붙여주기 위해 판단
-    {
-      ptr = index(buf, ':');
-      size = atoi(ptr + 1);
-    }
+    clienterror(fd, hostname, "403", "Forbidden", "Proxy does not tunnel to this port");
+    return;
+  }
+  // 일반 요청과 같은 routing 규칙을 따름. 정해둔 upstream이 있으면 그쪽으로 열고, backend pool로 보내는 host는 터널로 건너뛸 수 없음
+  curRoute = route_lookup(hostname, "/");
+  if (curRoute && curRoute->upstream == ROUTE_UPSTREAM_POOL)
+  {
+    clienterror(fd, hostname, "403", "Forbidden", "Proxy does not tunnel to this host");
+    return;
+  }
+  if (curRoute && curRoute->upstream == ROUTE_UPSTREAM_HOST)
+  {
+    hostname = curRoute->host;
+    port = curRoute->port;
   }
 
-  // GET일 경우에만 Response Body 부분 처리 (없으면 HEAD요청시에도 실행되어 불필요한 부분 참조하게됨)
-  if (!strcmp(method, "GET"))
+  curOriginHash = rl_hash(hostname, port);
+  if ((retryMs = rl_request(curClient, curOriginHash)))
+  {
+    limits_reject(fd, retryMs);
+    return;
+  }
+  if ((serverfd = Open_endServer(hostname, port)) < 0) // 터널도 origin 자리 하나를 열려있는 동안 씀
   {
-    Rio_writen(fd, buf, strlen(buf));             // \r\n 먼저 추가해줌
-    srcp = (char *)malloc(size);                  // 해당 size만큼 buf에 저장하기 위해 동적 할당받음
-    bufSize += Rio_readnb(&serv_rio, srcp, size); // 한번에 읽어주고, bufSize도 업데이트 해줌
-    Rio_writen(fd, srcp, size);                   // 클라이언트로 보내줌
-    if (bufSize < MAX_OBJECT_SIZE)                // 최대 사이즈보다 작을때에만 추가로 붙여줌
-      strcat(cacheBuf, srcp);
-    free(srcp);
+    if (serverfd == ENDSERVER_BUSY)
+      clienterror(fd, hostname, "503", "Service Unavailable", "Too many requests are waiting for the server");
+    else
+      clienterror(fd, hostname, "502", "Bad Gateway", "Proxy couldn't connect to the server");
+    return;
   }
-  Close(endserverfd);
+  alog_mark(curLog, ALOG_PHASE_CONNECT);
+  conn_write(fd, (char *)tunnel_hdr, strlen(tunnel_hdr));
+
+  // 200을 기다리지 않고 header 뒤에 바로 보낸 데이터 (TLS ClientHello 등)는 rio 버퍼에 있으므로 먼저 넘김
+  if (rio->rio_cnt > 0 && rio_writen(serverfd, rio->rio_bufptr, rio->rio_cnt) == rio->rio_cnt)
+    bytes[TUNNEL_UP] += rio->rio_cnt;
+  rio_consumeb(rio, rio->rio_cnt);
 
-  if (bufSize < MAX_OBJECT_SIZE) // 최대 사이즈보다 적을때에만 캐싱함
-    cache_cacheRequest(request, cacheBuf);
+  tw_total(curTimer, TUNNEL_TIMEOUT_MS);
+  tw_phase(curTimer, TW_PHASE_IDLE, TUNNEL_IDLE_TIMEOUT_MS);
+  tunnel_relay(fd, serverfd, curTimer, curClient, curOriginHash, bytes);
+  curLog->bytes += bytes[TUNNEL_DOWN];
+  curLog->received += bytes[TUNNEL_UP];
+  Close_endServer(serverfd);
 }
 
-// URI Parsing - request header로 들어온 uri에서 hostname, port, path 추출
-void parse_uri(char *uri, char *hostname, int *port, char *path)
+/* CONNECT로 열 수 있는 port를 콤마로 구분해서 추가 */
+int tunnel_addPorts(char *list)
 {
-  *port = 80; // HTTP 기본포트 80으로 default 세팅
-
-  char *ptr;
-  ptr = strstr(uri, "//");   // http:// 이후부분으로 파싱
-  ptr = ptr ? ptr + 2 : uri; // http:// 없어도 문제 없음
+  char *end;
+  long port;
 
-  char *ptr2 = strchr(ptr, ':'); // 포트번호
-  if (ptr2)                      // 있으면
-  {
-    *ptr2 = '\0';                         // eof넣고
-    sscanf(ptr, "%s", hostname);          // \0전까지 읽어서 hostname 파싱
-    sscanf(ptr2 + 1, "%d%s", port, path); // 나머지 port, path 파싱
-  }
-  else // 없으면
+  do
   {
-    ptr2 = strchr(ptr, '/'); // hostname 뒤 / 위치
-    if (ptr2)                // 있으면
-    {
-      *ptr2 = '\0';
-      sscanf(ptr, "%s", hostname);
-      *ptr2 = '/';
-      sscanf(ptr2, "%s", path); // 포트번호 없을때는 뒤에 바로 path
-    }
-    else                          // 없으면
-      scanf(ptr, "%s", hostname); // path없으면 바로 hostname으로 파싱
-  }
+    port = strtol(list, &end, 10);
+    if (end == list || (*end && *end != ',') || port <= 0 || port > 65535 || tunnelPortCount == TUNNEL_PORTS_MAX)
+      return -1;
+    tunnelPorts[tunnelPortCount++] = port;
+    list = end + 1;
+  } while (*end);
+  return 0;
 }
 
-/* endserver로의 request를 위해 header 작성 */
-void build_requesthdrs(char *http_header, char *method, char *hostname, char *path, rio_t *client_rio)
+/* 서버로 요청 및 응답받은 내용 반환 */
+void serve(int fd, rio_t *rio, arena_t *arena, char *method, char *uri, char *version, http_request *req)
 {
-  char buf[MAXLINE], request_hdr[MAXLINE], other_hdr[MAXLINE], host_hdr[MAXLINE];
+  int endserverfd;        // endserver 소켓
+  rio_t *serv_rio;        // 리오 버퍼
+  http_response *resp;    // 응답 header 파싱 결과
+  char *hdrBlock = NULL;  // 캐시에 넣을 미리 만든 header
+  hdr_meta meta;          // hdrBlock 정보
 
-  // Request Header 첫번째줄 세팅
-  sprintf(request_hdr, request_hdr_fmt, method, path);
+  // uri 파싱 - hostname, path는 uri보다 길 수 없으므로 uri 길이만큼만 잡음
+  char *hostname, *path;
+  int port;
+  hostname = arena_alloc(arena, strlen(uri) + 1);
+  path = arena_alloc(arena, strlen(uri) + 2);
+  hostname[0] = '\0';
+  strcpy(path, "/");
+  parse_uri(uri, hostname, &port, path);
 
-  // 클라이언트로부터 읽어오면서 데이터가 있는동안
-  while (Rio_readlineb(client_rio, buf, MAXLINE))
+  // body가 있으면 (POST, PUT 등) 크기를 알 수 있는지 먼저 확인함 (잘못되면 연결해보지 않음)
+  int isUnsafe = strcasecmp(method, "GET") && strcasecmp(method, "HEAD"); // 캐시를 쓰지 않고, 성공하면 캐시된 내용을 지움
+  long bodyLen = body_length(req);
+  char *expect = http_request_value(req, HTTP_HDR_EXPECT);
+  if (bodyLen == BODY_INVALID)
   {
-    // 끝에 도달했으면 멈춤
-    if (!strcmp(buf, endof_hdr))
-      break;
+    clienterror(fd, method, "400", "Bad Request", "Proxy could not determine the request body length");
+    return;
+  }
+  if (expect && strcasecmp(expect, "100-continue"))
+  {
+    clienterror(fd, expect, "417", "Expectation Failed", "Proxy only understands 100-continue");
+    return;
+  }
+  // 100-continue는 proxy가 직접 답함. endserver에 연결될 때까지 클라이언트가 body를 보내지 않고 기다리게 함 (HTTP/1.0 클라이언트에게는 보내지 않음)
+  int expectContinue = expect && bodyLen && strcasecmp(version, "HTTP/1.0");
 
-    // Host : 가 있는 경우 처리
-    if (!strncasecmp(buf, host_key, strlen(host_key)))
+  // routing 규칙으로 upstream과 정책을 고름. 규칙이 없으면 URI의 host로, host가 없는 요청("GET /path")은 backend pool로
+  char *routeHost = hostname[0] ? hostname : http_request_value(req, HTTP_HDR_HOST);
+  curRoute = route_lookup(routeHost ? routeHost : "", path);
+  int usePool = curRoute ? curRoute->upstream == ROUTE_UPSTREAM_POOL : !hostname[0] && backend_count();
+  int useCache = (!curRoute || curRoute->cache) && !isUnsafe; // 캐시를 쓰지 않는 route, method면 찾지도 저장하지도 않음
+  // 캐시 key에 넣을 요청 대상 ("host:port"). 다른 서버의 같은 path와 섞이지 않도록 upstream을 고르기 전의 대상(URI의 host, 없으면 Host header)으로 함
+  char *authority = arena_alloc(arena, strlen(routeHost ? routeHost : "") + 16);
+  if (!hostname[0] && routeHost && strchr(routeHost, ':'))
+    strcpy(authority, routeHost);
+  else
+    sprintf(authority, "%s:%d", routeHost ? routeHost : "", port);
+  if (curRoute && curRoute->upstream == ROUTE_UPSTREAM_HOST)
+  {
+    hostname = curRoute->host;
+    port = curRoute->port;
+  }
+  else if (usePool)
+  {
+    curBackendResult = BACKEND_UNKNOWN;
+    if ((curBackend = backend_pick(path, 0)) < 0) // 모두 빠져있으면 연결해보지 않고 바로 실패
     {
-      strcpy(host_hdr, buf);
-      continue;
+      clienterror(fd, path, "503", "Service Unavailable", "No healthy backend is available");
+      return;
     }
-
-    // 나머지 header 처리 - conn / prox conn / user agent 부분은 이미 저장되어있는 fmt 대로 쓸거라서 제외
-    if (strncasecmp(buf, conn_key, strlen(conn_key)) && strncasecmp(buf, prox_conn_key, strlen(prox_conn_key)) && strncasecmp(buf, user_agent_key, strlen(user_agent_key)))
-      strcat(other_hdr, buf);
+    hostname = backend_host(curBackend);
+    port = backend_port(curBackend);
   }
-  if (!strlen(host_hdr))
-    sprintf(host_hdr, host_hdr_fmt, hostname);
 
-  // 한번에 모아서 http_header에 저장
-  sprintf(http_header, "%s%s%s%s%s%s%s", request_hdr, host_hdr, conn_hdr, prox_conn_hdr, user_agent_hdr, other_hdr, endof_hdr);
-  return;
-}
+  // 요청 수 제한 (캐시에서 응답하는 요청도 셈)
+  long retryMs;
+  curOriginHash = rl_hash(hostname, port);
+  if ((retryMs = rl_request(curClient, curOriginHash)))
+  {
+    limits_reject(fd, retryMs);
+    return;
+  }
 
-/* 파싱한 port가 int형이기 때문에 문자열로 변환 및 endserver와 연결 */
-inline int Open_endServer(char *hostname, int port)
-{
-  char portStr[100];
-  sprintf(portStr, "%d", port);
-  return Open_clientfd(hostname, portStr);
-}
+  // request headers 작성 - Range header를 알아야 캐시에서 구간 응답을 할 수 있으므로 캐시 확인보다 먼저 읽음
+  char *request_hdrs, *range;
+  request_hdrs = build_requesthdrs(arena, method, hostname, path, req, &range);
+  int isGet = !strcasecmp(method, "GET"); // body를 주고받는 요청인지 (HEAD는 header만)
 
-/* 캐시 초기화 */
-void cache_init(void)
-{
-  for (int i = 0; i < CACHE_OBJS_COUNT; i++)
+  /* 캐시 되어있으면 바로 보내줌 */
+  int cachedIdx;    // 캐시되어있는지 찾고 반환값 저장
+  char *request;    // method, 대상, path 묶어서 확인 또는 저장 (ex. GET localhost:8000/home.html)
+  char *getRequest; // HEAD는 GET으로 채운 객체의 header로도 응답할 수 있음
+  request = arena_alloc(arena, strlen(method) + strlen(authority) + strlen(path) + 2);
+  getRequest = arena_alloc(arena, strlen(authority) + strlen(path) + 5);
+  sprintf(request, "%s %s%s", method, authority, path);
+  sprintf(getRequest, "GET %s%s", authority, path);
+  useCache = useCache && strlen(request) < MAXLINE; // 캐시에 key를 담을 자리보다 길면 캐시를 쓰지 않음
+  if (useCache && ((cachedIdx = cache_startHit(request)) != -1 || (!isGet && (cachedIdx = cache_startHit(getRequest)) != -1))) // 캐시되어있다면 (읽기 lock을 잡은 채로 반환됨)
   {
-    cache.blocks[i].priority = 0;   // 우선순위 모두 0
-    cache.blocks[i].isOccupied = 0; // 저장된게 없으니까 0
-    cache.blocks[i].readCnt = 0;
+    cache_block *block = &cache.blocks[cachedIdx];
+    curLog->cache = ALOG_CACHE_HIT;
+    char *body = block->body ? block->body->data : NULL;
+    int bodySize = block->body ? block->body->size : 0;
+    memstat_add(MEM_PINS, block->hdrSize + bodySize); // 쓰는 동안 블럭을 잡고 있음
+    // 조건부 요청이 맞으면 304, HEAD면 header만, Range 요청이면 캐시된 객체에서 구간만 잘라서 보내고, 아니면 header, body 그대로 클라이언트에 써줌
+    if (hdr_notModified(req, &block->meta))
+      hdr_write304(fd, block->hdr, &block->meta);
+    else if (!isGet)
+      conn_write(fd, block->hdr, block->hdrSize);
+    else if (!range[0] || !serve_range(fd, block->hdr, &block->meta, bodySize, range, write_body, body))
+    {
+      conn_write(fd, block->hdr, block->hdrSize);
+      if (bodySize)
+        conn_write(fd, body, bodySize);
+    }
+    memstat_add(MEM_PINS, -(block->hdrSize + bodySize));
+    endRead(cachedIdx); // 읽기 닫고
+    return;             // 반환함
+  }
 
-    // sem_init(초기화할 sem_t 포인터, 공유되는 대상, 초기 값)
-    // 공유되는 대상 : 0은 쓰레드 대상, 나머지는 프로세스 대상
-    // 초기 값 : 여기에 접근 가능한 쓰레드 수. 모든 캐시 블럭에 대해서 1개의 쓰레드로 접근 가능하기 때문에 1로 초기화
-    sem_init(&cache.blocks[i].wMutex, 0, 1);
-    sem_init(&cache.blocks[i].rcMutex, 0, 1);
+  /* 최근에 404/410을 받은 요청이면 저장해둔 에러 응답을 그대로 보내줌 */
+  if (useCache && negcache_lookup(request, fd))
+  {
+    curLog->cache = ALOG_CACHE_NEGATIVE;
+    return;
   }
-}
 
-/* 캐싱되어있는지 확인 */
-int cache_isCached(char *request)
-{
-  for (int i = 0; i < CACHE_OBJS_COUNT; i++) // 모든 캐시 블럭을 돌아다니면서
+  /* 큰 객체가 등록되어있으면 캐시에 있는 segment는 바로, 없는 segment만 서버에 Range 요청해서 채워 보내줌 */
+  seg_stream st;
+  if (useCache && segcache_findObject(getRequest, &st, arena))
   {
-    startRead(i);                                                            // 각각 캐시블럭에 대해서 읽을 수 있는 타이밍에 읽기 시작해서
-    if (cache.blocks[i].isOccupied && !strcmp(request, cache.blocks[i].req)) // 캐싱되어있다면
+    curLog->cache = ALOG_CACHE_SEGMENT;
+    if (hdr_notModified(req, &st.meta))
+      hdr_write304(fd, st.hdr, &st.meta);
+    else if (!isGet)
+      conn_write(fd, st.hdr, st.hdrSize);
+    else
     {
-      lowerPriorty(i); // 찾은 캐시블럭의 우선순위를 상대적으로 높이기 위해 나머지 우선순위 낮춰주고
-      endRead(i);      // 읽기 종료해줘서 다른 쓰레드가 읽을 수 있게 해주고
+      seg_initStream(&st, arena, hostname, port, request_hdrs);
+      serve_segmented(fd, &st, range);
+      seg_freeStream(&st);
+    }
+    return;
+  }
+
+  /* 캐시 안되어있으면 서버로 요청보내고 받은 다음에 받은 response를 캐싱해줌 */
+
+  // end server 연결하고 request 보내기
+  curLog->cache = ALOG_CACHE_MISS;
+  unsigned tried = 0; // 연결하지 못한 backend들
+  while ((endserverfd = Open_endServer(hostname, port)) < 0 && endserverfd != ENDSERVER_BUSY && curBackend >= 0)
+  {
+    // backend에 연결하지 못하면 실패로 기록하고 다른 backend로 다시 연결함 (클라이언트는 실패를 보지 않음)
+    backend_done(curBackend, BACKEND_FAILED);
+    tried |= 1u << curBackend;
+    if ((curBackend = backend_pick(path, tried)) < 0)
+      break;
+    curBackendResult = BACKEND_UNKNOWN;
+    hostname = backend_host(curBackend);
+    port = backend_port(curBackend);
+  }
+  if (endserverfd < 0) // 서버로 연결
+  {
+    if (endserverfd == ENDSERVER_BUSY)
+      clienterror(fd, hostname, "503", "Service Unavailable", "Too many requests are waiting for the server");
+    else
+      clienterror(fd, hostname, "502", "Bad Gateway", "Proxy couldn't connect to the server");
+    return;
+  }
+
+  // 캐시에 담을 수 있는 GET은 Range를 빼고 전체를 받아서, 채운 객체에서 206을 잘라줌 (origin이 206으로 답하면 캐시를 채울 수 없음)
+  // MAX_OBJECT_SIZE 뒤에서 시작하는 구간이면 객체 전체를 한 블럭에 담을 수 없으므로 Range를 그대로 보냄 (206은 segment 캐시가 이어받음)
+  char *upRange = range;
+  if (useCache && isGet && range[0] && range_start(range) < MAX_OBJECT_SIZE)
+    upRange = "";
+
+  alog_mark(curLog, ALOG_PHASE_CONNECT);
+  send_request(endserverfd, request_hdrs, upRange);
+  int bodyLeft = 0; // endserver가 body를 다 받지 않음 (클라이언트가 아직 보내는 중)
+  if (bodyLen)
+  {
+    if (expectContinue) // 이제 body를 보내도 됨 (중간 응답이라 status로 기록하지 않음)
+    {
+      conn_write(fd, (char *)continue_hdr, strlen(continue_hdr));
+      curLog->status = 0;
+    }
+    tw_phase(curTimer, TW_PHASE_IDLE, ROUTE_MS(idleMs, IDLE_TIMEOUT_MS)); // 올려보내는 동안은 멈춰있는 시간만 봄
+    int rc = send_body(endserverfd, rio, bodyLen);
+    bodyLeft = rc == -2;
+    if (rc == -1) // 클라이언트가 body를 다 보내지 않음 (endserver에는 반쯤 보낸 요청이므로 버림)
+    {
+      Close_endServer(endserverfd);
+      if (curTimer->expired)
+        clienterror(fd, hostname, "408", "Request Timeout", "Proxy timed out waiting for the request body");
+      else
+        clienterror(fd, hostname, "400", "Bad Request", "Proxy could not read the request body");
+      return;
+    }
+    tw_phase(curTimer, TW_PHASE_FIRST_BYTE, ROUTE_MS(firstByteMs, FIRST_BYTE_TIMEOUT_MS));
+  }
+  long sent = tw_now(); // 응답 header까지 걸린 시간을 집계함 (hedge 기준)
+  if (!isUnsafe && !bodyLen) // 같은 요청을 두번 보내도 되는 경우만 hedge함 (body는 다시 보낼 수 없으므로 body가 있는 GET, HEAD도 하지 않음)
+  {
+    endserverfd = hedge_race(endserverfd, hostname, port, path, request_hdrs, upRange);
+    if (curBackend >= 0) // 다른 backend가 먼저 응답했으면 이어서 (segment를 채울 때도) 그 backend를 씀
+    {
+      hostname = backend_host(curBackend);
+      port = backend_port(curBackend);
+    }
+  }
+
+  char *cacheBuf;     // 캐싱하기 위해 response 담을 버퍼 (받을 크기만큼만 잡음)
+  int cacheCap;       // cacheBuf 크기
+  int bufSize = 0;    // 캐싱할지 버릴지 판단하기 위해 사이즈 계산
+  int hdrSize;        // cacheBuf 중 header 부분 크기
+  char *relay = NULL; // 캐시에 담지 못하는 부분을 클라이언트로 넘겨줄 때 쓰는 버퍼 (필요할 때만 잡음)
+  char *hdrRaw;       // 받은 응답 header (rio 버퍼 안, 크면 arena)
+  int n;
+
+  /* 응답 header는 rio 버퍼 안에서 한번에 파싱하고 (Range를 캐시에서 처리할지 header를 다 봐야 알 수 있음), 크기를 알게 된 다음에 cacheBuf로 옮김
+   * rio 버퍼보다 큰 header는 arena에서 받고, HTTP_MAX_HEADERS보다 많은 header는 기록하지 않은 채 받은 그대로 넘겨줌 (캐시에는 저장하지 않음) */
+  serv_rio = arena_alloc(arena, sizeof(rio_t));
+  resp = arena_alloc(arena, sizeof(http_response));
+  Rio_readinitb(serv_rio, endserverfd);
+  // endserver가 body를 다 받기 전에 답하고 닫았으면 (413 등) 그 응답을 그대로 넘겨줌. 중간 응답(100 Continue 등)은 넘기지 않음
+  while ((hdrSize = read_response(serv_rio, resp, arena, &hdrRaw)) >= 0 && resp->status >= 100 && resp->status < 200 && resp->status != 101)
+    ;
+  if (hdrSize < 0)
+  {
+    curBackendResult = hdrSize == RESP_TOOLARGE ? BACKEND_OK : BACKEND_FAILED; // 응답은 왔으므로 backend를 빼지 않음
+    Close_endServer(endserverfd);
+    if (curTimer->expired == TW_PHASE_FIRST_BYTE + 1)
+      clienterror(fd, hostname, "504", "Gateway Timeout", "Proxy timed out waiting for the server");
+    else if (hdrSize == RESP_TOOLARGE)
+      clienterror(fd, hostname, "502", "Bad Gateway", "Proxy received a response header that is too large");
+    else
+      clienterror(fd, hostname, "502", "Bad Gateway", "Proxy received an invalid response from the server");
+    if (bodyLeft)
+      body_discard(fd, rio);
+    return;
+  }
+  alog_mark(curLog, ALOG_PHASE_HEADER);
+  hedge_record(curOriginHash, tw_now() - sent);
+  tw_phase(curTimer, TW_PHASE_IDLE, ROUTE_MS(idleMs, IDLE_TIMEOUT_MS));
+  bufSize = hdrSize;
+  int status = resp->status;          // response status code
+  curBackendResult = status >= 500 ? BACKEND_FAILED : BACKEND_OK;
+  long size = resp->contentLength;    // response body size (Content-length 없으면 -1)
+  int storable = useCache && resp_storable(resp); // no-store, chunked 등이 아니면 캐시에 저장 가능
+  if (isUnsafe && status < 400) // 내용이 바뀌었을 수 있으므로 같은 path의 캐시를 지움
+    cache_invalidate(authority, path);
+
+  // body 크기를 알고 캐시에 담을 수 있으면 딱 그만큼, 모르면 header만큼 잡고 받으면서 늘림
+  cacheCap = hdrSize + (isGet && size >= 0 && hdrSize + size <= MAX_OBJECT_SIZE ? size : 0);
+  cacheBuf = arena_alloc(arena, cacheCap);
+  memcpy(cacheBuf, hdrRaw, hdrSize);
+
+  // MAX_OBJECT_SIZE를 넘는 200 응답은 객체로 등록하고, 지금 연결에서 segment 단위로 읽어 캐싱하면서 보내줌
+  if (isGet && status == 200 && storable && size >= 0 && hdrSize + size > MAX_OBJECT_SIZE &&
+      (st.hdr = hdr_buildArena(arena, cacheBuf, resp, size, &st.meta, &st.hdrSize)))
+  {
+    st.total = size;
+    st.objId = segcache_addObject(request, st.hdr, st.hdrSize, &st.meta);
+    seg_initStream(&st, arena, hostname, port, request_hdrs);
+    st.servfd = endserverfd; // 열려있는 연결을 그대로 이어받음
+    st.rio = serv_rio;
+    st.pos = 0;
+    st.end = size;
+    serve_segmented(fd, &st, range);
+    seg_freeStream(&st);
+    return;
+  }
+
+  // origin이 Range를 처리해서 큰 객체의 일부만 보내준 경우, 전체 기준 header로 바꿔서 등록하고 열려있는 연결을 이어받아 그 구간부터 보내줌
+  // (segment를 다 채울 수 있는 부분은 캐싱하면서, 나머지는 바로 넘겨줌. 받은 구간 밖의 segment만 다시 요청함)
+  if (isGet && status == 206 && storable && resp->rangeTotal > MAX_OBJECT_SIZE && resp->rangeFirst >= 0 &&
+      (st.hdr = hdr_buildArena(arena, cacheBuf, resp, resp->rangeTotal, &st.meta, &st.hdrSize)))
+  {
+    st.total = resp->rangeTotal;
+    st.objId = segcache_addObject(request, st.hdr, st.hdrSize, &st.meta);
+    seg_initStream(&st, arena, hostname, port, request_hdrs);
+    if (resp->rangeLast >= resp->rangeFirst && resp->rangeLast < st.total)
+    {
+      st.servfd = endserverfd;
+      st.rio = serv_rio;
+      st.pos = resp->rangeFirst;
+      st.end = resp->rangeLast + 1;
+    }
+    else
+      Close_endServer(endserverfd);
+    serve_segmented(fd, &st, range);
+    seg_freeStream(&st);
+    return;
+  }
+
+  // 온전한 200 응답을 버퍼에 다 담을 수 있으면, Range 요청은 다 받은 다음에 캐시 객체 기준으로 206을 만들어줌
+  // (origin이 Range를 무시하고 전체를 주는 경우에도 client는 요청한 구간만 받음)
+  int rangeFromFill = isGet && range[0] && status == 200 && storable && size >= 0 && hdrSize + size <= MAX_OBJECT_SIZE;
+  if (!rangeFromFill)
+    conn_write(fd, cacheBuf, hdrSize);
+
+  // GET, POST 등일 경우에만 Response Body 부분 처리 (없으면 HEAD요청시에도 실행되어 불필요한 부분 참조하게됨)
+  if (isGet || isUnsafe)
+  {
+    long remain = size; // 남은 body 크기 (Content-length 없으면 EOF까지)
+    while (size < 0 || remain > 0)
+    {
+      int want = (size < 0 || remain > MAXBUF) ? MAXBUF : remain;
+      char *dst;
+      if (bufSize < MAX_OBJECT_SIZE) // 최대 사이즈까지는 cacheBuf에 바로 읽음 (모자라면 늘림)
+      {
+        if (want > MAX_OBJECT_SIZE - bufSize)
+          want = MAX_OBJECT_SIZE - bufSize;
+        if (bufSize + want > cacheCap)
+        {
+          int newCap = cacheCap * 2 < bufSize + want ? bufSize + want : cacheCap * 2;
+          newCap = newCap < MAX_OBJECT_SIZE ? newCap : MAX_OBJECT_SIZE;
+          cacheBuf = arena_resize(arena, cacheBuf, cacheCap, newCap);
+          cacheCap = newCap;
+        }
+        dst = cacheBuf + bufSize;
+      }
+      else // 넘는 부분은 캐싱하지 않으므로 relay 버퍼로 넘겨주기만 함
+      {
+        if (!relay)
+          relay = arena_alloc(arena, MAXBUF);
+        dst = relay;
+      }
+      if ((n = rio_readnb(serv_rio, dst, want)) < 0) // 중간에 끊기면 (RST 등) 받은 부분은 버리고 클라이언트도 끊음 (캐싱하지 않음)
+      {
+        curBackendResult = BACKEND_FAILED;
+        Close_endServer(endserverfd);
+        return;
+      }
+      if (n == 0)
+        break;
+      tw_touch(curTimer);
+      if (!rangeFromFill)
+        conn_write(fd, dst, n); // 클라이언트로 보내줌
+      bufSize += n;
+      remain -= n;
+    }
+  }
+  Close_endServer(endserverfd);
+
+  // 최대 사이즈보다 적은 온전한 200 응답이면 캐시에 둘 header를 한번 만들어둠 (206 같은 부분 응답이 전체 객체 키로 저장되면 안됨)
+  int blockSize = -1;
+  if (bufSize <= MAX_OBJECT_SIZE && status == 200 && storable && (size < 0 || bufSize == hdrSize + size || !isGet))
+    hdrBlock = hdr_buildArena(arena, cacheBuf, resp, isGet ? bufSize - hdrSize : size, &meta, &blockSize);
+
+  if (rangeFromFill && (!hdrBlock || !serve_range(fd, hdrBlock, &meta, size, range, write_body, cacheBuf + hdrSize)))
+    conn_write(fd, cacheBuf, bufSize <= MAX_OBJECT_SIZE ? bufSize : hdrSize); // 구간 응답을 못하면 받은 그대로 보내줌
+
+  if (hdrBlock)
+  {
+    cache_cacheRequest(request, hdrBlock, blockSize, &meta, cacheBuf + hdrSize, bufSize - hdrSize);
+    if (prefetchEnabled && isGet) // HTML이면 포함된 객체들을 미리 받아두도록 큐에 넣음
+      prefetch_scan(hostname, port, authority, path, hdrBlock, &meta, cacheBuf + hdrSize, bufSize - hdrSize);
+  }
+
+  // 404/410은 짧은 시간동안만 기억해둠
+  if ((status == 404 || status == 410) && bufSize <= MAXBUF && useCache)
+    negcache_add(request, cacheBuf, bufSize, NEG_RESPONSE_TTL);
+  if (bodyLeft)
+    body_discard(fd, rio);
+}
+
+/* Range header 값을 구간 리스트로 파싱
+ * 반환값: 만족 가능한 구간 수, 모든 구간이 범위 밖이면 -1 (416), 문법이 틀리거나 너무 많으면 0 (Range 무시하고 전체 응답) */
+int parse_range(char *range, long total, byte_range *ranges)
+{
+  int cnt = 0, specs = 0;
+  char *ptr = range, *end;
+  long first, last;
+
+  if (strncasecmp(ptr, "bytes=", 6)) // byte 단위 말고는 지원하지 않음
+    return 0;
+  ptr += 6;
+
+  while (*ptr)
+  {
+    while (*ptr == ' ' || *ptr == '\t' || *ptr == ',') // 구간 사이 공백, 콤마 건너뜀
+      ptr++;
+    if (!*ptr)
+      break;
+    if (++specs > MAX_RANGES) // 구간이 너무 많으면 쪼개주지 않고 전체를 보냄
+      return 0;
+
+    if (*ptr == '-') // suffix 구간 (-N : 마지막 N byte)
+    {
+      last = strtol(ptr + 1, &end, 10);
+      if (end == ptr + 1 || last < 0)
+        return 0;
+      first = last ? total - last : total; // -0 은 만족 불가
+      if (first < 0)
+        first = 0;
+      last = total - 1;
+    }
+    else
+    {
+      first = strtol(ptr, &end, 10);
+      if (end == ptr || *end != '-' || first < 0)
+        return 0;
+      ptr = end + 1;
+      last = strtol(ptr, &end, 10);
+      if (end == ptr) // N- : N부터 끝까지
+        last = total - 1;
+      else if (last < first)
+        return 0;
+      if (last >= total)
+        last = total - 1;
+    }
+    ptr = end;
+    while (*ptr == ' ' || *ptr == '\t')
+      ptr++;
+    if (*ptr && *ptr != ',')
+      return 0;
+
+    if (first < total) // 범위 밖 구간은 버림
+    {
+      ranges[cnt].first = first;
+      ranges[cnt].last = last;
+      cnt++;
+    }
+  }
+  if (!specs)
+    return 0;
+  return cnt ? cnt : -1;
+}
+
+/* Range 요청이 시작하는 가장 앞 위치. suffix 구간(-N)은 전체 크기를 알아야 하므로 문법이 틀린 경우와 같이 0 */
+long range_start(char *range)
+{
+  char *ptr = range + 6, *end;
+  long first, min = -1;
+
+  if (strncasecmp(range, "bytes=", 6))
+    return 0;
+  while (ptr)
+  {
+    while (*ptr == ' ' || *ptr == '\t' || *ptr == ',')
+      ptr++;
+    if (!*ptr)
+      break;
+    first = strtol(ptr, &end, 10);
+    if (end == ptr || first < 0)
+      return 0;
+    if (min < 0 || first < min)
+      min = first;
+    ptr = strchr(end, ',');
+  }
+  return min < 0 ? 0 : min;
+}
+
+/* 메모리에 있는 body에서 [first, last] 구간을 그대로 써줌 */
+int write_body(int fd, void *body, long first, long last)
+{
+  conn_write(fd, (char *)body + first, last - first + 1);
+  return 0;
+}
+
+/* 완전한 객체로부터 Range 요청에 대한 206/416 응답을 보냄. body 구간은 writer를 통해 씀
+ * Range를 처리했으면 1, 무시하고 전체를 보내야 하면 0 반환 */
+int serve_range(int fd, char *hdr, hdr_meta *meta, long bodySize, char *range, range_writer writer, void *ctx)
+{
+  byte_range ranges[MAX_RANGES];
+  char buf[MAXBUF], ctype[MAXLINE], part[2 * MAXLINE];
+  int cnt, len, n, i;
+
+  if ((cnt = parse_range(range, bodySize, ranges)) == 0)
+    return 0;
+  if (cnt < 0) // 만족 가능한 구간이 없음
+  {
+    sprintf(buf, "HTTP/1.0 416 Range Not Satisfiable\r\nContent-Range: bytes */%ld\r\nContent-length: 0\r\n\r\n", bodySize);
+    conn_write(fd, buf, strlen(buf));
+    return 1;
+  }
+
+  // 미리 만들어둔 header에서 validator와 나머지 줄은 그대로 쓰고, status line, Content-length, Content-type만 바꿈
+  n = meta->endOff - meta->valOff;
+  if (n >= MAXBUF / 2 || meta->lenOff - meta->ctypeOff >= MAXLINE) // 다시 쓸 header가 너무 크면 그냥 전체를 보냄
+    return 0;
+  strcpy(buf, partial_hdr);
+  len = strlen(buf);
+  memcpy(buf + len, hdr + meta->valOff, n);
+  len += n;
+  memcpy(ctype, hdr + meta->ctypeOff, meta->lenOff - meta->ctypeOff);
+  ctype[meta->lenOff - meta->ctypeOff] = '\0';
+
+  if (cnt == 1) // 단일 구간 : Content-Range와 함께 구간만 보냄
+  {
+    len += sprintf(buf + len, "%s", ctype);
+    len += sprintf(buf + len, content_range_fmt, ranges[0].first, ranges[0].last, bodySize);
+    len += sprintf(buf + len, content_length_fmt, ranges[0].last - ranges[0].first + 1);
+    len += sprintf(buf + len, "%s", endof_hdr);
+    conn_write(fd, buf, len);
+    writer(fd, ctx, ranges[0].first, ranges[0].last);
+    return 1;
+  }
+
+  // 여러 구간 : multipart/byteranges로 구간마다 part header를 붙여서 보냄. 전체 길이를 먼저 계산함
+  long total = 0;
+  for (i = 0; i < cnt; i++)
+  {
+    total += sprintf(part, "\r\n--%s\r\n%s", byteranges_boundary, ctype);
+    total += sprintf(part, content_range_fmt, ranges[i].first, ranges[i].last, bodySize);
+    total += 2 + ranges[i].last - ranges[i].first + 1;
+  }
+  total += sprintf(part, "\r\n--%s--\r\n", byteranges_boundary);
+
+  len += sprintf(buf + len, "Content-type: multipart/byteranges; boundary=%s\r\n", byteranges_boundary);
+  len += sprintf(buf + len, content_length_fmt, total);
+  len += sprintf(buf + len, "%s", endof_hdr);
+  conn_write(fd, buf, len);
+  for (i = 0; i < cnt; i++)
+  {
+    len = sprintf(part, "\r\n--%s\r\n%s", byteranges_boundary, ctype);
+    len += sprintf(part + len, content_range_fmt, ranges[i].first, ranges[i].last, bodySize);
+    len += sprintf(part + len, "\r\n");
+    conn_write(fd, part, len);
+    if (writer(fd, ctx, ranges[i].first, ranges[i].last) < 0)
+      return 1;
+  }
+  len = sprintf(part, "\r\n--%s--\r\n", byteranges_boundary);
+  conn_write(fd, part, len);
+  return 1;
+}
+
+/* endserver 응답 header를 빈 줄까지 rio 버퍼에 받으면서 그 자리에서 파싱함 (doit()의 요청 파싱과 같은 방식)
+ * rio 버퍼를 다 채워도 끝나지 않으면 받은 것을 arena로 옮기고, 거기에 이어 받으면서 MAX_RESP_HDR까지 늘림 (arena가 NULL이면 늘리지 않음)
+ * header 길이 반환. header는 rio에서 넘긴 상태로 *hdr에 있음 (rio 버퍼 안이면 rio에서 다시 읽기 전까지만 유효하므로 호출부에서 바로 복사함)
+ * 형식이 틀리거나 중간에 끊기면 -1, 너무 크면 RESP_TOOLARGE */
+int read_response(rio_t *rio, http_response *resp, arena_t *arena, char **hdr)
+{
+  char *buf = NULL; // arena로 옮긴 뒤의 버퍼. [0, len)은 rio에서 넘긴 부분, 그 뒤는 rio에 남은 부분의 복사본
+  int rc, len = 0, cap = 0;
+
+  http_response_init(resp);
+  while ((rc = http_parse_response(resp, buf ? buf : rio->rio_bufptr, len + rio->rio_cnt)) == HTTP_PARSE_AGAIN)
+  {
+    if (buf || rio->rio_cnt == sizeof(rio->rio_buf)) // rio 버퍼가 찼으면 arena로 옮기고 rio는 비움
+    {
+      if (!arena)
+        return RESP_TOOLARGE;
+      if (!buf)
+        memcpy(buf = arena_alloc(arena, cap = 2 * sizeof(rio->rio_buf)), rio->rio_bufptr, rio->rio_cnt);
+      len += rio->rio_cnt;
+      rio_consumeb(rio, rio->rio_cnt);
+    }
+    if (rio_fillb(rio) <= 0)
+      return -1;
+    if (buf)
+    {
+      if (len + rio->rio_cnt > MAX_RESP_HDR)
+        return RESP_TOOLARGE;
+      if (len + rio->rio_cnt > cap)
+      {
+        buf = arena_resize(arena, buf, cap, cap * 2 < MAX_RESP_HDR ? cap * 2 : MAX_RESP_HDR);
+        cap = cap * 2 < MAX_RESP_HDR ? cap * 2 : MAX_RESP_HDR;
+      }
+      memcpy(buf + len, rio->rio_bufptr, rio->rio_cnt);
+    }
+  }
+  if (rc <= 0)
+    return rc == HTTP_PARSE_TOOLARGE ? RESP_TOOLARGE : -1;
+  *hdr = buf ? buf : rio->rio_bufptr;
+  rio_consumeb(rio, rc - len);
+  return rc;
+}
+
+/* 캐시에 저장해도 되는 응답인지 (no-store, no-cache, private이거나 chunked이거나 기록하지 못한 header가 있으면 저장하지 않음) */
+int resp_storable(http_response *resp)
+{
+  return !resp->chunked && !resp->f.overflow && !(resp->cacheFlags & (HTTP_CC_NO_STORE | HTTP_CC_NO_CACHE | HTTP_CC_PRIVATE));
+}
+
+/* header 한 줄을 dst에 그대로 이어 붙임. 넘치면 -1 */
+static int hdr_append(char *dst, int dstSize, int len, char *raw, http_header *h)
+{
+  if (len + h->name.len + h->value.len + 4 >= dstSize)
+    return -1;
+  memcpy(dst + len, raw + h->name.off, h->name.len);
+  memcpy(dst + len + h->name.len, ": ", 2);
+  memcpy(dst + len + h->name.len + 2, raw + h->value.off, h->value.len);
+  memcpy(dst + len + h->name.len + 2 + h->value.len, "\r\n", 2);
+  return len + h->name.len + h->value.len + 4;
+}
+
+/* 캐시된 header에서 어느 자리에 둘 header인지. 0: validator (304에도 씀), 1: 나머지, -1: 빼거나 따로 씀 */
+static int hdr_group(int id)
+{
+  switch (id)
+  {
+  case HTTP_HDR_ETAG:
+  case HTTP_HDR_LAST_MODIFIED:
+  case HTTP_HDR_CACHE_CONTROL:
+  case HTTP_HDR_EXPIRES:
+  case HTTP_HDR_DATE:
+  case HTTP_HDR_VARY:
+    return 0;
+  case HTTP_HDR_CONNECTION: // hop-by-hop
+  case HTTP_HDR_KEEP_ALIVE:
+  case HTTP_HDR_PROXY_CONNECTION:
+  case HTTP_HDR_TE:
+  case HTTP_HDR_TRAILER:
+  case HTTP_HDR_TRANSFER_ENCODING:
+  case HTTP_HDR_UPGRADE:
+  case HTTP_HDR_CONTENT_LENGTH: // 길이는 직접 씀
+  case HTTP_HDR_CONTENT_RANGE:
+  case HTTP_HDR_CONTENT_TYPE: // 자리가 따로 있음
+    return -1;
+  }
+  return 1;
+}
+
+/* endserver 응답(raw, resp로 파싱한 것)으로부터 캐시에 둘 200 응답 header를 만듦. body 크기는 length (모르면 -1)
+ * 만든 길이 반환, dstSize를 넘으면 -1 */
+int hdr_build(char *dst, int dstSize, char *raw, http_response *resp, long length, hdr_meta *meta)
+{
+  http_header *h;
+  int len, i, group;
+
+  len = strlen(ok_hdr);
+  memcpy(dst, ok_hdr, len);
+  meta->ctypeOff = len;
+  if ((h = http_response_header(resp, HTTP_HDR_CONTENT_TYPE)) && (len = hdr_append(dst, dstSize, len, raw, h)) < 0)
+    return -1;
+  meta->lenOff = len;
+  if (length >= 0)
+    len += snprintf(dst + len, dstSize - len, content_length_fmt, length);
+  meta->valOff = len;
+  for (group = 0; group < 2; group++)
+  {
+    if (group == 1)
+      meta->restOff = len;
+    for (i = 0; i < resp->f.nheaders; i++)
+      if (hdr_group(resp->f.headers[i].id) == group && (len = hdr_append(dst, dstSize, len, raw, &resp->f.headers[i])) < 0)
+        return -1;
+  }
+  meta->endOff = len;
+  if (len + 2 >= dstSize)
+    return -1;
+  memcpy(dst + len, endof_hdr, 2);
+  len += 2;
+
+  // 조건부 요청 비교에 쓸 validator 값
+  meta->length = length;
+  meta->etag[0] = '\0';
+  if ((h = http_response_header(resp, HTTP_HDR_ETAG)) && h->value.len < MAX_ETAG)
+  {
+    memcpy(meta->etag, raw + h->value.off, h->value.len);
+    meta->etag[h->value.len] = '\0';
+  }
+  meta->lastModified = 0;
+  if ((h = http_response_header(resp, HTTP_HDR_LAST_MODIFIED)) && h->value.len < MAXLINE)
+  {
+    char date[MAXLINE];
+    memcpy(date, raw + h->value.off, h->value.len);
+    date[h->value.len] = '\0';
+    meta->lastModified = parse_http_date(date);
+  }
+  return len;
+}
+
+/* hdr_build()로 arena에 header를 만들고 실제 크기만큼만 남김. 크기는 *size에, 만들 수 없으면 NULL
+ * 다시 쓴 header는 원래 header보다 status line, Content-length 줄, 줄마다 ": "와 "\r\n" 만큼만 길어질 수 있음 */
+char *hdr_buildArena(arena_t *arena, char *raw, http_response *resp, long length, hdr_meta *meta, int *size)
+{
+  int cap = resp->f.pos + 2 * resp->f.nheaders + strlen(ok_hdr) + 64; // 64: Content-length 줄
+  char *dst;
+
+  cap = cap < MAXBUF ? cap : MAXBUF;
+  dst = arena_alloc(arena, cap);
+  if ((*size = hdr_build(dst, cap, raw, resp, length, meta)) < 0)
+  {
+    arena_resize(arena, dst, cap, 0);
+    return NULL;
+  }
+  return arena_resize(arena, dst, cap, *size); // 방금 잡은 자리라 제자리에서 줄어듦
+}
+
+/* 클라이언트의 If-None-Match / If-Modified-Since가 캐시된 객체와 맞으면 1 (304로 답함)
+ * If-None-Match가 있으면 If-Modified-Since는 보지 않음 (RFC 7232 3.3) */
+int hdr_notModified(http_request *req, hdr_meta *meta)
+{
+  char *inm = http_request_value(req, HTTP_HDR_IF_NONE_MATCH);
+  char *ims = http_request_value(req, HTTP_HDR_IF_MODIFIED_SINCE);
+  time_t since;
+
+  if (inm)
+    return etag_match(inm, meta->etag);
+  if (ims && meta->lastModified && (since = parse_http_date(ims)))
+    return meta->lastModified <= since;
+  return 0;
+}
+
+/* 미리 만들어둔 header의 validator 줄들로 304 응답을 보냄 */
+void hdr_write304(int fd, char *hdr, hdr_meta *meta)
+{
+  char buf[MAXBUF + MAXLINE];
+  int len = strlen(not_modified_hdr);
+
+  memcpy(buf, not_modified_hdr, len);
+  memcpy(buf + len, hdr + meta->valOff, meta->restOff - meta->valOff);
+  len += meta->restOff - meta->valOff;
+  memcpy(buf + len, endof_hdr, 2);
+  conn_write(fd, buf, len + 2);
+}
+
+/* HTTP-date (ex. Sun, 06 Nov 1994 08:49:37 GMT)를 time_t로. 형식이 다르면 0 */
+time_t parse_http_date(const char *date)
+{
+  static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  struct tm tm;
+  char mon[4];
+  const char *m;
+
+  memset(&tm, 0, sizeof(tm));
+  if (sscanf(date, "%*3s, %d %3s %d %d:%d:%d GMT", &tm.tm_mday, mon, &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+    return 0;
+  if (!(m = strstr(months, mon)) || (m - months) % 3)
+    return 0;
+  tm.tm_mon = (m - months) / 3;
+  tm.tm_year -= 1900;
+  return timegm(&tm);
+}
+
+/* If-None-Match 목록(ex. "a", W/"b" 또는 *)에 etag가 있는지. 약한 비교라 W/는 무시함 */
+int etag_match(char *list, char *etag)
+{
+  char *p = list;
+  int n;
+
+  if (!strncmp(etag, "W/", 2))
+    etag += 2;
+  n = strlen(etag);
+  while (p && *p)
+  {
+    while (*p == ' ' || *p == '\t' || *p == ',')
+      p++;
+    if (*p == '*')
+      return 1;
+    if (!strncmp(p, "W/", 2))
+      p += 2;
+    if (n && !strncmp(p, etag, n) && (!p[n] || p[n] == ',' || p[n] == ' ' || p[n] == '\t'))
+      return 1;
+    p = strchr(p, ',');
+  }
+  return 0;
+}
+
+// URI Parsing - request header로 들어온 uri에서 hostname, port, path 추출
+void parse_uri(char *uri, char *hostname, int *port, char *path)
+{
+  *port = 80; // HTTP 기본포트 80으로 default 세팅
+
+  if (uri[0] == '/') // origin-form ("GET /path")이면 host 없이 path만 (path 안의 ':', "//"를 host로 보지 않음)
+  {
+    sscanf(uri, "%s", path);
+    return;
+  }
+
+  char *ptr;
+  ptr = strstr(uri, "//");   // http:// 이후부분으로 파싱
+  ptr = ptr ? ptr + 2 : uri; // http:// 없어도 문제 없음
+
+  char *ptr2 = strchr(ptr, ':'); // 포트번호 (host 뒤 / 보다 앞에 있는 ':'만)
+  char *slash = strchr(ptr, '/');
+  if (ptr2 && slash && slash < ptr2)
+    ptr2 = NULL;
+  if (ptr2) // 있으면
+  {
+    *ptr2 = '\0';                         // eof넣고
+    sscanf(ptr, "%s", hostname);          // \0전까지 읽어서 hostname 파싱
+    sscanf(ptr2 + 1, "%d%s", port, path); // 나머지 port, path 파싱
+  }
+  else // 없으면
+  {
+    ptr2 = strchr(ptr, '/'); // hostname 뒤 / 위치
+    if (ptr2)                // 있으면
+    {
+      *ptr2 = '\0';
+      sscanf(ptr, "%s", hostname);
+      *ptr2 = '/';
+      sscanf(ptr2, "%s", path); // 포트번호 없을때는 뒤에 바로 path
+    }
+    else                           // 없으면
+      sscanf(ptr, "%s", hostname); // path없으면 바로 hostname으로 파싱
+  }
+}
+
+/* endserver로의 request를 위해 header 작성. 들어온 header 길이만큼만 arena에 잡아서 바로 씀 */
+char *build_requesthdrs(arena_t *arena, char *method, char *hostname, char *path, http_request *req, char **range)
+{
+  char *http_header, *host, *name, *value;
+  int i, len;
+  size_t size;
+  int hasIfRange = 0; // If-Range가 있으면 validator 확인 없이 전체 응답을 보내기 위해 표시
+  int chunked = body_length(req) == BODY_CHUNKED; // chunked body는 그대로 넘기므로 HTTP/1.1로 보냄
+  const char *fmt = chunked ? chunked_request_hdr_fmt : request_hdr_fmt;
+
+  *range = "";
+  host = http_request_value(req, HTTP_HDR_HOST); // Host : 가 있으면 그대로, 없으면 uri의 hostname으로
+
+  // 필요한 크기 계산 (고정 header + request line + Host + 나머지 header는 "name: value\r\n" 모양으로 다시 씀)
+  size = strlen(fmt) + strlen(method) + strlen(path) + strlen(host_hdr_fmt) + strlen(host ? host : hostname) +
+         strlen(conn_hdr) + strlen(prox_conn_hdr) + strlen(user_agent_hdr) + strlen(endof_hdr) + 1;
+  for (i = 0; i < req->f.nheaders; i++)
+    size += req->f.headers[i].name.len + req->f.headers[i].value.len + 4;
+  http_header = arena_alloc(arena, size);
+
+  // Request Header 첫번째줄, Host, 고정 header 세팅
+  len = sprintf(http_header, fmt, method, path);
+  len += sprintf(http_header + len, host_hdr_fmt, host ? host : hostname);
+  len += sprintf(http_header + len, "%s%s%s", conn_hdr, prox_conn_hdr, user_agent_hdr);
+
+  // doit()에서 파싱해둔 header들을 순서대로 봄. 이름은 파싱할 때 이미 분류해둠 (http_header_id)
+  for (i = 0; i < req->f.nheaders; i++)
+  {
+    name = http_str(req, req->f.headers[i].name);
+    value = http_str(req, req->f.headers[i].value);
+
+    switch (req->f.headers[i].id)
+    {
+    case HTTP_HDR_RANGE: // Range : 값만 따로 저장 (캐시에서 구간 응답할 때 사용). endserver로는 send_request()에서 필요할 때만 붙여 보냄
+      *range = arena_strndup(arena, value, req->f.headers[i].value.len);
+      continue;
+    case HTTP_HDR_IF_RANGE:
+      hasIfRange = 1;
+      continue;
+    case HTTP_HDR_HOST:       // 위에서 이미 씀
+    case HTTP_HDR_CONNECTION: // conn / prox conn / user agent 부분은 이미 저장되어있는 fmt 대로 쓸거라서 제외
+    case HTTP_HDR_PROXY_CONNECTION:
+    case HTTP_HDR_USER_AGENT:
+    case HTTP_HDR_EXPECT: // 100-continue는 proxy가 클라이언트에게 직접 답함
+      continue;
+    case HTTP_HDR_CONTENT_LENGTH: // Transfer-Encoding과 같이 오면 Content-Length는 무시해야 함 (둘 다 넘기면 endserver와 body 끝을 다르게 볼 수 있음)
+      if (chunked)
+        continue;
+      break;
+    }
+
+    // 나머지 header 처리 - 길이를 이미 알고 있으므로 sprintf 대신 그대로 이어 붙임
+    int nameLen = req->f.headers[i].name.len, valueLen = req->f.headers[i].value.len;
+    memcpy(http_header + len, name, nameLen);
+    memcpy(http_header + len + nameLen, ": ", 2);
+    memcpy(http_header + len + nameLen + 2, value, valueLen);
+    memcpy(http_header + len + nameLen + 2 + valueLen, "\r\n", 2);
+    len += nameLen + valueLen + 4;
+  }
+  strcpy(http_header + len, endof_hdr);
+  if (hasIfRange) // If-Range 조건은 확인하지 않으므로 항상 전체 응답 (RFC 7233상 허용됨)
+    *range = "";
+  return http_header;
+}
+
+/* 파싱한 port가 int형이기 때문에 문자열로 변환 및 endserver와 연결 */
+inline int Open_endServer(char *hostname, int port)
+{
+  char portStr[100], key[MAXLINE];
+  int fd, slot, tries;
+  long deadline, wait;
+
+  sprintf(portStr, "%d", port);
+  snprintf(key, MAXLINE, "%s:%s", hostname, portStr);
+  if (curBackend < 0 && negcache_lookup(key, -1)) // 최근에 연결 실패한 곳이면 다시 시도하지 않고 바로 실패 (backend는 circuit breaker가 판단함)
+    return -1;
+
+  // origin마다 동시에 여는 연결 수를 제한함. 자리가 없으면 클라이언트별 대기열에서 차례를 기다림
+  if ((slot = origin_acquire(hostname, portStr, curClient, ORIGIN_QUEUE_TIMEOUT_MS)) == ORIGIN_BUSY)
+    return ENDSERVER_BUSY;
+
+  // 주소는 resolver 캐시에서 찾고 (조회 실패도 resolver가 기억함), 연결 실패만 여기서 기억해둠
+  // Open_clientfd는 실패하면 프로세스를 종료시키므로 실패를 반환하는 resolver_connect를 씀
+  // 주소마다 막혀서 기다리지 않도록 non-blocking으로 시차를 두고 동시에 시도하고, connectTimeout이 지나면 포기함
+  // 연결 자체의 제한 시간은 resolver_connect가 지키고, wheel은 그래도 못 돌아올 때를 대비해 조금 늦게 걸어둠
+  // 바로 거절당하면 (재시작 중인 서버 등) 같은 제한 시간 안에서 잠깐 쉬었다가 다시 시도함. 재시도마다 예산을 씀
+  if (curTimer)
+    tw_phase(curTimer, TW_PHASE_CONNECT, connectTimeout + TW_TICK_MS);
+  hedge_deposit();
+  deadline = tw_now() + connectTimeout;
+  for (tries = 0; (fd = resolver_connect(hostname, portStr, tries ? deadline - tw_now() : connectTimeout, NULL, 0)) == -1; tries++)
+  {
+    wait = HEDGE_RETRY_BACKOFF_MS << tries;
+    if (curBackend >= 0 || connectTimeout <= 0 || tries >= HEDGE_MAX_RETRIES || deadline - tw_now() <= wait || !hedge_withdraw(HEDGE_KIND_RETRY))
+      break;
+    usleep(wait * 1000);
+  }
+  if (fd == -1 && curBackend < 0)
+    negcache_add(key, NULL, 0, NEG_CONNECT_TTL);
+  if (fd < 0)
+    origin_release(slot);
+  else
+    curOrigin = slot; // Close_endServer에서 돌려줌
+  if (fd >= 0 && curTimer) // 이제부터 응답 header가 올 때까지 기다림 (timer가 끊을 수 있도록 소켓 등록)
+  {
+    tw_server(curTimer, fd);
+    tw_phase(curTimer, TW_PHASE_FIRST_BYTE, ROUTE_MS(firstByteMs, FIRST_BYTE_TIMEOUT_MS));
+  }
+  return fd;
+}
+
+/* 캐시에 없는 GET/HEAD 요청이 이 origin의 p95가 지나도록 응답이 없으면, 다른 주소로 (없으면 같은 주소에 새 연결로)
+ * 같은 요청을 한번 더 보내고 먼저 응답이 오는 연결을 씀. 진 쪽은 바로 닫음.
+ * reverse proxy 모드에서는 다른 backend로 보냄 (backend마다 주소가 하나라 같은 backend로 보내면 느린 backend의 부하만 늘어남).
+ * 다른 backend가 이기면 curBackend를 그 backend로 바꾸고, 원래 backend는 결과 없이 끝냄 (늦었을 뿐 실패는 아님).
+ * 예산이 없거나 origin 자리가 비어있지 않거나 보낼 다른 backend가 없으면 원래 연결만 기다림 (hedge가 부하를 키우지 않도록).
+ * hedge 연결은 p95 안에 연결되지 않으면 포기함 (그 사이 원래 연결의 응답을 놓치지 않도록) */
+int hedge_race(int fd, char *hostname, int port, char *path, char *request_hdrs, char *range)
+{
+  struct pollfd pfds[2];
+  struct sockaddr_storage peer;
+  socklen_t peerLen = sizeof(peer);
+  char portStr[16];
+  long delay;
+  int slot, hfd, hb = -1;
+
+  if (!hedgeEnabled || (delay = hedge_delay(curOriginHash)) < 0)
+    return fd;
+  pfds[0].fd = fd;
+  pfds[0].events = POLLIN;
+  if (poll(pfds, 1, delay) != 0 || !hedge_withdraw(HEDGE_KIND_HEDGE)) // 응답(또는 끊김)이 왔음
+    return fd;
+  if (curBackend >= 0)
+  {
+    if ((hb = backend_pick(path, 1u << curBackend)) < 0)
+      return fd;
+    hostname = backend_host(hb);
+    port = backend_port(hb);
+  }
+  sprintf(portStr, "%d", port);
+  if ((slot = origin_acquire(hostname, portStr, curClient, 0)) == ORIGIN_BUSY)
+  {
+    if (hb >= 0)
+      backend_done(hb, BACKEND_UNKNOWN);
+    return fd;
+  }
+  if (hb >= 0 || getpeername(fd, (SA *)&peer, &peerLen) < 0) // 다른 backend면 주소를 피할 필요 없음
+    peerLen = 0;
+  if ((hfd = resolver_connect(hostname, portStr, delay, peerLen ? (SA *)&peer : NULL, peerLen)) < 0)
+  {
+    origin_release(slot);
+    if (hb >= 0)
+      backend_done(hb, BACKEND_FAILED);
+    return fd;
+  }
+  send_request(hfd, request_hdrs, range);
+
+  // 둘 중 먼저 읽을 수 있는 쪽을 씀. 늦어지면 timer가 원래 연결을 끊어서 깨워줌 (그러면 504)
+  pfds[1].fd = hfd;
+  pfds[1].events = POLLIN;
+  while (poll(pfds, 2, -1) < 0 && errno == EINTR)
+    ;
+  if (pfds[0].revents) // 같이 왔으면 원래 연결을 씀
+  {
+    Close(hfd);
+    origin_release(slot);
+    if (hb >= 0) // 응답을 보지 않았으므로 결과로 세지 않음
+      backend_done(hb, BACKEND_UNKNOWN);
+    return fd;
+  }
+  hedge_won();
+  if (curTimer) // 닫기 전에 timer가 끊을 소켓을 바꿔둠
+    tw_server(curTimer, hfd);
+  Close(fd);
+  origin_release(curOrigin);
+  curOrigin = slot;
+  if (hb >= 0) // 이제부터 결과는 이긴 backend에 반영함 (doit()에서 backend_done)
+  {
+    backend_done(curBackend, BACKEND_UNKNOWN);
+    curBackend = hb;
+    curBackendResult = BACKEND_UNKNOWN;
+  }
+  return hfd;
+}
+
+/* endserver 연결 닫기. 닫은 fd 번호를 다른 연결이 받을 수 있으므로 timer에서 먼저 뺌. origin 자리도 돌려줌 */
+void Close_endServer(int fd)
+{
+  if (curTimer)
+    tw_server(curTimer, -1);
+  Close(fd);
+  origin_release(curOrigin); // 기다리는 요청이 있으면 다음 차례에게 넘어감
+  curOrigin = ORIGIN_UNLIMITED;
+}
+
+/* endserver로 request 전송. range가 있으면 header 끝의 빈 줄 앞에 Range header를 붙여줌
+ * (timer가 연결을 끊었을 수 있으므로 실패해도 프로세스를 끝내지 않음. 응답을 읽을 때 실패로 처리됨) */
+void send_request(int serverfd, char *request_hdrs, char *range)
+{
+  char buf[MAXLINE];
+  int len = strlen(request_hdrs);
+
+  if (!range || !range[0])
+  {
+    rio_writen(serverfd, request_hdrs, len);
+    return;
+  }
+  rio_writen(serverfd, request_hdrs, len - strlen(endof_hdr));
+  sprintf(buf, range_hdr_fmt, range);
+  strcat(buf, endof_hdr);
+  rio_writen(serverfd, buf, strlen(buf));
+}
+
+/* 요청 body 크기. Transfer-Encoding이 있으면 마지막이 chunked여야 하고 Content-Length보다 먼저 봄 (RFC 7230 3.3.3) */
+long body_length(http_request *req)
+{
+  char *te = http_request_value(req, HTTP_HDR_TRANSFER_ENCODING), *cl = http_request_value(req, HTTP_HDR_CONTENT_LENGTH), *end;
+  size_t len;
+  long n;
+
+  if (te)
+  {
+    len = strlen(te);
+    return len >= 7 && !strcasecmp(te + len - 7, "chunked") ? BODY_CHUNKED : BODY_INVALID;
+  }
+  if (!cl)
+    return 0;
+  n = strtol(cl, &end, 10);
+  return end == cl || *end || n < 0 ? BODY_INVALID : n;
+}
+
+/* rio 버퍼에 있는 것부터 n byte를 endserver로 그대로 씀 (버퍼가 비면 클라이언트에서 더 받음). 클라이언트 쪽 실패면 -1, endserver 쪽이면 -2 */
+static int body_copy(int serverfd, rio_t *rio, long n)
+{
+  long len;
+
+  while (n > 0)
+  {
+    if (!rio->rio_cnt && rio_fillb(rio) <= 0)
+      return -1;
+    len = rio->rio_cnt < n ? rio->rio_cnt : n;
+    if (rio_writen(serverfd, rio->rio_bufptr, len) != len)
+      return -2;
+    rio_consumeb(rio, len);
+    curLog->received += len;
+    tw_touch(curTimer);
+    n -= len;
+  }
+  return 0;
+}
+
+/* 다음 줄(LF까지)이 rio 버퍼에 다 들어올 때까지 받고 그 길이를 반환 (버퍼보다 긴 줄이거나 끊기면 -1) */
+static int body_line(rio_t *rio)
+{
+  char *eol;
+
+  while (!(eol = memchr(rio->rio_bufptr, '\n', rio->rio_cnt)))
+    if (rio_fillb(rio) <= 0)
+      return -1;
+  return eol - rio->rio_bufptr + 1;
+}
+
+/* 요청 body를 endserver로 흘려보냄. 클라이언트 rio 버퍼(RIO_BUFSIZE)에 들어온 만큼씩 바로 쓰므로 업로드 전체를 담아두지 않음.
+ * chunked면 chunk 경계만 따라가면서 다시 인코딩하지 않고 그대로 보내고, 마지막 chunk와 trailer까지 보냄.
+ * 성공하면 0, 클라이언트가 끊었거나 chunk가 잘못되었으면 -1, endserver에 쓰지 못하면 -2 */
+int send_body(int serverfd, rio_t *rio, long length)
+{
+  long chunk;
+  char *end;
+  int len, rc;
+
+  if (length != BODY_CHUNKED)
+    return body_copy(serverfd, rio, length);
+  while (1) // chunk-size [; ext] CRLF, chunk data, CRLF
+  {
+    if ((len = body_line(rio)) < 0)
+      return -1;
+    chunk = strtol(rio->rio_bufptr, &end, 16);
+    if (end == rio->rio_bufptr || chunk < 0)
+      return -1;
+    if ((rc = body_copy(serverfd, rio, len)) < 0)
+      return rc;
+    if (!chunk) // 마지막 chunk
+      break;
+    if ((rc = body_copy(serverfd, rio, chunk)) < 0)
+      return rc;
+    if ((len = body_line(rio)) < 0 || len > 2) // data 뒤에는 빈 줄이어야 함
+      return -1;
+    if ((rc = body_copy(serverfd, rio, len)) < 0)
+      return rc;
+  }
+  do // trailer, 빈 줄까지
+  {
+    if ((len = body_line(rio)) < 0)
+      return -1;
+    if ((rc = body_copy(serverfd, rio, len)) < 0)
+      return rc;
+  } while (len > 2);
+  return 0;
+}
+
+/* endserver가 body를 다 받지 않고 응답한 경우 (413 등). 받지 않은 데이터가 남은 채로 닫으면 RST가 가서 클라이언트가 응답을 못 읽을 수 있으므로
+ * 쓰기를 닫고 SHED_LINGER_MS 동안 남은 body를 읽어서 버림 (timer가 끊으면 끝남) */
+void body_discard(int fd, rio_t *rio)
+{
+  shutdown(fd, SHUT_WR);
+  tw_phase(curTimer, TW_PHASE_IDLE, SHED_LINGER_MS);
+  rio_consumeb(rio, rio->rio_cnt);
+  while (rio_fillb(rio) > 0)
+    rio_consumeb(rio, rio->rio_cnt);
+}
+
+/* 캐시 초기화 */
+void cache_init(void)
+{
+  for (int i = 0; i < CACHE_OBJS_COUNT; i++)
+  {
+    cache.blocks[i].priority = 0;   // 우선순위 모두 0
+    cache.blocks[i].isOccupied = 0; // 저장된게 없으니까 0
+    cache.blocks[i].readCnt = 0;
+    cache.blocks[i].hdr = NULL;
+    cache.blocks[i].body = NULL;
+    cache.bodies[i].refCnt = 0;
+
+    // sem_init(초기화할 sem_t 포인터, 공유되는 대상, 초기 값)
+    // 공유되는 대상 : 0은 쓰레드 대상, 나머지는 프로세스 대상
+    // 초기 값 : 여기에 접근 가능한 쓰레드 수. 모든 캐시 블럭에 대해서 1개의 쓰레드로 접근 가능하기 때문에 1로 초기화
+    sem_init(&cache.blocks[i].wMutex, 0, 1);
+    sem_init(&cache.blocks[i].rcMutex, 0, 1);
+  }
+  cache.bytes = 0;
+  sem_init(&cache.bodyMutex, 0, 1);
+}
+
+/* 캐싱되어있는지 확인 */
+int cache_isCached(char *request)
+{
+  for (int i = 0; i < CACHE_OBJS_COUNT; i++) // 모든 캐시 블럭을 돌아다니면서
+  {
+    startRead(i);                                                            // 각각 캐시블럭에 대해서 읽을 수 있는 타이밍에 읽기 시작해서
+    if (cache.blocks[i].isOccupied && !strcmp(request, cache.blocks[i].req)) // 캐싱되어있다면
+    {
+      lowerPriorty(i); // 찾은 캐시블럭의 우선순위를 상대적으로 높이기 위해 나머지 우선순위 낮춰주고
+      endRead(i);      // 읽기 종료해줘서 다른 쓰레드가 읽을 수 있게 해주고
 
       return i; // 찾은 캐싱된 위치의 인덱스 반환
     }
@@ -352,6 +2112,19 @@ int cache_isCached(char *request)
   return -1; // 아예 없으면 -1 반환
 }
 
+/* 캐시된 블럭을 찾아 읽기 lock을 잡고 반환. cache_isCached가 lock을 놓은 사이 evict/덮어쓰기/invalidate로 바뀌었으면 miss(-1)로 처리 */
+int cache_startHit(char *request)
+{
+  int i = cache_isCached(request);
+  if (i == -1)
+    return -1;
+  startRead(i);
+  if (cache.blocks[i].isOccupied && !strcmp(request, cache.blocks[i].req)) // 여전히 같은 요청이면 lock을 잡은 채로 반환
+    return i;
+  endRead(i);
+  return -1;
+}
+
 /* 캐싱 가능한 블럭 확인 */
 int cache_findCacheableBlock(void)
 {
@@ -373,23 +2146,208 @@ int cache_findCacheableBlock(void)
       endRead(i);                             // 읽기 종료하고
       continue;                               // 추가로 더 찾아보기
     }
-    endRead(i); // 점유되어있고, 우선순위도 높으면 그냥 읽기 종료하고 다음으로
+    endRead(i); // 점유되어있고, 우선순위도 높으면 그냥 읽기 종료하고 다음으로
+  }
+  return minIndex; // 찾은 인덱스 반환
+}
+
+void cache_cacheRequest(char *request, char *hdr, int hdrSize, hdr_meta *meta, char *bodyData, int bodySize) // 요청을 캐싱하기
+{
+  unsigned long hash = bodySize ? cache_hash(bodyData, bodySize) : 0; // 락 밖에서 hash 계산
+  cache_body *body = bodySize ? cache_findBody(hash, bodyData, bodySize) : NULL; // 같은 내용이 이미 있으면 그걸 공유
+
+  int i = cache_findCacheableBlock(); // 새로쓰거나 덮어쓸 수 있는 블럭 인덱스 찾고
+  startWrite(i);                      // 쓰기시작
+
+  if (cache.blocks[i].isOccupied) // 덮어쓰는 경우 원래 내용 반납
+  {
+    cache_releaseBody(cache.blocks[i].body);
+    P(&cache.bodyMutex);
+    cache.bytes -= cache.blocks[i].hdrSize;
+    V(&cache.bodyMutex);
+    Free(cache.blocks[i].hdr);
+  }
+  if (bodySize && !body && !(body = cache_insertBody(hash, bodyData, bodySize))) // 처음 보는 내용이면 새로 저장
+  {
+    cache.blocks[i].isOccupied = 0; // 저장할 자리가 없으면 캐싱하지 않음
+    cache.blocks[i].hdr = NULL;     // 위에서 반납한 내용을 가리키지 않게 비워줌
+    cache.blocks[i].hdrSize = 0;
+    cache.blocks[i].body = NULL;
+    endWrite(i);
+    return;
+  }
+
+  cache.blocks[i].isOccupied = 1;                  // 점유된 상태로 반영하고
+  strcpy(cache.blocks[i].req, request);            // 요청내용 저장
+  cache.blocks[i].hdr = Malloc(hdrSize);           // header는 블럭마다 따로 저장
+  memcpy(cache.blocks[i].hdr, hdr, hdrSize);
+  cache.blocks[i].hdrSize = hdrSize;
+  cache.blocks[i].meta = *meta;
+  cache.blocks[i].body = body;                     // body는 공유
+  cache.blocks[i].priority = LRU_MAGIC_NUMBER;     // 최고 우선순위 부여
+  P(&cache.bodyMutex);
+  cache.bytes += hdrSize;
+  V(&cache.bodyMutex);
+  lowerPriorty(i); // 나머지애들은 우선순위 낮춰주고
+
+  endWrite(i); // 읽기 종료 해줌
+
+  // 전체 크기가 MAX_CACHE_SIZE를 넘으면 방금 쓴 블럭 말고 우선순위 낮은 것부터 비움
+  while (1)
+  {
+    int victim = -1, minPriority = LRU_MAGIC_NUMBER + 1;
+    P(&cache.bodyMutex);
+    long bytes = cache.bytes;
+    V(&cache.bodyMutex);
+    if (bytes <= MAX_CACHE_SIZE)
+      break;
+    for (int j = 0; j < CACHE_OBJS_COUNT; j++)
+    {
+      startRead(j);
+      if (j != i && cache.blocks[j].isOccupied && cache.blocks[j].priority < minPriority)
+      {
+        victim = j;
+        minPriority = cache.blocks[j].priority;
+      }
+      endRead(j);
+    }
+    if (victim < 0)
+      break;
+    cache_evict(victim);
+  }
+}
+
+/* 블럭 비우기 */
+void cache_evict(int index)
+{
+  startWrite(index);
+  if (cache.blocks[index].isOccupied)
+  {
+    cache.blocks[index].isOccupied = 0;
+    cache_releaseBody(cache.blocks[index].body);
+    cache.blocks[index].body = NULL;
+    P(&cache.bodyMutex);
+    cache.bytes -= cache.blocks[index].hdrSize;
+    V(&cache.bodyMutex);
+    Free(cache.blocks[index].hdr);
+    cache.blocks[index].hdr = NULL;
+  }
+  endWrite(index);
+}
+
+/* path의 GET, HEAD 응답으로 캐싱해둔 것을 모두 비움 (큰 객체는 등록만 지우면 남은 segment는 더이상 찾지 않음) */
+void cache_invalidate(char *authority, char *path)
+{
+  char key[MAXLINE];
+  static const char *methods[] = {"GET", "HEAD"};
+  int i, m;
+
+  for (m = 0; m < 2; m++)
+  {
+    snprintf(key, MAXLINE, "%s %s%s", methods[m], authority, path);
+    if ((i = cache_isCached(key)) != -1) // 그 사이 다른 요청으로 바뀌었으면 그 블럭이 비워질 뿐 (다시 받아옴)
+      cache_evict(i);
+    negcache_remove(key);
+  }
+  snprintf(key, MAXLINE, "GET %s%s", authority, path);
+  P(&segCache.mutex);
+  for (i = 0; i < SEG_OBJS_COUNT; i++)
+  {
+    seg_object *obj = &segCache.objs[i];
+    if (obj->id && !strcmp(key, obj->req))
+    {
+      obj->id = 0;
+      Free(obj->hdr);
+      obj->hdr = NULL;
+    }
+  }
+  V(&segCache.mutex);
+}
+
+/* body 내용 hash - 8byte씩 곱셈/회전으로 섞는 빠른 비암호화 hash (같은지 확실히 하는건 memcmp로 함) */
+unsigned long cache_hash(char *data, int size)
+{
+  const unsigned long m1 = 0x9E3779B97F4A7C15UL, m2 = 0xC2B2AE3D27D4EB4FUL;
+  unsigned long h = size * m1, k;
+  int i;
+
+  for (i = 0; i + 8 <= size; i += 8)
+  {
+    memcpy(&k, data + i, 8);
+    k *= m2;
+    k = (k << 31) | (k >> 33);
+    h ^= k * m1;
+    h = ((h << 27) | (h >> 37)) * 5 + 0x52DCE729;
+  }
+  for (k = 0; i < size; i++) // 남은 byte
+    k = (k << 8) | (unsigned char)data[i];
+  h ^= k * m2;
+  h ^= h >> 33;
+  h *= m1;
+  h ^= h >> 29;
+  return h;
+}
+
+/* hash와 크기가 같고 내용도 같은 body가 있으면 refCnt 올리고 반환, 없으면 NULL */
+cache_body *cache_findBody(unsigned long hash, char *data, int size)
+{
+  cache_body *found = NULL;
+
+  P(&cache.bodyMutex);
+  for (int i = 0; i < CACHE_OBJS_COUNT; i++)
+  {
+    cache_body *body = &cache.bodies[i];
+    if (body->refCnt && body->hash == hash && body->size == size && !memcmp(body->data, data, size))
+    {
+      body->refCnt++;
+      found = body;
+      break;
+    }
   }
-  return minIndex; // 찾은 인덱스 반환
+  V(&cache.bodyMutex);
+  return found;
 }
 
-void cache_cacheRequest(char *request, char *object) // 요청을 캐싱하기
+/* 새 body를 빈 자리에 저장하고 반환 (refCnt 1) */
+cache_body *cache_insertBody(unsigned long hash, char *data, int size)
 {
-  int i = cache_findCacheableBlock(); // 새로쓰거나 덮어쓸 수 있는 블럭 인덱스 찾고
-  startWrite(i);                      // 쓰기시작
+  cache_body *body = NULL;
+  char *copy = Malloc(size); // 실제 크기만큼만 할당
+  memcpy(copy, data, size);
 
-  cache.blocks[i].isOccupied = 1;              // 점유된 상태로 반영하고
-  strcpy(cache.blocks[i].req, request);        // 요청내용 저장
-  strcpy(cache.blocks[i].obj, object);         // 오브젝트 저장
-  cache.blocks[i].priority = LRU_MAGIC_NUMBER; // 최고 우선순위 부여
-  lowerPriorty(i);                             // 나머지애들은 우선순위 낮춰주고
+  P(&cache.bodyMutex);
+  for (int i = 0; i < CACHE_OBJS_COUNT; i++)
+  {
+    if (!cache.bodies[i].refCnt)
+    {
+      body = &cache.bodies[i];
+      body->hash = hash;
+      body->data = copy;
+      body->size = size;
+      body->refCnt = 1;
+      cache.bytes += size;
+      break;
+    }
+  }
+  V(&cache.bodyMutex);
+  if (!body)
+    Free(copy);
+  return body;
+}
 
-  endWrite(i); // 읽기 종료 해줌
+/* body 참조 놓기. 아무도 가리키지 않으면 반납 */
+void cache_releaseBody(cache_body *body)
+{
+  if (!body)
+    return;
+  P(&cache.bodyMutex);
+  if (--body->refCnt == 0)
+  {
+    cache.bytes -= body->size;
+    Free(body->data);
+    body->data = NULL;
+  }
+  V(&cache.bodyMutex);
 }
 
 /* 읽을 수 있는지 확인 후 읽기 진입 */
@@ -440,4 +2398,753 @@ void lowerPriorty(int index)
       cache.blocks[i].priority--;   // 우선순위 낮춰주고
     endWrite(i);                    // 쓰기 끝
   }
-}
\ No newline at end of file
+}
+
+/* 큰 객체 응답. Range가 있으면 구간만, 없으면 전체를 segment 단위로 보내줌 */
+void serve_segmented(int fd, seg_stream *st, char *range)
+{
+  if (range[0] && serve_range(fd, st->hdr, &st->meta, st->total, range, seg_write, st))
+    return;
+  conn_write(fd, st->hdr, st->hdrSize);
+  seg_write(fd, st, 0, st->total - 1);
+}
+
+/* 열린 연결에서 body의 [first, last] 구간을 캐싱하지 않고 바로 써줌 (segment 하나를 다 채울 수 없는 206을 이어받았을 때). first 앞은 읽어서 버림 */
+static int seg_relay(int fd, seg_stream *st, long first, long last)
+{
+  long skip;
+  int len;
+
+  while ((skip = first - st->pos) > 0 || st->pos <= last)
+  {
+    len = skip > 0 ? (skip < SEGMENT_SIZE ? skip : SEGMENT_SIZE) : last - st->pos + 1;
+    if (rio_readnb(st->rio, st->segBuf, len) != len) // 중간에 끊기면 (RST 등) 받던 segment는 버리고 포기
+    {
+      curBackendResult = BACKEND_FAILED;
+      seg_closeStream(st);
+      return -1;
+    }
+    tw_touch(curTimer);
+    st->pos += len;
+    if (skip <= 0)
+      conn_write(fd, st->segBuf, len);
+  }
+  return 0;
+}
+
+/* body의 [first, last] 구간을 segment 단위로 써줌. 캐시에 있는 segment는 그대로, 없으면 서버에서 채워서 씀 */
+int seg_write(int fd, void *ctx, long first, long last)
+{
+  seg_stream *st = (seg_stream *)ctx;
+  long index, segStart, segEnd, from, to;
+  char *data;
+  int slot;
+
+  for (index = first / SEGMENT_SIZE; index <= last / SEGMENT_SIZE; index++)
+  {
+    segStart = index * SEGMENT_SIZE;
+    from = (first > segStart ? first : segStart) - segStart;                        // segment 안에서 쓸 시작 위치
+    to = (last < segStart + SEGMENT_SIZE - 1 ? last : segStart + SEGMENT_SIZE - 1) - segStart; // segment 안에서 쓸 끝 위치
+
+    if ((slot = segcache_pin(st->objId, index, &data)) >= 0) // 캐시에 있으면 교체되지 않게 잡고 써줌
+    {
+      conn_write(fd, data + from, to - from + 1);
+      segcache_unpin(slot);
+      continue;
+    }
+    // 열린 연결이 segment를 다 채울 수는 없지만 쓸 구간은 보내주면 (중간부터, 또는 중간까지 오는 206) 다시 요청하지 않고 바로 넘겨줌
+    segEnd = st->total - segStart < SEGMENT_SIZE ? st->total : segStart + SEGMENT_SIZE;
+    if (st->servfd >= 0 && (st->pos > segStart || segEnd > st->end) && st->pos <= segStart + from && segStart + to < st->end)
+    {
+      if (seg_relay(fd, st, segStart + from, segStart + to) < 0)
+        return -1;
+      continue;
+    }
+    if (seg_fill(st, index) < 0) // 없으면 서버에서 받아옴
+      return -1;
+    conn_write(fd, st->segBuf + from, to - from + 1);
+  }
+  return 0;
+}
+
+/* index번째 segment를 서버에서 받아서 st->segBuf에 채우고 캐싱함 */
+int seg_fill(seg_stream *st, long index)
+{
+  long segStart = index * SEGMENT_SIZE, k;
+  long segEnd = st->total - segStart < SEGMENT_SIZE ? st->total : segStart + SEGMENT_SIZE;
+  int len;
+
+  // 열린 연결이 없거나, 이미 지나간 위치거나, segment 경계가 아닌 곳을 읽고 있거나, 그 segment 끝까지 보내주지 않으면 해당 segment부터 다시 요청함
+  if ((st->servfd < 0 || st->pos > segStart || st->pos % SEGMENT_SIZE || segEnd > st->end) && seg_open(st, segStart) < 0)
+    return -1;
+
+  // origin이 Range를 무시하고 처음부터 보내는 경우, 앞 segment들도 읽는 김에 캐싱해둠
+  while (st->pos <= segStart)
+  {
+    k = st->pos / SEGMENT_SIZE;
+    len = st->total - st->pos < SEGMENT_SIZE ? st->total - st->pos : SEGMENT_SIZE;
+    if (rio_readnb(st->rio, st->segBuf, len) != len) // 중간에 끊기면 (RST 등) 받던 segment는 버리고 포기
+    {
+      curBackendResult = BACKEND_FAILED;
+      seg_closeStream(st);
+      return -1;
+    }
+    tw_touch(curTimer);
+    st->pos += len;
+    segcache_store(st->objId, k, st->segBuf, len);
+  }
+  return 0;
+}
+
+/* segStart부터 끝까지 endserver에 Range 요청을 보내고 response header를 읽어둠 */
+int seg_open(seg_stream *st, long segStart)
+{
+  char range[MAXLINE];
+  http_response resp;
+  long first = -1, total = -1;
+  char *hdr;
+
+  seg_closeStream(st);
+  if ((st->servfd = Open_endServer(st->hostname, st->port)) < 0)
+    return -1;
+  sprintf(range, "bytes=%ld-", segStart);
+  send_request(st->servfd, st->request_hdrs, range);
+
+  if (!st->own_rio)
+    st->own_rio = arena_alloc(st->arena, sizeof(rio_t));
+  st->rio = st->own_rio;
+  Rio_readinitb(st->rio, st->servfd);
+  if (read_response(st->rio, &resp, st->arena, &hdr) > 0) // header는 더 쓸 일이 없으므로 넘기기만 함
+  {
+    tw_phase(curTimer, TW_PHASE_IDLE, ROUTE_MS(idleMs, IDLE_TIMEOUT_MS));
+    first = resp.status == 206 ? resp.rangeFirst : 0;
+    total = resp.status == 206 ? resp.rangeTotal : resp.contentLength;
+  }
+
+  // 206이면 요청한 위치부터, 200이면 처음부터 받게 됨. 전체 크기가 다르면 객체가 바뀐 것이므로 포기
+  if ((resp.status != 200 && resp.status != 206) || total != st->total || (resp.status == 206 && first != segStart))
+  {
+    seg_closeStream(st);
+    return -1;
+  }
+  st->pos = first;
+  st->end = st->total;
+  return 0;
+}
+
+/* 큰 객체 전송 상태 초기화 (hdr, total, objId는 호출부에서 채움) */
+void seg_initStream(seg_stream *st, arena_t *arena, char *hostname, int port, char *request_hdrs)
+{
+  st->arena = arena;
+  st->hostname = hostname;
+  st->port = port;
+  st->request_hdrs = request_hdrs;
+  st->servfd = -1;
+  st->rio = st->own_rio = NULL;
+  st->pos = st->end = 0;
+  st->segBuf = arena_alloc(arena, SEGMENT_SIZE);
+}
+
+/* 열려있는 endserver 연결 닫기 */
+void seg_closeStream(seg_stream *st)
+{
+  if (st->servfd >= 0)
+    Close_endServer(st->servfd);
+  st->servfd = -1;
+}
+
+/* 큰 객체 전송 끝. 연결 닫음 (버퍼들은 요청이 끝날 때 arena와 같이 반납됨) */
+void seg_freeStream(seg_stream *st)
+{
+  seg_closeStream(st);
+}
+
+/* segment 캐시 초기화 */
+void segcache_init(void)
+{
+  memset(segCache.objs, 0, sizeof(segCache.objs));
+  memset(segCache.segs, 0, sizeof(segCache.segs));
+  segCache.nextId = 1;
+  Sem_init(&segCache.mutex, 0, 1);
+}
+
+/* 큰 객체가 등록되어있으면 header(arena에 복사)와 크기를 st에 복사하고 1 반환 */
+int segcache_findObject(char *request, seg_stream *st, arena_t *arena)
+{
+  int found = 0;
+
+  P(&segCache.mutex);
+  for (int i = 0; i < SEG_OBJS_COUNT; i++)
+  {
+    seg_object *obj = &segCache.objs[i];
+    if (obj->id && !strcmp(request, obj->req))
+    {
+      st->hdr = arena_alloc(arena, obj->hdrSize);
+      memcpy(st->hdr, obj->hdr, obj->hdrSize);
+      st->hdrSize = obj->hdrSize;
+      st->meta = obj->meta;
+      st->total = obj->total;
+      st->objId = obj->id;
+      segcache_touch(&obj->priority, 1);
+      found = 1;
+      break;
+    }
+  }
+  V(&segCache.mutex);
+  return found;
+}
+
+/* 큰 객체 등록. 같은 요청이 있거나 자리가 없으면 덮어쓰고, 새 객체 번호 반환 (예전 번호의 segment는 더이상 찾지 않음) */
+long segcache_addObject(char *request, char *hdr, int hdrSize, hdr_meta *meta)
+{
+  int i, idx = -1, empty = -1, minPriority = LRU_MAGIC_NUMBER + 1;
+  long id;
+
+  P(&segCache.mutex);
+  for (i = 0; i < SEG_OBJS_COUNT; i++)
+  {
+    seg_object *obj = &segCache.objs[i];
+    if (obj->id && !strcmp(request, obj->req)) // 같은 요청이 있으면 그 자리를 씀
+    {
+      idx = empty = i;
+      break;
+    }
+    if (!obj->id) // 빈 자리가 있으면 먼저 씀
+    {
+      if (empty < 0)
+        empty = i;
+    }
+    else if (obj->priority < minPriority)
+    {
+      idx = i;
+      minPriority = obj->priority;
+    }
+  }
+
+  seg_object *obj = &segCache.objs[empty >= 0 ? empty : idx];
+  if (obj->hdr)
+    Free(obj->hdr);
+  strcpy(obj->req, request);
+  obj->hdr = Malloc(hdrSize);
+  memcpy(obj->hdr, hdr, hdrSize);
+  obj->hdrSize = hdrSize;
+  obj->meta = *meta;
+  obj->total = meta->length;
+  obj->id = id = segCache.nextId++;
+  segcache_touch(&obj->priority, 1);
+  V(&segCache.mutex);
+  return id;
+}
+
+/* segment가 캐싱되어있으면 교체되지 않도록 잡고 slot 번호 반환, 없으면 -1 */
+int segcache_pin(long objId, long index, char **data)
+{
+  int slot = -1;
+
+  P(&segCache.mutex);
+  for (int i = 0; i < SEGMENT_COUNT; i++)
+  {
+    cache_segment *seg = &segCache.segs[i];
+    if (seg->objId == objId && seg->index == index)
+    {
+      seg->pinCnt++;
+      *data = seg->data;
+      memstat_add(MEM_PINS, seg->size);
+      segcache_touch(&seg->priority, 0);
+      slot = i;
+      break;
+    }
+  }
+  V(&segCache.mutex);
+  return slot;
+}
+
+/* 잡았던 segment 놓기 */
+void segcache_unpin(int slot)
+{
+  P(&segCache.mutex);
+  segCache.segs[slot].pinCnt--;
+  memstat_add(MEM_PINS, -segCache.segs[slot].size);
+  V(&segCache.mutex);
+}
+
+/* segment 캐싱하기. 빈 자리가 없으면 아무도 쓰고있지 않은 segment 중 LRU를 교체함 */
+void segcache_store(long objId, long index, char *data, int size)
+{
+  int i, idx = -1, empty = -1, minPriority = LRU_MAGIC_NUMBER + 1;
+  char *copy = Malloc(size); // 락 밖에서 실제 크기만큼만 할당해서 복사해둠
+  memcpy(copy, data, size);
+
+  P(&segCache.mutex);
+  for (i = 0; i < SEGMENT_COUNT; i++)
+  {
+    cache_segment *seg = &segCache.segs[i];
+    if (seg->objId == objId && seg->index == index) // 다른 쓰레드가 먼저 채웠으면 그대로 둠
+    {
+      idx = empty = -1;
+      break;
+    }
+    if (!seg->objId) // 빈 자리가 있으면 먼저 씀
+    {
+      if (empty < 0)
+        empty = i;
+    }
+    else if (!seg->pinCnt && seg->priority < minPriority)
+    {
+      idx = i;
+      minPriority = seg->priority;
+    }
+  }
+
+  if (empty >= 0)
+    idx = empty;
+  if (idx >= 0)
+  {
+    cache_segment *seg = &segCache.segs[idx];
+    if (seg->data)
+      Free(seg->data);
+    seg->objId = objId;
+    seg->index = index;
+    seg->data = copy;
+    seg->size = size;
+    seg->pinCnt = 0;
+    segcache_touch(&seg->priority, 0);
+    copy = NULL;
+  }
+  V(&segCache.mutex);
+
+  if (copy) // 캐싱하지 못했으면 반납
+    Free(copy);
+}
+
+/* 새로 쓴 객체/segment는 최고 우선순위로, 같은 목록의 나머지는 우선순위 낮추기 (segCache.mutex 잡은 상태에서 호출) */
+void segcache_touch(int *priority, int isObj)
+{
+  int i, cnt = isObj ? SEG_OBJS_COUNT : SEGMENT_COUNT;
+
+  for (i = 0; i < cnt; i++)
+  {
+    int *p = isObj ? &segCache.objs[i].priority : &segCache.segs[i].priority;
+    if (p != priority)
+      (*p)--;
+  }
+  *priority = LRU_MAGIC_NUMBER;
+}
+
+/* 실패 캐시 초기화 */
+void negcache_init(void)
+{
+  memset(negCache.entries, 0, sizeof(negCache.entries));
+  Sem_init(&negCache.mutex, 0, 1);
+}
+
+/* 아직 유효한 실패로 기억하고 있으면 1 반환. 저장해둔 응답이 있고 fd가 주어지면 클라이언트에 써줌 */
+int negcache_lookup(char *key, int fd)
+{
+  char resp[MAXBUF];
+  int respSize = -1;
+  time_t now = time(NULL);
+
+  P(&negCache.mutex);
+  for (int i = 0; i < NEG_CACHE_COUNT; i++)
+  {
+    neg_entry *e = &negCache.entries[i];
+    if (e->expires > now && !strcmp(key, e->key))
+    {
+      respSize = e->respSize;
+      if (e->resp)
+        memcpy(resp, e->resp, respSize); // 클라이언트에 쓰는 동안 락을 잡지 않도록 복사해둠
+      break;
+    }
+  }
+  V(&negCache.mutex);
+
+  if (respSize < 0)
+    return 0;
+  if (respSize > 0 && fd >= 0)
+    conn_write(fd, resp, respSize);
+  return 1;
+}
+
+/* 실패 기억하기. 같은 키가 있거나 만료된 자리가 있으면 거기에, 없으면 가장 먼저 만료될 자리에 덮어씀 */
+void negcache_add(char *key, char *resp, int respSize, int ttl)
+{
+  int idx = 0;
+  time_t now = time(NULL);
+  char *copy = NULL;
+
+  if (resp && respSize > 0)
+  {
+    copy = Malloc(respSize);
+    memcpy(copy, resp, respSize);
+  }
+
+  P(&negCache.mutex);
+  for (int i = 0; i < NEG_CACHE_COUNT; i++)
+  {
+    neg_entry *e = &negCache.entries[i];
+    if (e->expires && !strcmp(key, e->key))
+    {
+      idx = i;
+      break;
+    }
+    if (e->expires < negCache.entries[idx].expires)
+      idx = i;
+  }
+
+  neg_entry *e = &negCache.entries[idx];
+  if (e->resp)
+    Free(e->resp);
+  strcpy(e->key, key);
+  e->resp = copy;
+  e->respSize = copy ? respSize : 0;
+  e->expires = now + ttl;
+  V(&negCache.mutex);
+}
+
+/* 기억하던 실패 지우기 (없으면 아무것도 안 함) */
+void negcache_remove(char *key)
+{
+  P(&negCache.mutex);
+  for (int i = 0; i < NEG_CACHE_COUNT; i++)
+  {
+    neg_entry *e = &negCache.entries[i];
+    if (e->expires && !strcmp(key, e->key))
+      e->expires = 0;
+  }
+  V(&negCache.mutex);
+}
+
+/* prefetch 큐 초기화 및 쓰레드 생성 */
+void prefetch_init(void)
+{
+  pthread_t tid;
+
+  prefetchQueue.front = prefetchQueue.rear = 0;
+  Sem_init(&prefetchQueue.mutex, 0, 1);
+  Sem_init(&prefetchQueue.slots, 0, PREFETCH_QUEUE_SIZE);
+  Sem_init(&prefetchQueue.filled, 0, 0);
+  Pthread_create(&tid, &threadAttr, prefetch_thread, NULL);
+}
+
+/* 큐에서 하나씩 꺼내서 미리 받아오는 쓰레드. 클라이언트 요청 쓰레드보다 낮은 우선순위로 돌아감 */
+void *prefetch_thread(void *vargp)
+{
+  prefetch_item item;
+  tw_timer timer; // 클라이언트 없이 endserver 연결만 제한 시간 대상
+
+  Pthread_detach(pthread_self());
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), PREFETCH_NICE);
+  curTimer = &timer;
+  while (1)
+  {
+    P(&prefetchQueue.filled); // 쌓인 요청이 있을 때까지 기다림
+    P(&prefetchQueue.mutex);
+    prefetchQueue.front = (prefetchQueue.front + 1) % PREFETCH_QUEUE_SIZE;
+    item = prefetchQueue.items[prefetchQueue.front];
+    V(&prefetchQueue.mutex);
+    V(&prefetchQueue.slots);
+    tw_start(&timer, -1, REQUEST_TIMEOUT_MS);
+    prefetch_fetch(&item);
+    tw_stop(&timer);
+  }
+  return NULL;
+}
+
+/* text/html 응답이면 태그를 훑어서 같은 서버의 포함 객체(link는 href, 나머지는 src)를 큐에 넣음 */
+void prefetch_scan(char *hostname, int port, char *authority, char *path, char *hdr, hdr_meta *meta, char *body, int bodySize)
+{
+  char *p = body, *end = body + bodySize, *tagEnd, *q, *v;
+  char tag[16], url[MAXLINE], target[MAXLINE];
+  const char *attr;
+  int cnt = 0, len, i;
+
+  // Content-type이 text/html인지 확인 (미리 만들어둔 header에서 자리가 정해져 있음)
+  const char *ctype;
+  if (meta->lenOff == meta->ctypeOff ||
+      http_classify_line(hdr + meta->ctypeOff, meta->lenOff - meta->ctypeOff, &ctype) != HTTP_HDR_CONTENT_TYPE ||
+      strncasecmp(ctype, "text/html", 9))
+    return;
+
+  while (cnt < PREFETCH_PER_PAGE && p < end && (p = memchr(p, '<', end - p)))
+  {
+    // 태그 이름 읽기
+    for (p++, i = 0; p < end && isalpha((unsigned char)*p) && i < (int)sizeof(tag) - 1; p++)
+      tag[i++] = *p;
+    tag[i] = '\0';
+    tagEnd = memchr(p, '>', end - p);
+    if (!tagEnd)
+      break;
+    attr = strcasecmp(tag, "link") ? "src" : "href";
+    len = strlen(attr);
+
+    // 태그 안에서 속성 찾기 (앞이 공백이고 뒤에 = 가 오는 경우만)
+    for (q = p; q + len < tagEnd; q++)
+    {
+      if (!isspace((unsigned char)q[-1]) || strncasecmp(q, attr, len))
+        continue;
+      for (v = q + len; v < tagEnd && isspace((unsigned char)*v); v++)
+        ;
+      if (v >= tagEnd || *v != '=')
+        continue;
+      for (v++; v < tagEnd && isspace((unsigned char)*v); v++)
+        ;
+      char quote = (*v == '"' || *v == '\'') ? *v++ : 0;
+      for (i = 0; v < tagEnd && i < MAXLINE - 1 && (quote ? *v != quote : !isspace((unsigned char)*v)); v++)
+        url[i++] = *v;
+      url[i] = '\0';
+      if (prefetch_resolve(hostname, port, path, url, target))
+      {
+        prefetch_enqueue(hostname, port, authority, target);
+        cnt++;
+      }
+      break;
+    }
+    p = tagEnd + 1;
+  }
+}
+
+/* HTML(base 경로)에 적힌 url이 같은 서버의 객체면 요청할 경로를 path에 저장하고 1 반환 */
+int prefetch_resolve(char *hostname, int port, char *base, char *url, char *path)
+{
+  char tmp[MAXLINE], host2[MAXLINE], *ptr;
+  int port2;
+
+  if ((ptr = strchr(url, '#'))) // fragment 제거
+    *ptr = '\0';
+  if (!url[0] || strstr(url, ".."))
+    return 0;
+
+  if (!strncasecmp(url, "http://", 7) || !strncmp(url, "//", 2)) // 절대 주소는 같은 host:port만
+  {
+    snprintf(tmp, MAXLINE, "%s", url);
+    strcpy(path, "/");
+    parse_uri(tmp, host2, &port2, path);
+    return !strcasecmp(host2, hostname) && port2 == port;
+  }
+  ptr = strchr(url, ':');
+  if (ptr && (!strchr(url, '/') || ptr < strchr(url, '/'))) // https:, data:, javascript: 등은 건너뜀
+    return 0;
+
+  if (url[0] == '/') // 같은 서버의 절대 경로
+  {
+    strcpy(path, url);
+    return 1;
+  }
+
+  // 상대 경로는 base의 디렉토리 기준으로 붙여줌
+  snprintf(tmp, MAXLINE, "%s", base);
+  if ((ptr = strchr(tmp, '?')))
+    *ptr = '\0';
+  ptr = strrchr(tmp, '/');
+  if (ptr)
+    ptr[1] = '\0';
+  else
+    strcpy(tmp, "/");
+  if (strlen(tmp) + strlen(url) >= MAXLINE)
+    return 0;
+  sprintf(path, "%s%s", tmp, url);
+  return 1;
+}
+
+/* 큐에 넣기. 이미 같은 요청이 쌓여있거나 큐가 꽉 찼으면 버림 */
+void prefetch_enqueue(char *hostname, int port, char *authority, char *path)
+{
+  int i;
+
+  if (strlen(hostname) >= sizeof(prefetchQueue.items[0].hostname) || strlen(authority) >= sizeof(prefetchQueue.items[0].authority) ||
+      sem_trywait(&prefetchQueue.slots) < 0)
+    return;
+
+  P(&prefetchQueue.mutex);
+  for (i = prefetchQueue.front; i != prefetchQueue.rear;) // 꺼내지 않은 요청 중에 같은게 있는지 확인
+  {
+    i = (i + 1) % PREFETCH_QUEUE_SIZE;
+    if (prefetchQueue.items[i].port == port && !strcmp(prefetchQueue.items[i].path, path) && !strcmp(prefetchQueue.items[i].hostname, hostname) &&
+        !strcmp(prefetchQueue.items[i].authority, authority))
+    {
+      V(&prefetchQueue.mutex);
+      V(&prefetchQueue.slots);
+      return;
+    }
+  }
+  prefetchQueue.rear = (prefetchQueue.rear + 1) % PREFETCH_QUEUE_SIZE;
+  prefetch_item *item = &prefetchQueue.items[prefetchQueue.rear];
+  strcpy(item->hostname, hostname);
+  item->port = port;
+  strcpy(item->authority, authority);
+  strcpy(item->path, path);
+  V(&prefetchQueue.mutex);
+  V(&prefetchQueue.filled);
+}
+
+/* 서버에서 받아서 캐싱. MAX_OBJECT_SIZE를 넘으면 중간에 포기함 */
+void prefetch_fetch(prefetch_item *item)
+{
+  static char objBuf[MAX_OBJECT_SIZE]; // prefetch 쓰레드는 하나뿐이라 정적 버퍼 사용
+  static char hdrBlock[MAXBUF];
+  char request[MAXLINE], buf[MAXLINE];
+  int serverfd, status = 0, hdrSize, blockSize, n;
+  long size = -1;
+  http_response resp;
+  hdr_meta meta;
+  rio_t serv_rio;
+  char *hdr;
+
+  if (snprintf(request, MAXLINE, "GET %s%s", item->authority, item->path) >= MAXLINE) // 캐시 key 자리에 들어가지 않으면 건너뜀
+    return;
+  if (cache_isCached(request) != -1 || negcache_lookup(request, -1)) // 이미 있거나 최근에 없던 객체면 건너뜀
+    return;
+  if ((serverfd = Open_endServer(item->hostname, item->port)) < 0)
+    return;
+
+  // 클라이언트 요청과 같은 모양의 header로 요청 (실패해도 프로세스가 죽지 않도록 소문자 rio 함수 사용)
+  n = snprintf(buf, MAXLINE, request_hdr_fmt, "GET", item->path);
+  n += snprintf(buf + n, MAXLINE - n, "Host: %s\r\n%s%s%s%s", item->authority, conn_hdr, prox_conn_hdr, user_agent_hdr, endof_hdr);
+  if (n >= MAXLINE || rio_writen(serverfd, buf, n) != n)
+  {
+    Close_endServer(serverfd);
+    return;
+  }
+
+  rio_readinitb(&serv_rio, serverfd);
+  if ((hdrSize = read_response(&serv_rio, &resp, NULL, &hdr)) > 0) // rio 버퍼보다 큰 header는 받지 않음 (arena가 없음)
+  {
+    tw_phase(curTimer, TW_PHASE_IDLE, IDLE_TIMEOUT_MS);
+    memcpy(objBuf, hdr, hdrSize);
+    status = resp.status;
+    size = resp.contentLength;
+  }
+
+  // Content-length가 있고 버퍼에 다 들어가는 경우만 받아서, 200은 캐싱하고 404/410은 실패로 기억해둠
+  if (hdrSize < 0 || size < 0 || hdrSize + size > MAX_OBJECT_SIZE || rio_readnb(&serv_rio, objBuf + hdrSize, size) != size)
+    status = 0;
+  if (status == 200 && resp_storable(&resp) && (blockSize = hdr_build(hdrBlock, MAXBUF, objBuf, &resp, size, &meta)) > 0)
+    cache_cacheRequest(request, hdrBlock, blockSize, &meta, objBuf + hdrSize, size);
+  else if ((status == 404 || status == 410) && hdrSize + size <= MAXBUF)
+    negcache_add(request, objBuf, hdrSize + size, NEG_RESPONSE_TTL);
+  Close_endServer(serverfd);
+}
+
+/* 최고치 갱신 (다른 쓰레드가 더 큰 값을 썼으면 그대로 둠) */
+static void stat_max(long *peak, long value)
+{
+  long old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+  while (value > old && !__atomic_compare_exchange_n(peak, &old, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+/* 이 쓰레드(연결)가 잡은 메모리 변화 반영. 락 없이 atomic으로 더함 */
+void memstat_add(int kind, long delta)
+{
+  stat_max(&memStats.peak[kind], __atomic_add_fetch(&memStats.cur[kind], delta, __ATOMIC_RELAXED));
+  stat_max(&memStats.totalPeak, __atomic_add_fetch(&memStats.total, delta, __ATOMIC_RELAXED));
+  connMem += delta;
+  stat_max(&memStats.connPeak, connMem);
+}
+
+void memstat_buffers(long delta)
+{
+  memstat_add(MEM_BUFFERS, delta);
+}
+
+void memstat_conn(int delta)
+{
+  stat_max(&memStats.connsPeak, __atomic_add_fetch(&memStats.conns, delta, __ATOMIC_RELAXED));
+}
+
+/* body[len]부터 이어 쓰고 새 길이를 반환. 잘렸으면 MAXLINE - 1로 맞춰서 다음 쓰기의 위치와 크기가 버퍼를 넘지 않게 함 */
+static int memstat_printf(char *body, int len, const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  len += vsnprintf(body + len, MAXLINE - len, fmt, ap);
+  va_end(ap);
+  return len < MAXLINE ? len : MAXLINE - 1;
+}
+
+/* 집계를 text/plain 응답으로 보냄. stack은 실제로 쓴 양이 아니라 쓰레드마다 예약하는 크기 */
+void memstat_write(int fd)
+{
+  static const char *names[MEM_KINDS] = {"buffers", "pins", "pending"};
+  char body[MAXLINE], hdr[MAXLINE];
+  long conns = __atomic_load_n(&memStats.conns, __ATOMIC_RELAXED);
+  long connsPeak = __atomic_load_n(&memStats.connsPeak, __ATOMIC_RELAXED);
+  resolver_stats dns;
+  origin_stats org;
+  hedge_stats hdg;
+  tunnel_stats tun;
+  int len, k;
+
+  len = memstat_printf(body, 0, "%-20s %12s %12s\n", "", "current", "peak");
+  len = memstat_printf(body, len, "%-20s %12ld %12ld\n", "connections", conns, connsPeak);
+  len = memstat_printf(body, len, "%-20s %12ld %12ld\n", "stack (reserved)", conns * (long)threadStack, connsPeak * (long)threadStack);
+  for (k = 0; k < MEM_KINDS; k++)
+    len = memstat_printf(body, len, "%-20s %12ld %12ld\n", names[k],
+                         __atomic_load_n(&memStats.cur[k], __ATOMIC_RELAXED), __atomic_load_n(&memStats.peak[k], __ATOMIC_RELAXED));
+  len = memstat_printf(body, len, "%-20s %12ld %12ld\n", "total",
+                       __atomic_load_n(&memStats.total, __ATOMIC_RELAXED), __atomic_load_n(&memStats.totalPeak, __ATOMIC_RELAXED));
+  len = memstat_printf(body, len, "%-20s %12s %12ld\n", "per connection", "", __atomic_load_n(&memStats.connPeak, __ATOMIC_RELAXED));
+  len = memstat_printf(body, len, "stack size %zu bytes\n", threadStack);
+  resolver_getStats(&dns);
+  len = memstat_printf(body, len, "dns hits %ld, negative hits %ld, misses %ld, refreshes %ld\n",
+                       dns.hits, dns.negHits, dns.misses, dns.refreshes);
+  len = memstat_printf(body, len, "admitted %ld, shed (in-flight %ld, memory %ld, delay %ld), in-flight %ld/%ld\n",
+                       __atomic_load_n(&admit.admitted, __ATOMIC_RELAXED), __atomic_load_n(&admit.shed[ADMIT_SHED_INFLIGHT], __ATOMIC_RELAXED),
+                       __atomic_load_n(&admit.shed[ADMIT_SHED_MEMORY], __ATOMIC_RELAXED), __atomic_load_n(&admit.shed[ADMIT_SHED_DELAY], __ATOMIC_RELAXED),
+                       __atomic_load_n(&admit.inflight, __ATOMIC_RELAXED), maxInflight);
+  origin_getStats(&org);
+  len = memstat_printf(body, len, "origin queued %ld, timed out %ld, rejected %ld (limit %d per origin)\n",
+                       org.queued, org.timeouts, org.rejected, originMax);
+  hedge_getStats(&hdg);
+  len = memstat_printf(body, len, "hedged %ld (won %ld), connect retries %ld, over budget %ld\n",
+                       hdg.used[HEDGE_KIND_HEDGE], hdg.wins, hdg.used[HEDGE_KIND_RETRY], hdg.denied);
+  tunnel_getStats(&tun);
+  len = memstat_printf(body, len, "tunnels open %ld, total %ld, bytes up %ld, down %ld, copied without splice %ld\n",
+                       tun.active, tun.total, tun.bytes[TUNNEL_UP], tun.bytes[TUNNEL_DOWN], tun.copied);
+  len += rl_format(body + len, MAXLINE - len);
+  len += backend_format(body + len, MAXLINE - len);
+  len += route_format(body + len, MAXLINE - len);
+
+  snprintf(hdr, MAXLINE, "HTTP/1.0 200 OK\r\nContent-type: text/plain\r\nContent-length: %d\r\n\r\n", len);
+  conn_write(fd, hdr, strlen(hdr));
+  conn_write(fd, body, len);
+}
+
+/* 클라이언트에 쓰기. 쓰기가 끝날 때까지 (느린 클라이언트면 오래) 그 크기만큼 pending으로 집계함 */
+void conn_write(int fd, void *buf, size_t n)
+{
+  char *p = buf;
+
+  if (curLog)
+  {
+    // 처음 쓰는 status line에서 status를 읽어둠 (응답마다 어디서 만들었는지와 상관없이 보낸 그대로 기록)
+    if (!curLog->status && n >= 12 && !strncmp(p, "HTTP/1.", 7) && isdigit((unsigned char)p[9]))
+      curLog->status = atoi(p + 9);
+    curLog->bytes += n;
+  }
+  memstat_add(MEM_PENDING, n);
+  if (curTimer && rl_bytesLimited()) // 클라이언트 연결이면 byte 제한에 맞춰 나누어 씀
+  {
+    for (size_t off = 0, len; off < n; off += len)
+    {
+      // 기다리는 동안은 주고받는 게 없으므로 idle 제한 시간 (그리고 남은 전체 시간) 안에 차례가 와야 함
+      long maxWaitMs = curTimer->totalDeadline - tw_now();
+      if (curTimer->phase == TW_PHASE_IDLE && curTimer->idleMs < maxWaitMs)
+        maxWaitMs = curTimer->idleMs;
+      len = n - off < RL_CHUNK ? n - off : RL_CHUNK;
+      if (rl_bytes(curClient, curOriginHash, len, maxWaitMs, &curTimer->expired) < 0)
+      {
+        shutdown(fd, SHUT_RDWR); // 중간을 빼고 보낼 수는 없으므로 응답을 끝냄 (뒤의 쓰기도 모두 실패함)
+        break;
+      }
+      if (rio_writen(fd, p + off, len) != len)
+        break;
+      tw_touch(curTimer);
+    }
+  }
+  else if (rio_writen(fd, buf, n) == n && curTimer) // 클라이언트가 끊었거나 timer가 끊었으면 나머지 쓰기도 실패하고 끝남 (프로세스는 계속)
+    tw_touch(curTimer);
+  memstat_add(MEM_PENDING, -(long)n);
+}
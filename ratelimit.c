@@ -0,0 +1,171 @@
+/*
+ * ratelimit.c - token bucket 제한 (ratelimit.h 참고)
+ */
+#include "csapp.h"
+#include "ratelimit.h"
+
+static const char *names[RL_SETTINGS] = {"global_bps", "origin_bps", "client_bps", "origin_rps", "client_rps", "burst_ms"};
+
+static long settings[RL_SETTINGS]; // 제한 값 (실행 중에 바뀔 수 있으므로 atomic으로 읽고 씀)
+
+// bucket은 다음 token이 생기는 시각(ns) 하나. 서로 다른 cache line에 두지는 않음 (칸이 많아서 같은 줄을 같이 쓰는 일이 드묾)
+static long globalBytes;
+static long originBytes[RL_SLOTS], clientBytes[RL_SLOTS];
+static long originReqs[RL_SLOTS], clientReqs[RL_SLOTS];
+static long throttledReqs, delayedWrites; // 거절한 요청 수, 기다렸다가 쓴 횟수
+
+static long now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static long setting(int k)
+{
+  return __atomic_load_n(&settings[k], __ATOMIC_RELAXED);
+}
+
+void rl_init(void)
+{
+  settings[RL_BURST] = RL_BURST_MS;
+}
+
+int rl_set(const char *name, long value)
+{
+  for (int k = 0; k < RL_SETTINGS; k++)
+  {
+    if (strcmp(name, names[k]))
+      continue;
+    if (value < 0 || (k == RL_BURST && value == 0))
+      return -1;
+    __atomic_store_n(&settings[k], value, __ATOMIC_RELAXED);
+    return 0;
+  }
+  return -1;
+}
+
+int rl_parse(char *spec)
+{
+  char *item, *save, *eq, *end;
+  long value;
+  int rc = 0;
+
+  for (item = strtok_r(spec, "&,", &save); item; item = strtok_r(NULL, "&,", &save))
+  {
+    if (!(eq = strchr(item, '=')))
+    {
+      rc = -1;
+      continue;
+    }
+    *eq = '\0';
+    value = strtol(eq + 1, &end, 10);
+    if (end == eq + 1 || *end || rl_set(item, value) < 0)
+      rc = -1;
+  }
+  return rc;
+}
+
+int rl_format(char *buf, size_t size)
+{
+  int len = 0;
+
+  for (int k = 0; k < RL_SETTINGS && len < size; k++)
+    len += snprintf(buf + len, size - len, "%s=%ld\n", names[k], setting(k));
+  if (len < size)
+    len += snprintf(buf + len, size - len, "throttled requests %ld, delayed writes %ld\n",
+                    __atomic_load_n(&throttledReqs, __ATOMIC_RELAXED), __atomic_load_n(&delayedWrites, __ATOMIC_RELAXED));
+  return len < size ? len : size - 1; // 잘렸으면 쓴 만큼만
+}
+
+unsigned rl_hash(const char *s, int port)
+{
+  unsigned h = 2166136261u; // FNV-1a
+
+  for (; *s; s++)
+    h = (h ^ (unsigned char)tolower(*s)) * 16777619u;
+  return (h ^ port) * 16777619u;
+}
+
+/* GCRA. n 만큼 token을 쓰면 다음 token 시각이 얼마나 뒤로 가는지 계산해서, burst를 넘는 만큼이 기다릴 시간(ns).
+ * reserve면 넘더라도 예약해두고 (기다렸다가 씀), 아니면 넘을 때 예약하지 않고 기다릴 시간만 알려줌 */
+static long gcra(long *tat, long rate, long n, long now, int reserve)
+{
+  long old, next, wait;
+  long inc = (long)((double)n * 1e9 / rate);
+  long burst = setting(RL_BURST) * 1000000L;
+
+  old = __atomic_load_n(tat, __ATOMIC_RELAXED);
+  do
+  {
+    next = (old > now ? old : now) + inc;
+    wait = next - burst - now;
+    if (!reserve) // 확인만 함
+      return wait > 0 ? wait : 0;
+  } while (!__atomic_compare_exchange_n(tat, &old, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return wait > 0 ? wait : 0;
+}
+
+long rl_request(unsigned client, unsigned origin)
+{
+  long originRate = setting(RL_ORIGIN_RPS), clientRate = setting(RL_CLIENT_RPS);
+  long now, wait = 0;
+
+  if (!originRate && !clientRate)
+    return 0;
+  now = now_ns();
+  // 둘 다 통과할 때만 예약함 (한쪽에서 거절되면 다른 쪽 token을 쓰지 않음. 확인과 예약 사이에 다른 쓰레드가 끼어들면 조금 넘을 수 있음)
+  if (originRate)
+    wait = gcra(&originReqs[origin % RL_SLOTS], originRate, 1, now, 0);
+  if (!wait && clientRate)
+    wait = gcra(&clientReqs[client % RL_SLOTS], clientRate, 1, now, 0);
+  if (wait)
+  {
+    __atomic_fetch_add(&throttledReqs, 1, __ATOMIC_RELAXED);
+    return wait / 1000000 + 1;
+  }
+  if (originRate)
+    gcra(&originReqs[origin % RL_SLOTS], originRate, 1, now, 1);
+  if (clientRate)
+    gcra(&clientReqs[client % RL_SLOTS], clientRate, 1, now, 1);
+  return 0;
+}
+
+int rl_bytesLimited(void)
+{
+  return setting(RL_GLOBAL_BPS) || setting(RL_ORIGIN_BPS) || setting(RL_CLIENT_BPS);
+}
+
+/* 기다릴 시간이 maxWaitMs를 넘으면 예약하지 않고 -1 (그만큼 자는 동안 연결의 제한 시간이 지나버림).
+ * 기다리는 동안은 RL_SLEEP_MS씩 나누어 자고, 그 사이 *stop이 서면 (timer가 연결을 끊음) 바로 -1 */
+int rl_bytes(unsigned client, unsigned origin, size_t n, long maxWaitMs, const int *stop)
+{
+  long rate, now = now_ns(), wait = 0, w, until;
+  int reserve;
+
+  // 전체, origin, 클라이언트 순서로 먼저 확인만 해보고, 기다릴 수 있으면 각각 예약하고 가장 늦은 차례까지 기다림
+  for (reserve = 0; reserve < 2; reserve++)
+  {
+    if ((rate = setting(RL_GLOBAL_BPS)) && (w = gcra(&globalBytes, rate, n, now, reserve)) > wait)
+      wait = w;
+    if ((rate = setting(RL_ORIGIN_BPS)) && (w = gcra(&originBytes[origin % RL_SLOTS], rate, n, now, reserve)) > wait)
+      wait = w;
+    if ((rate = setting(RL_CLIENT_BPS)) && (w = gcra(&clientBytes[client % RL_SLOTS], rate, n, now, reserve)) > wait)
+      wait = w;
+    if (!reserve && maxWaitMs >= 0 && wait / 1000000 > maxWaitMs)
+      return -1;
+  }
+  if (wait <= 0)
+    return 0;
+
+  __atomic_fetch_add(&delayedWrites, 1, __ATOMIC_RELAXED);
+  until = now + wait;
+  while ((w = until - now_ns()) > 0)
+  {
+    if (stop && __atomic_load_n(stop, __ATOMIC_RELAXED))
+      return -1;
+    usleep((w < RL_SLEEP_MS * 1000000L ? w : RL_SLEEP_MS * 1000000L) / 1000);
+  }
+  return 0;
+}
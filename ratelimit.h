@@ -0,0 +1,39 @@
+/*
+ * ratelimit.h - 요청 수, 보내는 byte 수 제한 (전체 -> origin -> 클라이언트 순서의 token bucket)
+ *
+ * bucket 하나는 "다음 token이 생기는 시각"(GCRA의 TAT) 값 하나뿐이라 CAS 한번으로 갱신하고 락을 잡지 않음.
+ * origin, 클라이언트 bucket은 hash로 고른 고정 칸을 씀 (겹치면 같이 씀).
+ * 요청 수는 넘으면 바로 거절하고 (429), byte 수는 쓸 만큼 미리 예약하고 차례가 올 때까지 기다렸다가 씀.
+ * 제한 값은 실행 중에도 바꿀 수 있음 (rl_set). 0이면 제한 없음.
+ */
+#ifndef __RATELIMIT_H__
+#define __RATELIMIT_H__
+
+#include <stddef.h>
+
+#define RL_SLOTS 1024      // origin, 클라이언트 bucket 칸 수
+#define RL_BURST_MS 1000   // 기본 burst (이 시간 동안 쌓이는 만큼은 한번에 쓸 수 있음)
+#define RL_CHUNK 16384     // byte 제한이 있을 때 나누어 쓰는 크기 (한번에 오래 기다리지 않도록)
+#define RL_SLEEP_MS 100    // byte 제한으로 기다릴 때 한번에 자는 최대 시간 (사이마다 연결이 끊겼는지 확인)
+
+enum
+{
+  RL_GLOBAL_BPS = 0, // 전체 보내는 byte/s
+  RL_ORIGIN_BPS,     // origin 하나에 대해 보내는 byte/s
+  RL_CLIENT_BPS,     // 클라이언트 하나에게 보내는 byte/s
+  RL_ORIGIN_RPS,     // origin 하나에 대한 요청/s
+  RL_CLIENT_RPS,     // 클라이언트 하나의 요청/s
+  RL_BURST,          // burst (ms)
+  RL_SETTINGS
+};
+
+void rl_init(void);
+int rl_set(const char *name, long value);        // 이름으로 제한 값 바꾸기 (없는 이름이면 -1)
+int rl_parse(char *spec);                        // "name=value[&name=value...]" 또는 ','로 구분 (잘못된 항목이 있으면 -1)
+int rl_format(char *buf, size_t size);           // 지금 제한 값과 집계를 text로
+unsigned rl_hash(const char *s, int port);       // origin hash
+long rl_request(unsigned client, unsigned origin); // 요청 하나 (0이면 통과, 아니면 다시 시도할 때까지 ms)
+int rl_bytes(unsigned client, unsigned origin, size_t n, long maxWaitMs, const int *stop); // n byte를 보낼 차례가 올 때까지 기다림 (못 보내면 -1, maxWaitMs < 0, stop == NULL이면 확인 안 함)
+int rl_bytesLimited(void);                       // byte 제한이 하나라도 있는지
+
+#endif /* __RATELIMIT_H__ */
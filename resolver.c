@@ -0,0 +1,230 @@
+/*
+ * resolver.c - endserver 주소 조회 캐시 (resolver.h 참고)
+ */
+#include "csapp.h"
+#include "resolver.h"
+
+typedef struct
+{
+  char host[RESOLVER_HOST_MAX];
+  char port[NI_MAXSERV];
+  resolver_addr addrs[RESOLVER_MAX_ADDRS];
+  int naddrs;     // 주소 수 (0이면 조회 실패를 기억해둔 것)
+  time_t expires; // 만료 시각 (0이면 빈 자리)
+  time_t used;    // 마지막으로 쓴 시각 (꽉 찼을 때 버릴 자리 고르기)
+  int hot;        // 마지막 조회 이후 쓰였는지 (refresh 대상)
+  int refreshing; // refresh 쓰레드가 다시 조회하는 중
+} resolver_entry;
+
+static struct
+{
+  resolver_entry entries[RESOLVER_COUNT];
+  resolver_stats stats;
+  sem_t mutex;
+} rcache;
+
+static void *resolver_thread(void *vargp);
+
+void resolver_init(pthread_attr_t *attr)
+{
+  pthread_t tid;
+
+  memset(&rcache.entries, 0, sizeof(rcache.entries));
+  memset(&rcache.stats, 0, sizeof(rcache.stats));
+  Sem_init(&rcache.mutex, 0, 1);
+  Pthread_create(&tid, attr, resolver_thread, NULL);
+}
+
+/* getaddrinfo 결과를 addrs에 복사 (개수 반환, 조회 실패면 -2) */
+static int resolve(char *host, char *port, resolver_addr *addrs)
+{
+  struct addrinfo hints, *listp, *p;
+  int rc, n = 0;
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG; // open_clientfd와 같은 조건
+  if ((rc = getaddrinfo(host, port, &hints, &listp)) != 0)
+  {
+    fprintf(stderr, "getaddrinfo failed (%s:%s): %s\n", host, port, gai_strerror(rc));
+    return -2;
+  }
+  for (p = listp; p && n < RESOLVER_MAX_ADDRS; p = p->ai_next)
+  {
+    if (p->ai_addrlen > sizeof(addrs[n].addr))
+      continue;
+    addrs[n].family = p->ai_family;
+    addrs[n].socktype = p->ai_socktype;
+    addrs[n].protocol = p->ai_protocol;
+    addrs[n].addrlen = p->ai_addrlen;
+    memcpy(&addrs[n].addr, p->ai_addr, p->ai_addrlen);
+    n++;
+  }
+  freeaddrinfo(listp);
+  return n ? n : -2;
+}
+
+/* host:port 자리 찾기 (없으면 -1). mutex를 잡고 불러야 함 */
+static int find_entry(char *host, char *port)
+{
+  for (int i = 0; i < RESOLVER_COUNT; i++)
+  {
+    resolver_entry *e = &rcache.entries[i];
+    if (e->expires && !strcmp(e->host, host) && !strcmp(e->port, port))
+      return i;
+  }
+  return -1;
+}
+
+/* 조회 결과 저장. 같은 자리가 없으면 빈 자리, 만료된 자리, 가장 오래 안 쓴 자리 순으로 덮어씀. mutex를 잡고 불러야 함 */
+static void store_entry(char *host, char *port, resolver_addr *addrs, int n, time_t now)
+{
+  int idx = find_entry(host, port);
+  resolver_entry *e;
+
+  if (idx < 0)
+  {
+    idx = 0;
+    for (int i = 0; i < RESOLVER_COUNT; i++)
+    {
+      e = &rcache.entries[i];
+      if (e->expires <= now && !e->refreshing)
+      {
+        idx = i;
+        break;
+      }
+      if (e->used < rcache.entries[idx].used && !e->refreshing)
+        idx = i;
+    }
+  }
+  e = &rcache.entries[idx];
+  strcpy(e->host, host);
+  strcpy(e->port, port);
+  e->naddrs = n > 0 ? n : 0;
+  if (n > 0)
+    memcpy(e->addrs, addrs, n * sizeof(resolver_addr));
+  e->expires = now + (n > 0 ? RESOLVER_TTL : RESOLVER_NEG_TTL);
+  e->used = now;
+  e->hot = 0;
+}
+
+int resolver_lookup(char *host, char *port, resolver_addr *addrs)
+{
+  time_t now = time(NULL);
+  int idx, n = -1;
+
+  if (strlen(host) >= RESOLVER_HOST_MAX || strlen(port) >= NI_MAXSERV) // 너무 긴 이름은 기억하지 않음
+    return resolve(host, port, addrs);
+
+  P(&rcache.mutex);
+  if ((idx = find_entry(host, port)) >= 0 && rcache.entries[idx].expires > now)
+  {
+    resolver_entry *e = &rcache.entries[idx];
+    e->used = now;
+    e->hot = 1;
+    if ((n = e->naddrs) > 0)
+    {
+      memcpy(addrs, e->addrs, n * sizeof(resolver_addr));
+      rcache.stats.hits++;
+    }
+    else
+    {
+      n = -2;
+      rcache.stats.negHits++;
+    }
+  }
+  else
+    rcache.stats.misses++;
+  V(&rcache.mutex);
+  if (n != -1)
+    return n;
+
+  // 조회하는 동안은 락을 잡지 않음 (같은 이름을 동시에 처음 조회하면 둘 다 getaddrinfo를 부르지만 결과는 같음)
+  n = resolve(host, port, addrs);
+  P(&rcache.mutex);
+  store_entry(host, port, addrs, n, time(NULL));
+  V(&rcache.mutex);
+  return n;
+}
+
+int resolver_connect(char *host, char *port, int timeoutMs, struct sockaddr *avoid, socklen_t avoidLen)
+{
+  resolver_addr addrs[RESOLVER_MAX_ADDRS], tmp;
+  struct addrinfo list[RESOLVER_MAX_ADDRS];
+  int i, n;
+
+  if ((n = resolver_lookup(host, port, addrs)) < 0)
+    return -2;
+
+  // 피할 주소가 있으면 맨 뒤로 보냄 (다른 주소가 없으면 결국 같은 주소로 연결함)
+  for (i = 0; avoid && i < n - 1; i++)
+    if (addrs[i].addrlen == avoidLen && !memcmp(&addrs[i].addr, avoid, avoidLen))
+    {
+      tmp = addrs[i];
+      memmove(&addrs[i], &addrs[i + 1], (n - i - 1) * sizeof(resolver_addr));
+      addrs[n - 1] = tmp;
+      break;
+    }
+
+  // 기억해둔 주소들을 open_clientaddr가 받는 addrinfo 목록으로 엮음
+  memset(list, 0, n * sizeof(struct addrinfo));
+  for (i = 0; i < n; i++)
+  {
+    list[i].ai_family = addrs[i].family;
+    list[i].ai_socktype = addrs[i].socktype;
+    list[i].ai_protocol = addrs[i].protocol;
+    list[i].ai_addrlen = addrs[i].addrlen;
+    list[i].ai_addr = (SA *)&addrs[i].addr;
+    list[i].ai_next = i + 1 < n ? &list[i + 1] : NULL;
+  }
+  return open_clientaddr(list, timeoutMs);
+}
+
+void resolver_getStats(resolver_stats *stats)
+{
+  P(&rcache.mutex);
+  *stats = rcache.stats;
+  V(&rcache.mutex);
+}
+
+/* 1초마다 곧 만료될 자리 중 그동안 쓰인 이름을 다시 조회함. 실패하면 만료될 때까지 예전 주소를 그대로 씀 */
+static void *resolver_thread(void *vargp)
+{
+  char host[RESOLVER_HOST_MAX], port[NI_MAXSERV];
+  resolver_addr addrs[RESOLVER_MAX_ADDRS];
+  int i, n;
+
+  Pthread_detach(pthread_self());
+  while (1)
+  {
+    sleep(1);
+    for (i = 0; i < RESOLVER_COUNT; i++)
+    {
+      time_t now = time(NULL);
+      resolver_entry *e = &rcache.entries[i];
+
+      P(&rcache.mutex);
+      if (!e->hot || !e->naddrs || e->expires <= now || e->expires - now > RESOLVER_REFRESH_AHEAD)
+      {
+        V(&rcache.mutex);
+        continue;
+      }
+      e->refreshing = 1; // 조회하는 동안 다른 이름이 이 자리를 가져가지 않도록
+      strcpy(host, e->host);
+      strcpy(port, e->port);
+      V(&rcache.mutex);
+
+      n = resolve(host, port, addrs);
+
+      P(&rcache.mutex);
+      e->refreshing = 0;
+      if (n > 0)
+      {
+        store_entry(host, port, addrs, n, time(NULL));
+        rcache.stats.refreshes++;
+      }
+      V(&rcache.mutex);
+    }
+  }
+  return NULL;
+}
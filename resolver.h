@@ -0,0 +1,43 @@
+/*
+ * resolver.h - endserver 주소 조회 캐시 (getaddrinfo 앞에 둠)
+ *
+ * host:port로 조회한 주소 목록을 TTL 동안 기억해서, 같은 서버에 다시 연결할 때는 getaddrinfo를 부르지 않음.
+ * 조회 실패도 짧게 기억하고 (없는 이름을 매번 다시 묻지 않음), 자주 쓰는 이름은 만료되기 전에
+ * refresh 쓰레드가 미리 다시 조회해서 요청 쓰레드가 만료 때문에 기다리지 않게 함.
+ * getaddrinfo는 DNS 레코드의 TTL을 알려주지 않으므로 TTL은 정해둔 값을 씀.
+ */
+#ifndef __RESOLVER_H__
+#define __RESOLVER_H__
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#define RESOLVER_COUNT 64        // 기억할 수 있는 host:port 개수 (꽉 차면 가장 오래 안 쓴 것을 버림)
+#define RESOLVER_MAX_ADDRS 8     // host 하나에 대해 기억할 최대 주소 수
+#define RESOLVER_HOST_MAX 256    // 캐시할 hostname 최대 길이 (더 길면 캐시하지 않고 매번 조회)
+#define RESOLVER_TTL 60          // 조회 결과를 쓰는 시간 (초)
+#define RESOLVER_NEG_TTL 10      // 조회 실패를 기억하는 시간 (초)
+#define RESOLVER_REFRESH_AHEAD 10 // 만료 이 시간(초) 전부터, 그동안 쓰인 이름은 미리 다시 조회함
+
+typedef struct
+{
+  int family, socktype, protocol;
+  socklen_t addrlen;
+  struct sockaddr_storage addr;
+} resolver_addr;
+
+typedef struct
+{
+  long hits;      // 캐시에서 주소를 찾음
+  long negHits;   // 기억해둔 실패로 바로 실패
+  long misses;    // 요청 쓰레드가 getaddrinfo를 부름
+  long refreshes; // refresh 쓰레드가 미리 다시 조회함
+} resolver_stats;
+
+void resolver_init(pthread_attr_t *attr);                   // 캐시 초기화 및 refresh 쓰레드 생성
+int resolver_lookup(char *host, char *port, resolver_addr *addrs); // 주소 목록 (개수 반환, 조회 실패면 -2)
+int resolver_connect(char *host, char *port, int timeoutMs, struct sockaddr *avoid, socklen_t avoidLen); // 조회 후 연결 (timeoutMs 안에 못하면 실패. 조회 실패 -2, 연결 실패 -1). avoid 주소는 마지막에 시도
+void resolver_getStats(resolver_stats *stats);              // hit/miss 집계
+
+#endif /* __RESOLVER_H__ */
@@ -0,0 +1,355 @@
+/*
+ * route.c - host, path routing table (route.h 참고)
+ */
+#include "csapp.h"
+#include "route.h"
+
+#define HOST_END '|' // 정확히 같은 host 규칙의 끝 표시 (host에 올 수 없는 글자)
+
+// 압축한 radix trie의 node. 자식들은 node 배열에 연속으로, edge 첫 글자 순서로 둠
+typedef struct
+{
+  const char *label; // 부모에서 이 node로 오는 edge (규칙 문자열 안을 가리킴)
+  int labelLen;
+  int child, nchild; // 자식 node 범위
+  int value;         // 여기서 끝나는 key의 값 (없으면 -1)
+} trie_node;
+
+typedef struct
+{
+  trie_node *nodes; // nodes[0]이 root
+  int nnodes;
+} trie;
+
+typedef struct
+{
+  char *pattern;  // 파일에 적힌 host
+  char *hostKey;  // 뒤집은 host (suffix 규칙은 끝 표시 없음)
+  char *path;     // path prefix
+} route_rule;
+
+static route_rule rules[ROUTE_MAX];
+static route_policy policies[ROUTE_MAX];
+static int nrules;
+static trie hostTrie;   // 값은 host 항목 번호
+static trie *pathTries; // host 항목마다 (값은 규칙 번호)
+
+/* 정렬된 key[lo, hi) 중 앞 depth 글자가 같은 것들로 node n 아래를 채움 */
+static void trie_fill(trie *t, int n, char **keys, int *vals, int lo, int hi, int depth)
+{
+  int i, j, k, len, groups = 0;
+
+  t->nodes[n].value = -1;
+  if (lo < hi && !keys[lo][depth]) // 여기서 끝나는 key
+    t->nodes[n].value = vals[lo++];
+  for (i = lo; i < hi; i = j, groups++)
+    for (j = i; j < hi && keys[j][depth] == keys[i][depth]; j++)
+      ;
+  t->nodes[n].child = t->nnodes;
+  t->nodes[n].nchild = groups;
+  t->nnodes += groups;
+
+  // 첫 글자가 같은 묶음마다 edge 하나. 묶음의 처음과 끝 key가 같은 만큼을 edge로 (정렬되어 있으므로 묶음 전체의 공통 부분)
+  for (i = lo, k = t->nodes[n].child; i < hi; i = j, k++)
+  {
+    for (j = i; j < hi && keys[j][depth] == keys[i][depth]; j++)
+      ;
+    for (len = 1; keys[i][depth + len] && keys[i][depth + len] == keys[j - 1][depth + len]; len++)
+      ;
+    t->nodes[k].label = keys[i] + depth;
+    t->nodes[k].labelLen = len;
+    trie_fill(t, k, keys, vals, i, j, depth + len);
+  }
+}
+
+static char **sortKeys;
+
+static int key_cmp(const void *a, const void *b)
+{
+  return strcmp(sortKeys[*(int *)a], sortKeys[*(int *)b]);
+}
+
+/* 서로 다른 key n개로 trie 만들기 */
+static void trie_build(trie *t, char **keys, int *vals, int n)
+{
+  int *order = Malloc(n * sizeof(int) + 1);
+  char **k = Malloc(n * sizeof(char *) + 1);
+  int *v = Malloc(n * sizeof(int) + 1);
+  int i;
+
+  for (i = 0; i < n; i++)
+    order[i] = i;
+  sortKeys = keys;
+  qsort(order, n, sizeof(int), key_cmp);
+  for (i = 0; i < n; i++)
+  {
+    k[i] = keys[order[i]];
+    v[i] = vals[order[i]];
+  }
+  t->nodes = Malloc((2 * n + 1) * sizeof(trie_node)); // 갈라지는 곳마다 node가 하나씩 늘어남
+  t->nnodes = 1;
+  t->nodes[0].label = "";
+  t->nodes[0].labelLen = 0;
+  trie_fill(t, 0, k, v, 0, n, 0);
+  Free(order);
+  Free(k);
+  Free(v);
+}
+
+/* 가장 긴 prefix로 맞는 key의 값 (없으면 -1). 자식은 첫 글자로 이분 탐색 */
+static int trie_match(trie *t, const char *key, int keyLen)
+{
+  trie_node *node = &t->nodes[0], *next;
+  int pos = 0, best = t->nnodes ? node->value : -1;
+
+  while (pos < keyLen && node->nchild)
+  {
+    int lo = node->child, hi = node->child + node->nchild;
+    unsigned char c = key[pos];
+
+    next = NULL;
+    while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+      unsigned char m = t->nodes[mid].label[0];
+      if (m == c)
+      {
+        next = &t->nodes[mid];
+        break;
+      }
+      if (m < c)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (!next || next->labelLen > keyLen - pos || memcmp(next->label, key + pos, next->labelLen))
+      break;
+    pos += next->labelLen;
+    node = next;
+    if (node->value >= 0)
+      best = node->value;
+  }
+  return best;
+}
+
+/* host 규칙을 뒤집은 key로 ("*" -> "", "*.a.com" -> "moc.a.", "a.com" -> "moc.a|") */
+static char *host_key(char *pattern)
+{
+  int n, exact = 1, i;
+  char *key;
+
+  if (!strcmp(pattern, "*"))
+    return strdup("");
+  if (!strncmp(pattern, "*.", 2))
+  {
+    pattern++;
+    exact = 0;
+  }
+  n = strlen(pattern);
+  key = Malloc(n + 2);
+  for (i = 0; i < n; i++)
+    key[i] = tolower((unsigned char)pattern[n - 1 - i]);
+  if (exact)
+    key[n++] = HOST_END;
+  key[n] = '\0';
+  return key;
+}
+
+/* 규칙 한 줄의 옵션 하나 */
+static int parse_option(route_policy *p, char *opt)
+{
+  char *eq = strchr(opt, '='), *end, *colon;
+  long v;
+
+  if (!eq)
+    return -1;
+  *eq++ = '\0';
+  if (!strcmp(opt, "upstream"))
+  {
+    if (!strcmp(eq, "uri"))
+      p->upstream = ROUTE_UPSTREAM_URI;
+    else if (!strcmp(eq, "pool"))
+      p->upstream = ROUTE_UPSTREAM_POOL;
+    else
+    {
+      if (!(colon = strrchr(eq, ':')) || colon == eq || colon - eq >= ROUTE_HOST_MAX)
+        return -1;
+      v = strtol(colon + 1, &end, 10);
+      if (end == colon + 1 || *end || v <= 0 || v > 65535)
+        return -1;
+      memcpy(p->host, eq, colon - eq);
+      p->host[colon - eq] = '\0';
+      p->port = v;
+      p->upstream = ROUTE_UPSTREAM_HOST;
+    }
+    return 0;
+  }
+  if (!strcmp(opt, "cache"))
+  {
+    if (strcmp(eq, "on") && strcmp(eq, "off"))
+      return -1;
+    p->cache = !strcmp(eq, "on");
+    return 0;
+  }
+  v = strtol(eq, &end, 10);
+  if (end == eq || *end || v <= 0 || v > 3600000)
+    return -1;
+  if (!strcmp(opt, "first_byte_ms"))
+    p->firstByteMs = v;
+  else if (!strcmp(opt, "idle_ms"))
+    p->idleMs = v;
+  else
+    return -1;
+  return 0;
+}
+
+int route_load(char *file)
+{
+  char line[MAXLINE], *host, *path, *opt, *save, *hash;
+  char **hostKeys, **pathKeys;
+  int *vals, *ruleOf;
+  int lineNo = 0, nhosts = 0, i, j, g, n;
+  FILE *fp;
+
+  if (!(fp = fopen(file, "r")))
+  {
+    fprintf(stderr, "%s: %s\n", file, strerror(errno));
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp))
+  {
+    lineNo++;
+    if ((hash = strchr(line, '#')))
+      *hash = '\0';
+    if (!(host = strtok_r(line, " \t\r\n", &save)))
+      continue;
+    if (!(path = strtok_r(NULL, " \t\r\n", &save)) || path[0] != '/' || strlen(host) >= ROUTE_HOST_MAX ||
+        (host[0] == '*' && host[1] && host[1] != '.') || strchr(host, HOST_END))
+    {
+      fprintf(stderr, "%s:%d: expected <host> <path prefix> [options]\n", file, lineNo);
+      fclose(fp);
+      return -1;
+    }
+    if (nrules == ROUTE_MAX)
+    {
+      fprintf(stderr, "%s:%d: too many routes (max %d)\n", file, lineNo, ROUTE_MAX);
+      fclose(fp);
+      return -1;
+    }
+    for (i = 0; i < nrules; i++)
+      if (!strcasecmp(rules[i].pattern, host) && !strcmp(rules[i].path, path))
+        break;
+    if (i < nrules)
+    {
+      fprintf(stderr, "%s:%d: duplicate route %s %s\n", file, lineNo, host, path);
+      fclose(fp);
+      return -1;
+    }
+    route_policy *p = &policies[nrules];
+    memset(p, 0, sizeof(*p));
+    p->cache = 1;
+    while ((opt = strtok_r(NULL, " \t\r\n", &save)))
+      if (parse_option(p, opt) < 0)
+      {
+        fprintf(stderr, "%s:%d: invalid option %s\n", file, lineNo, opt);
+        fclose(fp);
+        return -1;
+      }
+    rules[nrules].pattern = strdup(host);
+    rules[nrules].hostKey = host_key(host);
+    rules[nrules].path = strdup(path);
+    nrules++;
+  }
+  fclose(fp);
+
+  // host 항목 (서로 다른 hostKey)
+  hostKeys = Malloc(nrules * sizeof(char *) + 1);
+  vals = Malloc(nrules * sizeof(int) + 1);
+  for (i = 0; i < nrules; i++)
+  {
+    for (j = 0; j < nhosts && strcmp(hostKeys[j], rules[i].hostKey); j++)
+      ;
+    if (j == nhosts)
+    {
+      hostKeys[nhosts] = rules[i].hostKey;
+      vals[nhosts] = nhosts;
+      nhosts++;
+    }
+  }
+  trie_build(&hostTrie, hostKeys, vals, nhosts);
+
+  // host 항목마다 path trie. 이 host를 포함하는 (hostKey가 prefix인) 규칙을 모두 넣고, 같은 path면 더 구체적인 host 규칙만 남김
+  pathTries = Malloc(nhosts * sizeof(trie) + 1);
+  pathKeys = Malloc(nrules * sizeof(char *) + 1);
+  ruleOf = Malloc(nrules * sizeof(int) + 1);
+  for (g = 0; g < nhosts; g++)
+  {
+    for (i = n = 0; i < nrules; i++)
+    {
+      if (strncmp(rules[i].hostKey, hostKeys[g], strlen(rules[i].hostKey)))
+        continue;
+      for (j = 0; j < n && strcmp(pathKeys[j], rules[i].path); j++)
+        ;
+      if (j < n && strlen(rules[ruleOf[j]].hostKey) >= strlen(rules[i].hostKey))
+        continue;
+      pathKeys[j] = rules[i].path;
+      ruleOf[j] = i;
+      if (j == n)
+        n++;
+    }
+    trie_build(&pathTries[g], pathKeys, ruleOf, n);
+  }
+  Free(hostKeys);
+  Free(vals);
+  Free(pathKeys);
+  Free(ruleOf);
+  return 0;
+}
+
+route_policy *route_lookup(char *host, char *path)
+{
+  char key[ROUTE_HOST_MAX + 1];
+  int n, i, g, r;
+  char *end;
+
+  if (!nrules)
+    return NULL;
+  // ":port"는 빼고 뒤집음 ("[::1]:80" 같은 IPv6 주소 안의 ':'는 남김)
+  n = strlen(host);
+  if ((end = strrchr(host, ':')) && !strchr(end, ']') && (host[0] != '[' || end[-1] == ']'))
+    n = end - host;
+  if (n >= ROUTE_HOST_MAX)
+    return NULL;
+  for (i = 0; i < n; i++)
+    key[i] = tolower((unsigned char)host[n - 1 - i]);
+  key[n++] = HOST_END;
+
+  if ((g = trie_match(&hostTrie, key, n)) < 0 || (r = trie_match(&pathTries[g], path, strlen(path))) < 0)
+    return NULL;
+  __atomic_fetch_add(&policies[r].hits, 1, __ATOMIC_RELAXED);
+  return &policies[r];
+}
+
+int route_count(void)
+{
+  return nrules;
+}
+
+int route_format(char *buf, size_t size)
+{
+  static const char *upstreams[] = {"uri", "pool", "host"};
+  route_policy *p;
+  int len = 0;
+
+  for (int i = 0; i < nrules && len < size; i++)
+  {
+    p = &policies[i];
+    if (p->upstream == ROUTE_UPSTREAM_HOST)
+      len += snprintf(buf + len, size - len, "route %s %s -> %s:%d", rules[i].pattern, rules[i].path, p->host, p->port);
+    else
+      len += snprintf(buf + len, size - len, "route %s %s -> %s", rules[i].pattern, rules[i].path, upstreams[p->upstream]);
+    if (len < size)
+      len += snprintf(buf + len, size - len, "%s, hits %ld\n", p->cache ? "" : " (no cache)", __atomic_load_n(&p->hits, __ATOMIC_RELAXED));
+  }
+  return len < size ? len : size - 1; // 잘렸으면 쓴 만큼만
+}
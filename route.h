@@ -0,0 +1,46 @@
+/*
+ * route.h - host, path로 요청마다 upstream과 정책을 고르는 routing table
+ *
+ * 시작할 때 규칙 파일(-R)을 읽어서 압축한 radix trie 두 단계로 만들어둠.
+ *   host trie : host를 뒤집은 문자열 ("a.example.com" -> "moc.elpmaxe.a") 위에서 가장 긴 prefix를 찾음.
+ *               그래서 "*.example.com" 같은 suffix 규칙이 prefix 규칙이 됨. 정확히 같은 host는 끝 표시('|')까지 맞아야 함
+ *   path trie : host 항목마다 하나. 가장 긴 path prefix를 찾음
+ * 덜 구체적인 host의 규칙은 만들 때 더 구체적인 host의 path trie에 미리 합쳐둠. 그래서 찾을 때는 host 한번,
+ * path 한번 내려가기만 하고 (key 길이에 비례), 할당하지 않으며, 규칙 수와 상관없음.
+ * 고르는 순서: 가장 긴 path prefix, 같으면 더 구체적인 host.
+ *
+ * 규칙 파일 한 줄: <host> <path prefix> [upstream=uri|pool|host:port] [cache=on|off] [first_byte_ms=N] [idle_ms=N]
+ *   host는 "*" (모두), "*.example.com" (하위 도메인), "example.com" (정확히) 중 하나. '#' 뒤는 주석
+ */
+#ifndef __ROUTE_H__
+#define __ROUTE_H__
+
+#include <stddef.h>
+
+#define ROUTE_MAX 1024      // 최대 규칙 수
+#define ROUTE_HOST_MAX 256  // host 최대 길이
+
+enum
+{
+  ROUTE_UPSTREAM_URI = 0, // 요청 URI의 host (기본)
+  ROUTE_UPSTREAM_POOL,    // backend pool (-b)
+  ROUTE_UPSTREAM_HOST     // 정해둔 host:port
+};
+
+typedef struct
+{
+  int upstream;               // ROUTE_UPSTREAM_*
+  char host[ROUTE_HOST_MAX];  // ROUTE_UPSTREAM_HOST일 때
+  int port;
+  int cache;                  // 0이면 캐시에서 찾지도, 저장하지도 않음
+  int firstByteMs;            // 응답 header를 기다리는 시간 (0이면 기본값)
+  int idleMs;                 // body를 주고받다가 멈춰있을 수 있는 시간 (0이면 기본값)
+  long hits;                  // 이 규칙으로 고른 요청 수
+} route_policy;
+
+int route_load(char *path);                      // 규칙 파일 읽고 trie 만들기 (잘못되면 stderr에 쓰고 -1)
+route_policy *route_lookup(char *host, char *path); // 맞는 규칙 (없으면 NULL). host에 ":port"가 붙어있어도 됨
+int route_count(void);
+int route_format(char *buf, size_t size);        // 규칙별 사용 수를 text로
+
+#endif /* __ROUTE_H__ */
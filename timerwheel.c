@@ -0,0 +1,220 @@
+/*
+ * timerwheel.c - 연결별 단계 제한 시간 (timerwheel.h 참고)
+ */
+#include "csapp.h"
+#include "timerwheel.h"
+
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_MASK (TW_SLOTS - 1)
+
+static struct
+{
+  tw_timer slots[TW_LEVELS][TW_SLOTS]; // 칸마다 목록의 머리 (비어있으면 자기 자신을 가리킴)
+  long now;                            // 마지막으로 처리한 tick
+  long base;                           // tick 0의 시각 (ms)
+  sem_t mutex;
+} wheel;
+
+static void *tw_thread(void *vargp);
+
+long tw_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+void tw_init(pthread_attr_t *attr)
+{
+  pthread_t tid;
+
+  for (int l = 0; l < TW_LEVELS; l++)
+    for (int i = 0; i < TW_SLOTS; i++)
+      wheel.slots[l][i].next = wheel.slots[l][i].prev = &wheel.slots[l][i];
+  wheel.base = tw_now();
+  wheel.now = 0;
+  Sem_init(&wheel.mutex, 0, 1);
+  Pthread_create(&tid, attr, tw_thread, NULL);
+}
+
+/* 만료 tick에 맞는 단계, 칸에 넣음. mutex를 잡고 불러야 함 */
+static void tw_link(tw_timer *t)
+{
+  long delta = t->expires - wheel.now;
+  tw_timer *head;
+  int l;
+
+  if (delta < 1)
+    t->expires = wheel.now + (delta = 1); // 이미 지났으면 다음 tick에
+  for (l = 0; l < TW_LEVELS - 1 && delta >= 1L << (TW_BITS * (l + 1)); l++)
+    ;
+  if (delta >= 1L << (TW_BITS * TW_LEVELS)) // 가장 먼 단계보다 멀면 끝 칸에 두고 내려올 때 다시 확인
+    t->expires = wheel.now + (1L << (TW_BITS * TW_LEVELS)) - 1;
+  head = &wheel.slots[l][(t->expires >> (TW_BITS * l)) & TW_MASK];
+  t->next = head->next;
+  t->prev = head;
+  head->next->prev = t;
+  head->next = t;
+}
+
+static void tw_unlink(tw_timer *t)
+{
+  if (!t->prev)
+    return;
+  t->prev->next = t->next;
+  t->next->prev = t->prev;
+  t->next = t->prev = NULL;
+}
+
+/* 지금 단계에서 가장 먼저 끝나야 하는 시각 (ms) */
+static long tw_deadline(tw_timer *t)
+{
+  long d = t->phaseDeadline;
+
+  if (t->phase == TW_PHASE_IDLE)
+    d = __atomic_load_n(&t->lastActive, __ATOMIC_RELAXED) + t->idleMs;
+  return d < t->totalDeadline ? d : t->totalDeadline;
+}
+
+/* 다시 걸기. mutex를 잡고 불러야 함 */
+static void tw_arm(tw_timer *t)
+{
+  tw_unlink(t);
+  t->expires = (tw_deadline(t) - wheel.base + TW_TICK_MS - 1) / TW_TICK_MS;
+  tw_link(t);
+}
+
+void tw_start(tw_timer *t, int clientfd, int totalMs)
+{
+  long now = tw_now();
+
+  t->next = t->prev = NULL;
+  t->clientfd = clientfd;
+  t->serverfd = -1;
+  t->expired = 0;
+  t->idleMs = 0;
+  t->phase = TW_PHASE_HEADER;
+  t->lastActive = now;
+  t->totalDeadline = now + totalMs;
+  t->phaseDeadline = t->totalDeadline;
+}
+
+void tw_phase(tw_timer *t, int phase, int ms)
+{
+  long now = tw_now();
+
+  P(&wheel.mutex);
+  t->phase = phase;
+  t->phaseDeadline = now + ms;
+  t->idleMs = ms;
+  t->lastActive = now;
+  if (!t->expired) // 이미 만료된 연결은 다시 걸지 않음 (소켓이 이미 닫혀있음)
+    tw_arm(t);
+  V(&wheel.mutex);
+}
+
+void tw_touch(tw_timer *t)
+{
+  __atomic_store_n(&t->lastActive, tw_now(), __ATOMIC_RELAXED);
+}
+
+void tw_total(tw_timer *t, int ms)
+{
+  P(&wheel.mutex);
+  t->totalDeadline = tw_now() + ms;
+  if (!t->expired)
+    tw_arm(t);
+  V(&wheel.mutex);
+}
+
+void tw_server(tw_timer *t, int fd)
+{
+  P(&wheel.mutex);
+  t->serverfd = fd;
+  if (fd >= 0 && t->expired) // 만료된 다음에 연 연결도 바로 끊음
+    shutdown(fd, SHUT_RDWR);
+  V(&wheel.mutex);
+}
+
+void tw_stop(tw_timer *t)
+{
+  P(&wheel.mutex);
+  tw_unlink(t);
+  t->clientfd = t->serverfd = -1;
+  V(&wheel.mutex);
+}
+
+/* 만료 확인. idle 단계에서 그 사이 주고받은 게 있으면 늦춰서 다시 걸고, 아니면 소켓을 끊음. mutex를 잡고 불러야 함 */
+static void tw_fire(tw_timer *t, long nowMs)
+{
+  if (tw_deadline(t) > nowMs)
+  {
+    tw_arm(t);
+    return;
+  }
+  t->expired = t->phase + 1;
+  if (t->totalDeadline > nowMs && t->phase == TW_PHASE_HEADER) // 읽기만 끊어서 408을 보낼 수 있게 함
+  {
+    if (t->clientfd >= 0)
+      shutdown(t->clientfd, SHUT_RD);
+    return;
+  }
+  if (t->clientfd >= 0 && (t->totalDeadline <= nowMs || t->phase == TW_PHASE_IDLE)) // endserver만 늦으면 클라이언트에는 504를 보낼 수 있게 둠
+    shutdown(t->clientfd, SHUT_RDWR);
+  if (t->serverfd >= 0)
+    shutdown(t->serverfd, SHUT_RDWR);
+}
+
+/* 한 tick 진행. 가장 아래 단계가 한바퀴 돌면 위 단계의 다음 칸을 내려보냄. mutex를 잡고 불러야 함 */
+static void tw_tick(long nowMs)
+{
+  tw_timer *head, *t, list;
+  int l;
+
+  wheel.now++;
+  for (l = 1; l < TW_LEVELS && !((wheel.now >> (TW_BITS * (l - 1))) & TW_MASK); l++)
+  {
+    head = &wheel.slots[l][(wheel.now >> (TW_BITS * l)) & TW_MASK];
+    while ((t = head->next) != head)
+    {
+      tw_unlink(t);
+      tw_link(t);
+    }
+  }
+
+  // 만료된 칸을 떼어낸 다음 처리함 (처리하면서 다시 거는 timer가 같은 칸에 들어갈 수 있음)
+  head = &wheel.slots[0][wheel.now & TW_MASK];
+  if (head->next == head)
+    return;
+  list.next = head->next;
+  list.prev = head->prev;
+  list.next->prev = list.prev->next = &list;
+  head->next = head->prev = head;
+  while ((t = list.next) != &list)
+  {
+    tw_unlink(t);
+    if (t->expires > wheel.now) // 아래로 내려오지 못하고 끝 칸에 있던 먼 timer
+      tw_link(t);
+    else
+      tw_fire(t, nowMs);
+  }
+}
+
+/* TW_TICK_MS마다 깨어나서 지난 tick을 모두 처리함 */
+static void *tw_thread(void *vargp)
+{
+  long nowMs;
+
+  Pthread_detach(pthread_self());
+  while (1)
+  {
+    usleep(TW_TICK_MS * 1000);
+    nowMs = tw_now();
+    P(&wheel.mutex);
+    while (wheel.now < (nowMs - wheel.base) / TW_TICK_MS)
+      tw_tick(nowMs);
+    V(&wheel.mutex);
+  }
+  return NULL;
+}
@@ -0,0 +1,51 @@
+/*
+ * timerwheel.h - 연결별 단계 제한 시간 (모든 연결이 같이 쓰는 계층 timer wheel)
+ *
+ * 요청 쓰레드는 blocking read/write를 그대로 쓰고, 연결마다 timer 하나를 wheel에 걸어둠.
+ * timer 쓰레드가 TW_TICK_MS마다 wheel을 돌리다가 시간이 지난 연결의 소켓을 shutdown해서,
+ * 막혀있던 read/write가 EOF/에러로 돌아오게 함 (쓰레드가 끝없이 붙잡혀 있지 않음).
+ * 걸기, 빼기, 만료 처리는 모두 O(1)이고, 먼 만료 시각은 위 단계에 두었다가 가까워지면 내려옴.
+ * body 전송 중의 idle 제한은 주고받을 때마다 시각만 기록하고 (락 없음), 만료될 때 다시 확인해서 늦춤.
+ */
+#ifndef __TIMERWHEEL_H__
+#define __TIMERWHEEL_H__
+
+#include <pthread.h>
+
+#define TW_TICK_MS 100 // wheel 한 칸 시간 (제한 시간 정밀도)
+#define TW_BITS 6      // 단계마다 칸 수 (2^TW_BITS)
+#define TW_LEVELS 3    // 단계 수 (100ms * 64^3 = 약 7시간까지)
+
+// 연결 처리 단계
+enum
+{
+  TW_PHASE_HEADER = 0, // 클라이언트 요청 header 받기
+  TW_PHASE_CONNECT,    // endserver 연결
+  TW_PHASE_FIRST_BYTE, // 요청을 보내고 응답 header 받기
+  TW_PHASE_IDLE,       // body 주고받기 (주고받는 게 멈춘 시간 제한)
+  TW_PHASES
+};
+
+typedef struct tw_timer
+{
+  struct tw_timer *next, *prev; // 걸려있는 칸의 목록 (prev가 NULL이면 걸려있지 않음)
+  long expires;                 // 다시 확인할 tick
+  long phaseDeadline;           // 지금 단계가 끝나야 하는 시각 (ms)
+  long totalDeadline;           // 요청 전체가 끝나야 하는 시각 (ms)
+  long lastActive;              // idle 단계에서 마지막으로 주고받은 시각 (ms, 락 없이 씀)
+  int idleMs;                   // idle 단계 제한 시간
+  int phase;                    // TW_PHASE_*
+  int clientfd, serverfd;       // 만료되면 shutdown할 소켓 (-1이면 없음)
+  int expired;                  // 만료된 단계 + 1 (0이면 아직 안 됨)
+} tw_timer;
+
+void tw_init(pthread_attr_t *attr);                    // wheel 초기화 및 timer 쓰레드 생성
+void tw_start(tw_timer *t, int clientfd, int totalMs); // 새 연결 (HEADER 단계는 tw_phase로 따로 걺)
+void tw_phase(tw_timer *t, int phase, int ms);         // 단계 바꾸고 그 단계 제한 시간 걺
+void tw_touch(tw_timer *t);                            // idle 단계에서 주고받은 게 있음 (락 없음)
+void tw_total(tw_timer *t, int ms);                    // 전체 제한 시간을 지금부터 ms로 다시 정함 (터널처럼 오래 열어두는 연결)
+void tw_server(tw_timer *t, int fd);                   // endserver 소켓 등록 (닫기 전에 -1로 빼야 함)
+void tw_stop(tw_timer *t);                             // 연결 끝 (소켓을 닫기 전에 불러야 함)
+long tw_now(void);                                     // 지금 시각 (ms, CLOCK_MONOTONIC)
+
+#endif /* __TIMERWHEEL_H__ */
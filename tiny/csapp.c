@@ -806,18 +806,11 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 /* $end rio_writen */
 
 /*
- * rio_read - This is a wrapper for the Unix read() function that
- *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
- *    buffer, where n is the number of bytes requested by the user and
- *    rio_cnt is the number of unread bytes in the internal buffer. On
- *    entry, rio_read() refills the internal buffer via a call to
- *    read() if the internal buffer is empty.
+ * rio_fill - Refill the internal buffer with a call to read() if it is
+ *    empty. Returns the number of unread bytes, 0 on EOF, -1 on error.
  */
-/* $begin rio_read */
-static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
+static ssize_t rio_fill(rio_t *rp)
 {
-    int cnt;
-
     while (rp->rio_cnt <= 0)
     { /* Refill if buf is empty */
         rp->rio_cnt = read(rp->rio_fd, rp->rio_buf,
@@ -832,6 +825,24 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
         else
             rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
     }
+    return rp->rio_cnt;
+}
+
+/*
+ * rio_read - This is a wrapper for the Unix read() function that
+ *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
+ *    buffer, where n is the number of bytes requested by the user and
+ *    rio_cnt is the number of unread bytes in the internal buffer. On
+ *    entry, rio_read() refills the internal buffer via a call to
+ *    read() if the internal buffer is empty.
+ */
+/* $begin rio_read */
+static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
+{
+    int cnt;
+
+    if ((cnt = rio_fill(rp)) <= 0)
+        return cnt;
 
     /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
     cnt = n;
@@ -880,37 +891,39 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 /* $end rio_readnb */
 
 /*
- * rio_readlineb - Robustly read a text line (buffered)
+ * rio_readlineb - Robustly read a text line (buffered). Instead of
+ *    moving one byte at a time, find the newline in the internal buffer
+ *    with memchr() and copy everything up to it in one memcpy().
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
+    size_t n = 0, cnt;
+    ssize_t rc;
+    char *bufp = usrbuf, *nl = NULL;
 
-    for (n = 1; n < maxlen; n++)
+    while (!nl && n + 1 < maxlen)
     {
-        if ((rc = rio_read(rp, &c, 1)) == 1)
-        {
-            *bufp++ = c;
-            if (c == '\n')
-            {
-                n++;
-                break;
-            }
-        }
-        else if (rc == 0)
-        {
-            if (n == 1)
-                return 0; /* EOF, no data read */
-            else
-                break; /* EOF, some data was read */
-        }
-        else
+        if ((rc = rio_fill(rp)) < 0)
             return -1; /* Error */
+        else if (rc == 0)
+            break; /* EOF */
+
+        /* Copy up to and including the newline, or as much as fits */
+        cnt = maxlen - 1 - n;
+        if (rp->rio_cnt < cnt)
+            cnt = rp->rio_cnt;
+        if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+            cnt = nl - rp->rio_bufptr + 1;
+        memcpy(bufp, rp->rio_bufptr, cnt);
+        rp->rio_bufptr += cnt;
+        rp->rio_cnt -= cnt;
+        bufp += cnt;
+        n += cnt;
     }
-    *bufp = 0;
-    return n - 1;
+    if (maxlen > 0)
+        *bufp = 0;
+    return n;
 }
 /* $end rio_readlineb */
 
@@ -41,7 +41,7 @@ int main(int argc, char **argv)
     connfd = Accept(listenfd, (SA *)&clientaddr,
                     &clientlen); // line:netp:tiny:accept
     Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,
-                0);
+                NI_NUMERICHOST | NI_NUMERICSERV); // 숫자로만 바꿈 (역방향 DNS 조회로 다음 연결을 막지 않도록)
     printf("Accepted connection from (%s, %s)\n", hostname, port);
     doit(connfd);  // line:netp:tiny:doit
     Close(connfd); // line:netp:tiny:close
@@ -131,11 +131,13 @@ void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longms
 void read_requesthdrs(rio_t *rp) // 호출부에서 이미 init한 상태로 rio_t 구조체를 넘겨줌
 {
   char buf[MAXLINE];
+  ssize_t n;
 
-  Rio_readlineb(rp, buf, MAXLINE); // buf에서 한 줄 읽음
-  while (strcmp(buf, "\r\n"))      // 읽은 한 줄이 \r\n과 같은지 비교. 같지 않은 동안 반복
+  // 빈 줄("\r\n" 또는 "\n")이 나올 때까지 읽음. 길이로 먼저 걸러서 줄마다 strcmp하지 않고, 도중에 끊기면(EOF) 멈춤
+  while ((n = Rio_readlineb(rp, buf, MAXLINE)) > 0)
   {
-    Rio_readlineb(rp, buf, MAXLINE);
+    if (n <= 2 && (buf[0] == '\n' || (buf[0] == '\r' && buf[1] == '\n')))
+      break;
     printf("%s", buf);
   }
   return;
@@ -0,0 +1,207 @@
+/*
+ * tunnel.c - CONNECT 양방향 터널 (tunnel.h 참고)
+ *
+ * splice, pipe2는 _GNU_SOURCE에서만 선언되는데 csapp.h와 같이 쓰면 gai_error()가 겹치므로 csapp.h 없이 씀.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "tunnel.h"
+#include "ratelimit.h"
+
+// 한 방향의 상태. 아직 dst에 쓰지 못한 byte는 pipe 안에 (또는 buf 안에) 있음
+typedef struct
+{
+  int src, dst;
+  int pipefd[2]; // splice용 pipe (-1이면 read/write로 옮김)
+  char *buf;     // read/write로 옮길 때의 버퍼 (그때만 잡음)
+  size_t off;    // buf에서 다음에 쓸 위치
+  size_t len;    // 쓰지 못하고 남아있는 byte 수
+  long moved;    // dst에 쓴 byte 수
+  int full;      // pipe가 찼음 (page 단위로 차므로 TUNNEL_CHUNK보다 먼저 찰 수 있음. 쓰고 나면 다시 읽음)
+  int eof;       // src가 끝남 (EOF 또는 에러)
+  int done;      // 남은 것을 다 쓰고 dst 쓰기를 닫음
+} tunnel_dir;
+
+static tunnel_stats stats;
+
+/* splice를 쓸 수 없으면 이 방향은 read/write로 옮김 */
+static void dir_copyMode(tunnel_dir *d)
+{
+  if (d->pipefd[0] >= 0)
+  {
+    close(d->pipefd[0]);
+    close(d->pipefd[1]);
+    d->pipefd[0] = d->pipefd[1] = -1;
+  }
+  if (!d->buf && !(d->buf = malloc(TUNNEL_CHUNK)))
+    d->eof = 1; // 옮길 수 없으니 닫음
+  __atomic_fetch_add(&stats.copied, 1, __ATOMIC_RELAXED);
+}
+
+static void dir_init(tunnel_dir *d, int src, int dst)
+{
+  d->src = src;
+  d->dst = dst;
+  d->buf = NULL;
+  d->off = d->len = 0;
+  d->moved = 0;
+  d->full = d->eof = d->done = 0;
+  if (pipe2(d->pipefd, O_NONBLOCK | O_CLOEXEC) < 0)
+  {
+    d->pipefd[0] = d->pipefd[1] = -1;
+    dir_copyMode(d);
+  }
+}
+
+/* src에서 읽을 수 있는 만큼 pipe(또는 buf)로 받음 */
+static void dir_fill(tunnel_dir *d)
+{
+  ssize_t n;
+
+  if (d->pipefd[0] >= 0)
+  {
+    n = splice(d->src, NULL, d->pipefd[1], NULL, TUNNEL_CHUNK - d->len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n < 0 && errno == EINVAL && !d->len && !d->moved) // splice를 지원하지 않는 fd
+      dir_copyMode(d);
+    else
+      goto got;
+  }
+  if (d->eof || d->len) // buf는 다 쓴 다음에 다시 채움
+    return;
+  n = read(d->src, d->buf, TUNNEL_CHUNK);
+  d->off = 0;
+got:
+  if (n > 0)
+    d->len += n;
+  else if (n < 0 && errno == EAGAIN && d->len) // src에는 있는데 pipe에 자리가 없음
+    d->full = 1;
+  else if (n == 0 || (errno != EAGAIN && errno != EINTR)) // 끝났거나 끊김 (timer가 끊은 경우 포함)
+    d->eof = 1;
+}
+
+/* 남은 것을 dst에 쓸 수 있는 만큼 씀. dst가 끊겼으면 -1 */
+static int dir_drain(tunnel_dir *d, tw_timer *timer, unsigned client, unsigned origin, int limited)
+{
+  size_t want;
+  ssize_t n;
+  long maxWaitMs;
+
+  while (d->len)
+  {
+    want = limited && d->len > RL_CHUNK ? RL_CHUNK : d->len; // byte 제한이 있으면 나누어 쓰고 쓴 만큼 기다림
+    if (d->pipefd[0] >= 0)
+      n = splice(d->pipefd[0], NULL, d->dst, NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    else
+      n = write(d->dst, d->buf + d->off, want);
+    if (n < 0)
+      return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    d->len -= n;
+    d->off += n;
+    d->moved += n;
+    d->full = 0;
+    if (timer)
+      tw_touch(timer);
+    if (limited) // 기다리는 동안 idle 제한 시간 (또는 남은 전체 시간)이 지나버리면 끊긴 것으로 봄
+    {
+      maxWaitMs = timer ? timer->totalDeadline - tw_now() : -1;
+      if (timer && timer->idleMs < maxWaitMs)
+        maxWaitMs = timer->idleMs;
+      if (rl_bytes(client, origin, n, maxWaitMs, timer ? &timer->expired : NULL) < 0)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+static void dir_free(tunnel_dir *d)
+{
+  if (d->pipefd[0] >= 0)
+  {
+    close(d->pipefd[0]);
+    close(d->pipefd[1]);
+  }
+  free(d->buf);
+}
+
+void tunnel_relay(int clientfd, int serverfd, tw_timer *timer, unsigned client, unsigned origin, long bytes[TUNNEL_DIRS])
+{
+  tunnel_dir dirs[TUNNEL_DIRS];
+  struct pollfd pfds[2 * TUNNEL_DIRS];
+  int in[TUNNEL_DIRS], out[TUNNEL_DIRS];
+  int i, n, broken = 0;
+
+  __atomic_fetch_add(&stats.active, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats.total, 1, __ATOMIC_RELAXED);
+  fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL, 0) | O_NONBLOCK); // 한쪽이 막혀도 다른 방향은 계속 옮기도록
+  fcntl(serverfd, F_SETFL, fcntl(serverfd, F_GETFL, 0) | O_NONBLOCK);
+  dir_init(&dirs[TUNNEL_UP], clientfd, serverfd);
+  dir_init(&dirs[TUNNEL_DOWN], serverfd, clientfd);
+
+  while (!broken && !(dirs[TUNNEL_UP].done && dirs[TUNNEL_DOWN].done))
+  {
+    // 방향마다 pipe에 자리가 있으면 src를 읽을 수 있을 때, 남은 게 있으면 dst에 쓸 수 있을 때 깨어남
+    for (i = n = 0; i < TUNNEL_DIRS; i++)
+    {
+      tunnel_dir *d = &dirs[i];
+      in[i] = out[i] = -1;
+      if (d->done)
+        continue;
+      if (!d->eof && !d->full && d->len < TUNNEL_CHUNK && (d->pipefd[0] >= 0 || !d->len))
+      {
+        pfds[n].fd = d->src;
+        pfds[n].events = POLLIN;
+        in[i] = n++;
+      }
+      if (d->len)
+      {
+        pfds[n].fd = d->dst;
+        pfds[n].events = POLLOUT;
+        out[i] = n++;
+      }
+    }
+    if (poll(pfds, n, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    for (i = 0; i < TUNNEL_DIRS; i++)
+    {
+      tunnel_dir *d = &dirs[i];
+      int filled = in[i] >= 0 && pfds[in[i]].revents;
+      if (filled)
+        dir_fill(d);
+      // 받은 것은 POLLOUT을 기다리지 않고 바로 써봄 (대개 바로 써짐)
+      if ((filled || (out[i] >= 0 && pfds[out[i]].revents)) &&
+          dir_drain(d, timer, client, origin, i == TUNNEL_DOWN && rl_bytesLimited()) < 0)
+        broken = 1; // 받는 쪽이 끊김. 반대 방향도 더 옮길 수 없음
+      if (d->eof && !d->len && !d->done) // 다 넘겼으면 반대쪽에 EOF를 전함 (다른 방향은 계속)
+      {
+        shutdown(d->dst, SHUT_WR);
+        d->done = 1;
+      }
+    }
+  }
+
+  for (i = 0; i < TUNNEL_DIRS; i++)
+  {
+    bytes[i] += dirs[i].moved;
+    __atomic_fetch_add(&stats.bytes[i], bytes[i], __ATOMIC_RELAXED);
+    dir_free(&dirs[i]);
+  }
+  __atomic_fetch_sub(&stats.active, 1, __ATOMIC_RELAXED);
+}
+
+void tunnel_getStats(tunnel_stats *out)
+{
+  out->active = __atomic_load_n(&stats.active, __ATOMIC_RELAXED);
+  out->total = __atomic_load_n(&stats.total, __ATOMIC_RELAXED);
+  for (int i = 0; i < TUNNEL_DIRS; i++)
+    out->bytes[i] = __atomic_load_n(&stats.bytes[i], __ATOMIC_RELAXED);
+  out->copied = __atomic_load_n(&stats.copied, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,39 @@
+/*
+ * tunnel.h - CONNECT 요청의 양방향 터널 (클라이언트 <-> endserver byte를 그대로 옮김)
+ *
+ * 터널 하나를 요청 쓰레드 하나가 poll로 두 소켓을 같이 보면서 옮김 (방향마다 blocking 쓰레드를 두지 않음).
+ * 방향마다 pipe를 하나 두고 splice()로 소켓 -> pipe -> 소켓으로 옮겨서 user 공간으로 복사하지 않음.
+ * pipe를 만들 수 없거나 splice를 쓸 수 없는 fd면 그 방향만 read/write로 옮김.
+ * 한쪽이 EOF를 보내면 남은 것을 다 넘긴 뒤 반대쪽에 쓰기만 닫고 (half-close), 다른 방향은 계속 옮김.
+ * 제한 시간은 따로 재지 않음. 옮길 때마다 timer를 touch하고, 멈춰있으면 timer wheel이 두 소켓을 끊어서 끝남.
+ */
+#ifndef __TUNNEL_H__
+#define __TUNNEL_H__
+
+#include <stddef.h>
+#include "timerwheel.h"
+
+#define TUNNEL_CHUNK 65536 // 한번에 옮기는 최대 크기 (pipe 기본 크기)
+
+enum
+{
+  TUNNEL_UP = 0, // 클라이언트 -> endserver
+  TUNNEL_DOWN,   // endserver -> 클라이언트
+  TUNNEL_DIRS
+};
+
+typedef struct
+{
+  long active;              // 지금 열려있는 터널 수
+  long total;               // 지금까지 연 터널 수
+  long bytes[TUNNEL_DIRS];  // 방향별로 옮긴 byte 수 (끝난 터널만)
+  long copied;              // splice를 쓰지 못하고 read/write로 옮긴 방향 수
+} tunnel_stats;
+
+// clientfd와 serverfd 사이를 둘 다 끝날 때까지 옮김. bytes에 방향별로 옮긴 byte 수를 더함
+// (부르기 전에 먼저 넘긴 데이터가 있으면 bytes에 넣어두면 집계에도 같이 들어감)
+// timer는 옮길 때마다 touch함 (NULL이면 안 함). byte 제한이 있으면 클라이언트로 보내는 만큼 client, origin bucket에서 씀
+void tunnel_relay(int clientfd, int serverfd, tw_timer *timer, unsigned client, unsigned origin, long bytes[TUNNEL_DIRS]);
+void tunnel_getStats(tunnel_stats *out);
+
+#endif /* __TUNNEL_H__ */